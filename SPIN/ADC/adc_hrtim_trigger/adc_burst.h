@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2021-2024 LAAS-CNRS
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published by
+ *   the Free Software Foundation, either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGLPV2.1
+ */
+
+/**
+ * @brief  Oversampled and averaged acquisition of several ADC channels.
+ *
+ *         The ADC is triggered by the HRTIM at each switching period and
+ *         converts all its enabled channels. Two averages are stacked:
+ *
+ *         - the oversampler of the ADC, `enableOversampling()`: each trigger
+ *           makes a burst of 2^n conversions of each channel, summed and
+ *           shifted by the ADC itself, the result is still 12 bits,
+ *         - `acquire()`: the critical task gets with `data.getValues()` all
+ *           the values of each channel since its previous call, one per
+ *           switching period (20 at 200 kHz for a 100 us task), and
+ *           averages them.
+ *
+ *         The last burst of a channel can be copied by `copyBurst()`, in the
+ *         critical task too: the values are in the buffers of the data API
+ *         until the next `acquire()`. The average of a channel without a new
+ *         value keeps its previous value.
+ */
+
+#ifndef ADC_BURST_H_
+#define ADC_BURST_H_
+
+#include <soc.h> // ADC_TypeDef
+#include <stm32_ll_adc.h>
+
+#include "DataAPI.h"
+
+struct adc_burst_channel
+{
+    uint8_t adc;
+    uint8_t pin;
+};
+
+/**
+ * @brief hardware oversampling of the regular channels of an ADC, to be
+ * called before the start of the acquisition.
+ *
+ * @param ratio LL_ADC_OVS_RATIO_x, number of conversions per trigger.
+ * @param shift LL_ADC_OVS_SHIFT_RIGHT_x, log2 of the ratio to keep 12 bits.
+ */
+inline void enableOversampling(ADC_TypeDef *adc, uint32_t ratio, uint32_t shift)
+{
+    LL_ADC_SetOverSamplingScope(adc, LL_ADC_OVS_GRP_REGULAR_CONTINUED);
+    LL_ADC_ConfigOverSamplingRatioShift(adc, ratio, shift);
+    LL_ADC_SetOverSamplingDiscont(adc, LL_ADC_OVS_REG_CONT); // whole burst on each trigger
+}
+
+template <uint8_t N>
+class AdcBurst
+{
+public:
+    AdcBurst(const adc_burst_channel (&channels)[N])
+    {
+        for (uint8_t k = 0; k < N; k++) {
+            this->channels[k] = channels[k];
+            mean[k] = 0.0F;
+            burst[k] = nullptr;
+            nb_samples[k] = 0;
+        }
+    }
+
+    /**
+     * @brief enable the acquisition of all the channels.
+     */
+    void enable()
+    {
+        for (uint8_t k = 0; k < N; k++) {
+            data.enableAcquisition(channels[k].adc, channels[k].pin);
+        }
+    }
+
+    /**
+     * @brief get and average the values of all the channels since the
+     * previous call, in the critical task.
+     */
+    void acquire()
+    {
+        for (uint8_t k = 0; k < N; k++) {
+            uint32_t n = 0;
+            float32_t *values = data.getValues(channels[k].adc, channels[k].pin, n);
+            burst[k] = values;
+            nb_samples[k] = n;
+            if (n == 0) {
+                continue;
+            }
+            float32_t sum = 0.0F;
+            for (uint32_t i = 0; i < n; i++) {
+                sum += values[i];
+            }
+            mean[k] = sum / n;
+        }
+    }
+
+    /**
+     * @return average of the channel k at the last `acquire()`.
+     */
+    float32_t getMean(uint8_t k) { return mean[k]; }
+
+    /**
+     * @return number of values of the channel k at the last `acquire()`.
+     */
+    uint32_t getNbSamples(uint8_t k) { return nb_samples[k]; }
+
+    /**
+     * @brief copy the values of the channel k at the last `acquire()`.
+     *
+     * @return number of values copied, at most `size`.
+     */
+    uint32_t copyBurst(uint8_t k, float32_t *buffer, uint32_t size)
+    {
+        uint32_t n = nb_samples[k] < size ? nb_samples[k] : size;
+        for (uint32_t i = 0; i < n; i++) {
+            buffer[i] = burst[k][i];
+        }
+        return n;
+    }
+
+private:
+    adc_burst_channel channels[N];
+    float32_t mean[N];
+    float32_t *burst[N];  // buffer of the data API, valid until the next acquire()
+    uint32_t nb_samples[N];
+};
+
+#endif // ADC_BURST_H_
@@ -33,6 +33,7 @@
 #include "TaskAPI.h"
 #include "TwistAPI.h"
 #include "SpinAPI.h"
+#include "adc_burst.h"
 
 //--------------SETUP FUNCTIONS DECLARATION-------------------
 void setup_routine(); // Setups the hardware and software of the system
@@ -44,6 +45,20 @@ void loop_critical_task();     // Code to be executed in real time in the critic
 //--------------USER VARIABLES DECLARATIONS-------------------
 static float32_t adc_value;
 
+/* Several channels of ADC 2, oversampled and averaged over the critical task */
+#define ADC_BURST // Comment to read only the latest value of pin 35
+
+static const adc_burst_channel burst_channels[] = {
+    {2, 35}, // PC4, ADC2 channel 5
+    {2, 29}, // PA0, ADC2 channel 1
+    {2, 30}, // PA1, ADC2 channel 2
+};
+static AdcBurst<3> burst(burst_channels);
+
+#define BURST_SIZE 32
+static float32_t burst_values[BURST_SIZE]; // last burst of pin 35
+static uint32_t burst_size;
+
 
 //--------------SETUP FUNCTIONS-------------------------------
 
@@ -74,7 +89,12 @@ void setup_routine()
 
     spin.adc.configureTriggerSource(2, hrtim_ev1); // ADC 2 configured to be triggered by the PWM
 
+#ifdef ADC_BURST
+    enableOversampling(ADC2, LL_ADC_OVS_RATIO_4, LL_ADC_OVS_SHIFT_RIGHT_2); // 4 conversions per trigger
+    burst.enable();
+#else
     data.enableAcquisition(2, 35); // ADC 2 enabled
+#endif
 
     // Then declare tasks
     uint32_t background_task_number = task.createBackground(loop_background_task);
@@ -95,7 +115,11 @@ void setup_routine()
 void loop_background_task()
 {
     // Task content
+#ifdef ADC_BURST
+    printk("%f:%f:%f:%u\n", burst.getMean(0), burst.getMean(1), burst.getMean(2), burst_size);
+#else
     printk("%f \n", adc_value);
+#endif
 
     // Pause between two runs of the task
     task.suspendBackgroundMs(100);
@@ -109,7 +133,13 @@ void loop_background_task()
  */
 void loop_critical_task()
 {
+#ifdef ADC_BURST
+    burst.acquire();
+    adc_value = burst.getMean(0);
+    burst_size = burst.copyBurst(0, burst_values, BURST_SIZE);
+#else
     adc_value = data.getLatest(2, 35);
+#endif
 }
 
 /**
@@ -33,18 +33,37 @@
 #include "TaskAPI.h"
 #include "TwistAPI.h"
 #include "SpinAPI.h"
+#include "waveform_player.h"
+
+#include "zephyr/console/console.h"
 
 //--------------SETUP FUNCTIONS DECLARATION-------------------
 void setup_routine(); // Setups the hardware and software of the system
 
 //--------------LOOP FUNCTIONS DECLARATION--------------------
 void loop_background_task();   // Code to be executed in the background task
+void loop_communication_task(); // code to be executed in the slow communication task
 void loop_critical_task();     // Code to be executed in real time in the critical task
 
 //--------------USER VARIABLES DECLARATIONS-------------------
 
 static uint32_t dac_value;
 
+/* Waveform played by DMA, without the CPU */
+#define ARBITRARY_WAVEFORM // Comment to increment the DAC from the background task
+
+#define WAVEFORM_SAMPLES 256
+#define CHIRP_SAMPLES 8192 // 80 ms at CHIRP_SAMPLE_RATE, 8 periods of 100 Hz
+
+static WaveformPlayer player;
+static float32_t sample_rate = 256000; // [Hz] 1 kHz for 256 samples
+static float32_t chirp_rate = 102400;  // [Hz] 10 samples per period of 10 kHz
+static uint16_t waveform[WAVEFORM_SAMPLES];
+static uint16_t chirp[CHIRP_SAMPLES];
+static const uint16_t user_waveform[8] = {0, 4095, 0, 2048, 2048, 4095, 4095, 0};
+
+uint8_t received_serial_char;
+
 //--------------SETUP FUNCTIONS-------------------------------
 
 /**
@@ -61,7 +80,16 @@ void setup_routine()
     spin.dac.initConstValue(2); // DAC initialization
     spin.dac.setConstValue(2, 1, 0);
 
+#ifdef ARBITRARY_WAVEFORM
+    player.init(DAC2, WAVEFORM_TRIGGER_TIMER);
+    sample_rate = player.setSampleRate(sample_rate);
+    fillSine(waveform, WAVEFORM_SAMPLES, 0.1, 1.9);
+    player.play(waveform, WAVEFORM_SAMPLES);
+
+    uint32_t background_task_number = task.createBackground(loop_communication_task);
+#else
     uint32_t background_task_number = task.createBackground(loop_background_task);
+#endif
     //task.createCritical(loop_critical_task, 500); // Uncomment if you use the critical task
 
     // Finally, start tasks
@@ -87,6 +115,60 @@ void loop_background_task()
     task.suspendBackgroundMs(100);
 }
 
+/**
+ * This is the code loop of the communication task, it changes the waveform.
+ */
+void loop_communication_task()
+{
+    while (1)
+    {
+        received_serial_char = console_getchar();
+        switch (received_serial_char)
+        {
+        case 'h':
+            //----------SERIAL INTERFACE MENU-----------------------
+            printk(" ________________________________________\n");
+            printk("|     ------- MENU DAC waveform -------  |\n");
+            printk("|     press s : sine                     |\n");
+            printk("|     press t : triangle                 |\n");
+            printk("|     press c : chirp 100 Hz to 10 kHz   |\n");
+            printk("|     press u : user table               |\n");
+            printk("|________________________________________|\n\n");
+            //------------------------------------------------------
+            break;
+        case 's':
+            player.stop();
+            sample_rate = player.setSampleRate(sample_rate);
+            fillSine(waveform, WAVEFORM_SAMPLES, 0.1, 1.9);
+            player.play(waveform, WAVEFORM_SAMPLES);
+            printk("sine %f Hz\n", sample_rate / WAVEFORM_SAMPLES);
+            break;
+        case 't':
+            player.stop();
+            sample_rate = player.setSampleRate(sample_rate);
+            fillTriangle(waveform, WAVEFORM_SAMPLES, 0.1, 1.9);
+            player.play(waveform, WAVEFORM_SAMPLES);
+            printk("triangle %f Hz\n", sample_rate / WAVEFORM_SAMPLES);
+            break;
+        case 'c':
+            // its own table and rate: 100 Hz needs a long table, 10 kHz a fast rate
+            player.stop();
+            chirp_rate = player.setSampleRate(chirp_rate);
+            fillChirp(chirp, CHIRP_SAMPLES, chirp_rate, 100, 10000, 0.1, 1.9);
+            player.play(chirp, CHIRP_SAMPLES);
+            printk("chirp %f ms\n", 1000.0F * CHIRP_SAMPLES / chirp_rate);
+            break;
+        case 'u':
+            sample_rate = player.setSampleRate(sample_rate);
+            player.play(user_waveform, 8);
+            printk("user table %f Hz\n", sample_rate / 8);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
 /**
  * This is the code loop of the critical task
  * It is executed every 500 micro-seconds defined in the setup_software function.
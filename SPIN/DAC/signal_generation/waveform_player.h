@@ -0,0 +1,206 @@
+/*
+ * Copyright (c) 2021-2024 LAAS-CNRS
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published by
+ *   the Free Software Foundation, either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGLPV2.1
+ */
+
+/**
+ * @brief  Arbitrary waveform played by the DAC from a table, by DMA.
+ *
+ *         The table is read in a loop by a circular DMA channel, one sample
+ *         per trigger of the DAC:
+ *         - WAVEFORM_TRIGGER_TIMER: TIM7 at the sample rate given to
+ *           `setSampleRate()`,
+ *         - WAVEFORM_TRIGGER_HRTIM: the DAC trigger 1 of the HRTIM, sent at
+ *           each period of the given HRTIM timer, the sample rate is then
+ *           the switching frequency.
+ *
+ *         Once started the CPU is not used. The frequency of the waveform is
+ *         the sample rate divided by the number of samples of the table.
+ *
+ *         A table must not be written while it is played: `stop()` first
+ *         turns off the DMA requests of the DAC, then the channel, so that a
+ *         trigger of the stopped table does not leave the DAC in DMA
+ *         underrun; `play()` clears the underrun before starting again.
+ *
+ *         The tables are in DAC values, 0 to 4095 for 0 to 2.048 V.
+ *         `fillSine()`, `fillTriangle()` and `fillChirp()` compute the usual
+ *         ones, any other table can be given to `play()`.
+ *
+ *         TIM6 is used by the critical task, TIM4 by the encoder, the player
+ *         uses TIM7 and the channel 3 of DMA2.
+ */
+
+#ifndef WAVEFORM_PLAYER_H_
+#define WAVEFORM_PLAYER_H_
+
+#include <soc.h> // SystemCoreClock
+#include <stm32_ll_bus.h>
+#include <stm32_ll_dac.h>
+#include <stm32_ll_dma.h>
+#include <stm32_ll_hrtim.h>
+#include <stm32_ll_tim.h>
+
+#include <math.h>
+#include "arm_math.h" // float32_t, PI
+
+#define WAVEFORM_DMA_CHANNEL LL_DMA_CHANNEL_3
+#define WAVEFORM_DAC_MAX 4095.0F
+#define WAVEFORM_DAC_VOLT 2.048F // [V] full scale of the DAC
+
+enum waveform_trigger_t
+{
+    WAVEFORM_TRIGGER_TIMER = 0,
+    WAVEFORM_TRIGGER_HRTIM
+};
+
+/**
+ * @param low, high [V] bounds of the waveform.
+ */
+inline uint16_t waveformValue(float32_t x, float32_t low, float32_t high)
+{
+    float32_t v = (low + (high - low) * x) * (WAVEFORM_DAC_MAX / WAVEFORM_DAC_VOLT);
+    v = v < 0.0F ? 0.0F : (v > WAVEFORM_DAC_MAX ? WAVEFORM_DAC_MAX : v);
+    return (uint16_t) (v + 0.5F);
+}
+
+/**
+ * @brief one period of a sine, from low to high [V].
+ */
+inline void fillSine(uint16_t *table, uint16_t size, float32_t low, float32_t high)
+{
+    for (uint16_t k = 0; k < size; k++) {
+        float32_t x = 0.5F + 0.5F * sinf(2.0F * PI * k / size);
+        table[k] = waveformValue(x, low, high);
+    }
+}
+
+/**
+ * @brief one period of a triangle, from low to high [V].
+ */
+inline void fillTriangle(uint16_t *table, uint16_t size, float32_t low, float32_t high)
+{
+    for (uint16_t k = 0; k < size; k++) {
+        float32_t x = 2.0F * k / size;
+        table[k] = waveformValue(x < 1.0F ? x : 2.0F - x, low, high);
+    }
+}
+
+/**
+ * @brief linear chirp from f_start to f_end [Hz], sampled at sample_rate [Hz],
+ * from low to high [V]. It lasts size / sample_rate then starts again, the
+ * table must be long enough for a few periods of f_start and the sample rate
+ * several times f_end.
+ */
+inline void fillChirp(uint16_t *table, uint16_t size, float32_t sample_rate,
+                      float32_t f_start, float32_t f_end, float32_t low, float32_t high)
+{
+    float32_t duration = size / sample_rate;
+    for (uint16_t k = 0; k < size; k++) {
+        float32_t t = k / sample_rate;
+        float32_t cycles = f_start * t + 0.5F * (f_end - f_start) * t * t / duration;
+        cycles -= floorf(cycles); // the phase stays accurate over hundreds of periods
+        table[k] = waveformValue(0.5F + 0.5F * sinf(2.0F * PI * cycles), low, high);
+    }
+}
+
+class WaveformPlayer
+{
+public:
+    /**
+     * @brief take the channel 1 of a DAC initialised by
+     * `spin.dac.initConstValue()`.
+     *
+     * @param dac         DAC1 (PA4) or DAC2 (PA6).
+     * @param trigger     trigger of the samples.
+     * @param hrtim_timer LL_HRTIM_TIMER_x sending the trigger, HRTIM trigger only.
+     */
+    void init(DAC_TypeDef *dac, waveform_trigger_t trigger,
+              uint32_t hrtim_timer = LL_HRTIM_TIMER_A)
+    {
+        this->dac = dac;
+        LL_AHB1_GRP1_EnableClock(LL_AHB1_GRP1_PERIPH_DMA2 | LL_AHB1_GRP1_PERIPH_DMAMUX1);
+        LL_DMA_ConfigTransfer(DMA2, WAVEFORM_DMA_CHANNEL,
+                              LL_DMA_DIRECTION_MEMORY_TO_PERIPH | LL_DMA_MODE_CIRCULAR |
+                              LL_DMA_PERIPH_NOINCREMENT | LL_DMA_MEMORY_INCREMENT |
+                              LL_DMA_PDATAALIGN_WORD | LL_DMA_MDATAALIGN_HALFWORD |
+                              LL_DMA_PRIORITY_MEDIUM);
+        LL_DMA_SetPeriphRequest(DMA2, WAVEFORM_DMA_CHANNEL,
+                                dac == DAC1 ? LL_DMAMUX_REQ_DAC1_CH1 : LL_DMAMUX_REQ_DAC2_CH1);
+        LL_DMA_SetPeriphAddress(DMA2, WAVEFORM_DMA_CHANNEL,
+                                LL_DAC_DMA_GetRegAddr(dac, LL_DAC_CHANNEL_1,
+                                                      LL_DAC_DMA_REG_DATA_12BITS_RIGHT_ALIGNED));
+
+        // the trigger can only be changed while the channel is disabled
+        LL_DAC_Disable(dac, LL_DAC_CHANNEL_1);
+        if (trigger == WAVEFORM_TRIGGER_TIMER) {
+            LL_APB1_GRP1_EnableClock(LL_APB1_GRP1_PERIPH_TIM7);
+            LL_TIM_SetTriggerOutput(TIM7, LL_TIM_TRGO_UPDATE);
+            LL_DAC_SetTriggerSource(dac, LL_DAC_CHANNEL_1, LL_DAC_TRIG_EXT_TIM7_TRGO);
+        } else {
+            LL_HRTIM_TIM_SetDACTrig(HRTIM1, hrtim_timer, LL_HRTIM_DACTRIG_DACTRIGOUT_1);
+            LL_DAC_SetTriggerSource(dac, LL_DAC_CHANNEL_1, LL_DAC_TRIG_EXT_HRTIM_TRGO1);
+        }
+        LL_DAC_EnableTrigger(dac, LL_DAC_CHANNEL_1);
+        LL_DAC_Enable(dac, LL_DAC_CHANNEL_1); // the DMA requests are enabled by play()
+    }
+
+    /**
+     * @brief sample rate of the timer trigger, up to 1 MHz.
+     *
+     * @return [Hz] actual sample rate, the closest division of the clock.
+     */
+    float32_t setSampleRate(float32_t rate)
+    {
+        uint32_t ticks = (uint32_t) ((float32_t) SystemCoreClock / rate + 0.5F);
+        uint32_t prescaler = ticks / 65536 + 1;
+        uint32_t reload = ticks / prescaler;
+        LL_TIM_DisableCounter(TIM7);
+        LL_TIM_SetPrescaler(TIM7, prescaler - 1);
+        LL_TIM_SetAutoReload(TIM7, reload - 1);
+        LL_TIM_GenerateEvent_UPDATE(TIM7);
+        LL_TIM_EnableCounter(TIM7);
+        return (float32_t) SystemCoreClock / (prescaler * reload);
+    }
+
+    /**
+     * @brief play a table in a loop, it must stay valid while played.
+     */
+    void play(const uint16_t *table, uint16_t size)
+    {
+        stop();
+        LL_DMA_SetMemoryAddress(DMA2, WAVEFORM_DMA_CHANNEL, (uint32_t) table);
+        LL_DMA_SetDataLength(DMA2, WAVEFORM_DMA_CHANNEL, size);
+        LL_DAC_ClearFlag_DMAUDR1(dac);
+        LL_DAC_EnableDMAReq(dac, LL_DAC_CHANNEL_1);
+        LL_DMA_EnableChannel(DMA2, WAVEFORM_DMA_CHANNEL);
+    }
+
+    /**
+     * @brief stop the DMA, the DAC keeps its last value, the table can be
+     * written.
+     */
+    void stop()
+    {
+        LL_DAC_DisableDMAReq(dac, LL_DAC_CHANNEL_1);
+        LL_DMA_DisableChannel(DMA2, WAVEFORM_DMA_CHANNEL);
+    }
+
+private:
+    DAC_TypeDef *dac;
+};
+
+#endif // WAVEFORM_PLAYER_H_
@@ -33,6 +33,7 @@
 #include "TaskAPI.h"
 #include "TwistAPI.h"
 #include "SpinAPI.h"
+#include "pwm_batch.h"
 
 #include "zephyr/console/console.h"
 
@@ -49,6 +50,14 @@ uint8_t received_serial_char;
 
 float32_t duty_cycle = 0.3;
 
+/* The duty cycles and phase shifts of all the units are applied together */
+#define PWM_BATCH // Comment to write the duty cycles one unit after the other
+
+static const hrtim_tu_number_t units[] = {PWMA, PWMC, PWMD, PWME, PWMF};
+static const uint8_t nb_units = sizeof(units) / sizeof(units[0]);
+static PwmBatch batch;
+static bool interleaved = true; // phase shifts of 360/5 degrees, else in phase
+
 //---------------------------------------------------------------
 
 enum serial_interface_menu_mode // LIST OF POSSIBLE MODES FOR THE OWNTECH CONVERTER
@@ -147,6 +156,7 @@ void loop_communication_task()
             printk("|     ------- MENU ---------             |\n");
             printk("|     press u : duty cycle UP            |\n");
             printk("|     press d : duty cycle DOWN          |\n");
+            printk("|     press s : interleaved / in phase   |\n");
             printk("|________________________________________|\n\n");
             //------------------------------------------------------
             break;
@@ -156,6 +166,10 @@ void loop_communication_task()
         case 'd':
             duty_cycle -= 0.05;
             break;
+        case 's':
+            interleaved = !interleaved;
+            printk(interleaved ? "interleaved\n" : "in phase\n");
+            break;
         default:
             break;
         }
@@ -185,11 +199,20 @@ void loop_application_task()
  */
 void loop_critical_task()
 {
+#ifdef PWM_BATCH
+        batch.setDutyCycle(units[0], duty_cycle); // PWMA is the reference of the phases
+        for (uint8_t k = 1; k < nb_units; k++) {
+            batch.setDutyCycle(units[k], duty_cycle);
+            batch.setPhaseShift(units[k], interleaved ? k * 360 / nb_units : 0);
+        }
+        batch.commit();
+#else
         spin.pwm.setDutyCycle(PWMA, duty_cycle);
         spin.pwm.setDutyCycle(PWMC, duty_cycle);
         spin.pwm.setDutyCycle(PWMD, duty_cycle);
         spin.pwm.setDutyCycle(PWME, duty_cycle);
         spin.pwm.setDutyCycle(PWMF, duty_cycle);
+#endif
 }
 
 /**
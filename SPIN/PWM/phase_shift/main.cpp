@@ -33,6 +33,7 @@
 #include "TaskAPI.h"
 #include "TwistAPI.h"
 #include "SpinAPI.h"
+#include "pwm_batch.h"
 
 #include "zephyr/console/console.h"
 
@@ -49,6 +50,10 @@ uint8_t received_serial_char;
 
 float32_t duty_cycle = 0.3;
 
+#define PWM_BATCH // Comment to write the duty cycles one unit after the other
+
+static PwmBatch batch; // PWMA and PWMC updated in the same switching period
+
 //---------------------------------------------------------------
 
 enum serial_interface_menu_mode // LIST OF POSSIBLE MODES FOR THE OWNTECH CONVERTER
@@ -149,8 +154,14 @@ void loop_application_task()
  */
 void loop_critical_task()
 {
+#ifdef PWM_BATCH
+        batch.setDutyCycle(PWMA, duty_cycle);
+        batch.setDutyCycle(PWMC, duty_cycle);
+        batch.commit();
+#else
         spin.pwm.setDutyCycle(PWMA, duty_cycle);
         spin.pwm.setDutyCycle(PWMC, duty_cycle);
+#endif
 }
 
 /**
@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2021-2024 LAAS-CNRS
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published by
+ *   the Free Software Foundation, either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGLPV2.1
+ */
+
+/**
+ * @brief  Duty cycles and phase shifts of several PWM units applied together.
+ *
+ *         `spin.pwm.setDutyCycle()` writes the preload compare registers of
+ *         one HRTIM timer, which are copied to the active registers at the
+ *         next update of this timer. Written one after the other, the units
+ *         may not be updated in the same switching period.
+ *
+ *         The values are staged with `setDutyCycle()` and `setPhaseShift()`,
+ *         then `commit()` suspends the update of all the timers (UDIS bits,
+ *         the preload registers are not copied), writes the staged values
+ *         and resumes the update: all the units of the batch get their new
+ *         values at the same update event.
+ *
+ *         A value equal to the one already committed is not written again.
+ */
+
+#ifndef PWM_BATCH_H_
+#define PWM_BATCH_H_
+
+#include <stm32_ll_hrtim.h>
+
+#include "SpinAPI.h"
+
+#define PWM_BATCH_UNITS 6 // PWMA to PWMF
+
+class PwmBatch
+{
+public:
+    PwmBatch()
+    {
+        for (uint8_t k = 0; k < PWM_BATCH_UNITS; k++) {
+            duty_cycle[k] = -1.0F; // never committed
+            phase_shift[k] = -1;
+        }
+    }
+
+    void setDutyCycle(hrtim_tu_number_t unit, float32_t value)
+    {
+        if (value != duty_cycle[unit]) {
+            duty_cycle[unit] = value;
+            staged_duty |= 1U << unit;
+        }
+    }
+
+    /**
+     * @param value [deg] phase shift.
+     */
+    void setPhaseShift(hrtim_tu_number_t unit, int16_t value)
+    {
+        if (value != phase_shift[unit]) {
+            phase_shift[unit] = value;
+            staged_phase |= 1U << unit;
+        }
+    }
+
+    /**
+     * @brief write the staged values, applied at the same update event.
+     *
+     * @return number of values written.
+     */
+    uint8_t commit()
+    {
+        uint8_t staged = staged_duty | staged_phase;
+        if (staged == 0) {
+            return 0;
+        }
+        uint32_t timers = LL_HRTIM_TIMER_MASTER; // phase shifts
+        for (uint8_t k = 0; k < PWM_BATCH_UNITS; k++) {
+            if (staged & (1U << k)) {
+                timers |= LL_HRTIM_TIMER_A << k;
+            }
+        }
+
+        uint8_t nb_writes = 0;
+        LL_HRTIM_SuspendUpdate(HRTIM1, timers);
+        for (uint8_t k = 0; k < PWM_BATCH_UNITS; k++) {
+            if (staged_phase & (1U << k)) {
+                spin.pwm.setPhaseShift((hrtim_tu_number_t) k, phase_shift[k]);
+                nb_writes++;
+            }
+            if (staged_duty & (1U << k)) {
+                spin.pwm.setDutyCycle((hrtim_tu_number_t) k, duty_cycle[k]);
+                nb_writes++;
+            }
+        }
+        LL_HRTIM_ResumeUpdate(HRTIM1, timers);
+
+        staged_duty = 0;
+        staged_phase = 0;
+        return nb_writes;
+    }
+
+private:
+    float32_t duty_cycle[PWM_BATCH_UNITS];
+    int16_t phase_shift[PWM_BATCH_UNITS];
+    uint8_t staged_duty = 0;  // bit k: unit k to write
+    uint8_t staged_phase = 0;
+};
+
+#endif // PWM_BATCH_H_
@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2021-2024 LAAS-CNRS
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published by
+ *   the Free Software Foundation, either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGLPV2.1
+ */
+
+/**
+ * @brief  Clarke/Park transforms and synchronous reference frame PLL.
+ *
+ *         The transforms are amplitude invariant and use the cosine
+ *         convention: va = V.cos(theta) gives vd = V, vq = 0 when the frame
+ *         angle is theta.
+ *
+ *         Clarke and Park are fused in one function, the sin and cos of the
+ *         angle are given by the caller so that they are computed once per
+ *         control period for all the transforms. No memory is allocated, the
+ *         results are written in structs given by reference.
+ */
+
+#ifndef DQ_TRANSFORMS_H_
+#define DQ_TRANSFORMS_H_
+
+#include "trigo.h"
+#include "pid.h"
+
+#define ONE_OVER_SQRT3 0.57735026919F
+#define SQRT3_OVER_2 0.86602540378F
+
+struct abc_t
+{
+    float32_t a;
+    float32_t b;
+    float32_t c;
+};
+
+struct dq_t
+{
+    float32_t d;
+    float32_t q;
+};
+
+/**
+ * @brief abc -> dq (Clarke then Park) of the three phases.
+ */
+static inline void abc_to_dq(const abc_t &x, float32_t sin_theta, float32_t cos_theta, dq_t &out)
+{
+    float32_t alpha = (2.0F * x.a - x.b - x.c) * (1.0F / 3.0F);
+    float32_t beta = (x.b - x.c) * ONE_OVER_SQRT3;
+    out.d = alpha * cos_theta + beta * sin_theta;
+    out.q = beta * cos_theta - alpha * sin_theta;
+}
+
+/**
+ * @brief abc -> dq of a balanced system from two of its phases,
+ * c = -a - b, only two sensors are needed.
+ */
+static inline void ab_to_dq(float32_t a, float32_t b, float32_t sin_theta, float32_t cos_theta, dq_t &out)
+{
+    float32_t beta = (a + 2.0F * b) * ONE_OVER_SQRT3;
+    out.d = a * cos_theta + beta * sin_theta;
+    out.q = beta * cos_theta - a * sin_theta;
+}
+
+/**
+ * @brief dq -> abc (inverse Park then inverse Clarke).
+ */
+static inline void dq_to_abc(const dq_t &x, float32_t sin_theta, float32_t cos_theta, abc_t &out)
+{
+    float32_t alpha = x.d * cos_theta - x.q * sin_theta;
+    float32_t beta = x.d * sin_theta + x.q * cos_theta;
+    out.a = alpha;
+    out.b = -0.5F * alpha + SQRT3_OVER_2 * beta;
+    out.c = -0.5F * alpha - SQRT3_OVER_2 * beta;
+}
+
+/**
+ * @brief Synchronous reference frame PLL.
+ *
+ * A PI drives vq to 0, its output is added to the nominal pulsation. The
+ * angle used for the transforms of a period is read with `getSin()` and
+ * `getCos()`, then `calculate(vq)` computes the angle of the next period.
+ */
+class SrfPll
+{
+public:
+    /**
+     * @param Ts [s] sampling period.
+     * @param w0 [rad/s] nominal pulsation.
+     * @param Kp [rad/s/V] proportional gain.
+     * @param Ti [s] integral time constant.
+     * @param dw_max [rad/s] bound of the pulsation deviation.
+     */
+    SrfPll(float32_t Ts, float32_t w0, float32_t Kp, float32_t Ti, float32_t dw_max)
+        : Ts(Ts), w0(w0), params(Ts, Kp, Ti, 0.0F, 0.0F, -dw_max, dw_max)
+    {
+        reset();
+    }
+
+    void reset(float32_t angle = 0.0F)
+    {
+        pi.init(params);
+        this->angle = angle;
+        w = w0;
+        sin_theta = ot_sin(angle);
+        cos_theta = ot_cos(angle);
+    }
+
+    /**
+     * @param vq [V] q component of the voltage in the frame of the current angle.
+     */
+    void calculate(float32_t vq)
+    {
+        w = w0 + pi.calculateWithReturn(vq, 0.0F);
+        angle = ot_modulo_2pi(angle + w * Ts);
+        sin_theta = ot_sin(angle);
+        cos_theta = ot_cos(angle);
+    }
+
+    float32_t getSin() { return sin_theta; }
+    float32_t getCos() { return cos_theta; }
+    float32_t getAngle() { return angle; }
+    float32_t getW() { return w; }
+
+private:
+    const float32_t Ts;
+    const float32_t w0;
+    PidParams params;
+    Pid pi;
+    float32_t angle;
+    float32_t w;
+    float32_t sin_theta;
+    float32_t cos_theta;
+};
+
+#endif // DQ_TRANSFORMS_H_
@@ -0,0 +1,402 @@
+/*
+ * Copyright (c) 2021-2024 LAAS-CNRS
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published by
+ *   the Free Software Foundation, either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGLPV2.1
+ */
+
+/**
+ * @brief  This file it the main entry point of the
+ *         OwnTech Power API. Please check the OwnTech
+ *         documentation for detailed information on
+ *         how to use Power API: https://docs.owntech.org/
+ *
+ * @author Clément Foucher <clement.foucher@laas.fr>
+ * @author Luiz Villa <luiz.villa@laas.fr>
+ * @author Ayoub Farah Hassan <ayoub.farah-hassan@laas.fr>
+ * @author Régis Ruelland <regis.ruelland@laas.fr>
+ */
+
+//--------------OWNTECH APIs----------------------------------
+#include "DataAPI.h"
+#include "TaskAPI.h"
+#include "SpinAPI.h"
+
+// modules from control library
+#include "trigo.h"
+#include "pid.h"
+#include "dq_transforms.h"
+
+#include "zephyr/console/console.h"
+#include "zephyr/kernel.h"
+#include <soc.h> // DWT cycle counter, used by the transforms benchmark
+
+#define DUTY_MIN 0.1F
+#define DUTY_MAX 0.9F
+
+//--------------SETUP FUNCTIONS DECLARATION-------------------
+void setup_routine(); // Setups the hardware and software of the system
+
+//--------------LOOP FUNCTIONS DECLARATION--------------------
+void loop_communication_task(); // code to be executed in the slow communication task
+void loop_application_task();   // Code to be executed in the background task
+void loop_critical_task();     // Code to be executed in real time in the critical task
+
+//--------------USER VARIABLES DECLARATIONS-------------------
+static const uint32_t control_task_period = 100; //[us] period of the control task
+static const float32_t Ts = control_task_period * 1.0e-6F;
+static bool pwm_enable = false;            //[bool] state of the PWM (ctrl task)
+
+uint8_t received_serial_char;
+
+/* Measures: ADC and pins of the sensors of the power stage, to be adapted */
+static const uint8_t ADC_I = 1;   // currents of phases a and b
+static const uint8_t PIN_IA = 29;
+static const uint8_t PIN_IB = 30;
+static const uint8_t ADC_V = 2;   // phase to neutral voltages of phases a and b
+static const uint8_t PIN_VA = 35;
+static const uint8_t PIN_VB = 36;
+
+static float32_t Ia, Ib; // [A]
+static float32_t Va, Vb; // [V]
+static float meas_data; // temp storage meas value (ctrl task)
+
+/* dq variables */
+static dq_t i_dq;      // [A] measured currents
+static dq_t v_dq;      // [V] measured voltages
+static dq_t i_dq_ref = {0.0F, 0.0F}; // [A] current references, d: active, q: reactive
+static dq_t u_dq;      // [V] inverter voltages
+static abc_t u_abc;    // [V]
+static abc_t duty_abc;
+
+/* Power stage */
+static const float32_t Udc = 40.0F;  // [V] dc bus voltage
+static const float32_t L = 1.0e-3F;  // [H] filter inductance
+static const float32_t R = 0.5F;     // [Ohm] resistance of the inductance
+
+/* SRF-PLL: w_n = 2.pi.20 rad/s, damping 0.7 for a 20 V amplitude */
+static const float32_t f0 = 50.0F;
+static const float32_t w0 = 2.0F * PI * f0;
+static const float32_t V_nominal = 20.0F;
+static SrfPll pll(Ts, w0, 2.0F * 0.7F * 2.0F * PI * 20.0F / V_nominal, 2.0F * 0.7F / (2.0F * PI * 20.0F), 100.0F);
+
+/* dq current PI: bandwidth of 1 kHz, the zero compensates the pole L/R */
+static const float32_t Kp_i = L * 2.0F * PI * 1000.0F;
+static const float32_t Ti_i = L / R;
+static const PidParams current_params(Ts, Kp_i, Ti_i, 0.0F, 0.0F, -Udc / 2.0F, Udc / 2.0F);
+static Pid pi_d;
+static Pid pi_q;
+
+//---------------------------------------------------------------
+
+enum serial_interface_menu_mode // LIST OF POSSIBLE MODES FOR THE OWNTECH CONVERTER
+{
+    IDLEMODE = 0,
+    POWERMODE
+};
+
+uint8_t mode = IDLEMODE;
+
+//--------------SETUP FUNCTIONS-------------------------------
+
+float32_t saturate(const float32_t x, float32_t min, float32_t max) {
+    if (x > max) {
+        return max;
+    }
+    if (x < min) {
+        return min;
+    }
+    return x;
+}
+
+/**
+ * Clarke then Park as separate steps, through the alpha/beta frame, to be
+ * compared with the fused `abc_to_dq()`: inlined the same way and given the
+ * same sin/cos.
+ */
+static inline void clarke(const abc_t &x, float32_t &alpha, float32_t &beta)
+{
+    alpha = (2.0F * x.a - x.b - x.c) * (1.0F / 3.0F);
+    beta = (x.b - x.c) * ONE_OVER_SQRT3;
+}
+
+static inline void park(float32_t alpha, float32_t beta, float32_t sin_theta,
+                        float32_t cos_theta, dq_t &out)
+{
+    out.d = alpha * cos_theta + beta * sin_theta;
+    out.q = beta * cos_theta - alpha * sin_theta;
+}
+
+/**
+ * Cycles of the transforms of one control period: the fused kernel of
+ * dq_transforms.h against Clarke and Park called separately, each loop
+ * computing its sin/cos. The interrupts are masked while timing, so it is only available
+ * in idle mode.
+ */
+void transforms_benchmark()
+{
+    const uint32_t nb = 1000;
+    abc_t x = {1.0F, -0.5F, -0.5F};
+    volatile float32_t input = 1.0F; // read at each iteration, not hoisted by the compiler
+    volatile float32_t theta = 0.3F;
+    volatile float32_t sink;
+    float32_t alpha, beta;
+    dq_t y;
+    abc_t z;
+
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    unsigned int key = irq_lock();
+    uint32_t t0 = DWT->CYCCNT;
+    for (uint32_t k = 0; k < nb; k++) {
+        // sin/cos computed once, shared by the abc->dq and dq->abc transforms
+        x.a = input;
+        float32_t s = ot_sin(theta);
+        float32_t c = ot_cos(theta);
+        abc_to_dq(x, s, c, y);
+        dq_to_abc(y, s, c, z);
+        sink = z.a;
+    }
+    uint32_t t1 = DWT->CYCCNT;
+    for (uint32_t k = 0; k < nb; k++) {
+        x.a = input;
+        float32_t s = ot_sin(theta);
+        float32_t c = ot_cos(theta);
+        abc_to_dq(x, s, c, y);
+        sink = y.d;
+    }
+    uint32_t t2 = DWT->CYCCNT;
+    for (uint32_t k = 0; k < nb; k++) {
+        x.a = input;
+        float32_t s = ot_sin(theta);
+        float32_t c = ot_cos(theta);
+        clarke(x, alpha, beta);
+        park(alpha, beta, s, c, y);
+        sink = y.d;
+    }
+    uint32_t t3 = DWT->CYCCNT;
+    irq_unlock(key);
+    (void) sink;
+
+    printk("cycles with sin/cos: abc->dq->abc %u, fused abc->dq %u, clarke+park %u\n",
+           (t1 - t0) / nb, (t2 - t1) / nb, (t3 - t2) / nb);
+}
+
+/**
+ * This is the setup routine.
+ * It is used to call functions that will initialize your spin, twist, data and/or tasks.
+ * In this example, we setup the version of the spin board and a background task.
+ * The critical task is defined but not started.
+ */
+void setup_routine()
+{
+    // Setup the hardware first
+    spin.version.setBoardVersion(SPIN_v_1_0);
+
+    /* one leg per phase, the three carriers are in phase */
+    spin.pwm.setModulation(PWMA, UpDwn);
+    spin.pwm.setAdcEdgeTrigger(PWMA, EdgeTrigger_up);
+    spin.pwm.setMode(PWMA, VOLTAGE_MODE);
+    spin.pwm.initUnit(PWMA); // timer initialization
+
+    spin.pwm.setModulation(PWMC, UpDwn);
+    spin.pwm.setAdcEdgeTrigger(PWMC, EdgeTrigger_up);
+    spin.pwm.setMode(PWMC, VOLTAGE_MODE);
+    spin.pwm.initUnit(PWMC); // timer initialization
+
+    spin.pwm.setModulation(PWMD, UpDwn);
+    spin.pwm.setAdcEdgeTrigger(PWMD, EdgeTrigger_up);
+    spin.pwm.setMode(PWMD, VOLTAGE_MODE);
+    spin.pwm.initUnit(PWMD); // timer initialization
+
+    // the measures are triggered near the trough of the carrier of PWMA
+    spin.pwm.setAdcTrigger(PWMA, ADCTRIG_1);
+    spin.pwm.setAdcTriggerInstant(PWMA, 0.06);
+    spin.pwm.enableAdcTrigger(PWMA);
+    spin.adc.configureTriggerSource(ADC_I, hrtim_ev1);
+    spin.adc.configureTriggerSource(ADC_V, hrtim_ev1);
+
+    data.enableAcquisition(ADC_I, PIN_IA);
+    data.enableAcquisition(ADC_I, PIN_IB);
+    data.enableAcquisition(ADC_V, PIN_VA);
+    data.enableAcquisition(ADC_V, PIN_VB);
+
+    pi_d.init(current_params);
+    pi_q.init(current_params);
+
+    // Then declare tasks
+    uint32_t app_task_number = task.createBackground(loop_application_task);
+    uint32_t com_task_number = task.createBackground(loop_communication_task);
+    task.createCritical(loop_critical_task, control_task_period);
+
+    // Finally, start tasks
+    task.startBackground(app_task_number);
+    task.startBackground(com_task_number);
+    task.startCritical();
+}
+
+//--------------LOOP FUNCTIONS--------------------------------
+
+void loop_communication_task()
+{
+    while (1)
+    {
+        received_serial_char = console_getchar();
+        switch (received_serial_char)
+        {
+        case 'h':
+            //----------SERIAL INTERFACE MENU-----------------------
+            printk(" ________________________________________\n");
+            printk("|     ---- three phase inverter ----     |\n");
+            printk("|     press i : idle mode                |\n");
+            printk("|     press p : power mode               |\n");
+            printk("|     press u : Id reference UP          |\n");
+            printk("|     press d : Id reference DOWN        |\n");
+            printk("|     press q : Iq reference UP          |\n");
+            printk("|     press w : Iq reference DOWN        |\n");
+            printk("|     press b : transforms benchmark     |\n");
+            printk("|________________________________________|\n\n");
+            //------------------------------------------------------
+            break;
+        case 'i':
+            printk("idle mode\n");
+            mode = IDLEMODE;
+            break;
+        case 'p':
+            printk("power mode\n");
+            mode = POWERMODE;
+            break;
+        case 'u':
+            i_dq_ref.d += 0.1F;
+            break;
+        case 'd':
+            i_dq_ref.d -= 0.1F;
+            break;
+        case 'q':
+            i_dq_ref.q += 0.1F;
+            break;
+        case 'w':
+            i_dq_ref.q -= 0.1F;
+            break;
+        case 'b':
+            if (mode == IDLEMODE) {
+                transforms_benchmark();
+            }
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+/**
+ * This is the code loop of the background task
+ * It is executed second as defined by it suspend task in its last line.
+ * You can use it to execute slow code such as state-machines.
+ */
+void loop_application_task()
+{
+    printk("%f:", pll.getW() / (2.0F * PI));
+    printk("%f:", v_dq.d);
+    printk("%f:", v_dq.q);
+    printk("%f:", i_dq_ref.d);
+    printk("%f:", i_dq.d);
+    printk("%f:", i_dq_ref.q);
+    printk("%f\n", i_dq.q);
+
+    task.suspendBackgroundMs(100);
+}
+
+/**
+ * This is the code loop of the critical task
+ * It is executed every 100 micro-seconds defined in the setup_software function.
+ * You can use it to execute an ultra-fast code with the highest priority which cannot be interruped.
+ * It is from it that you will control your power flow.
+ */
+void loop_critical_task()
+{
+    meas_data = data.getLatest(ADC_I, PIN_IA);
+    if (meas_data < 10000 && meas_data > -10000)
+        Ia = meas_data;
+
+    meas_data = data.getLatest(ADC_I, PIN_IB);
+    if (meas_data < 10000 && meas_data > -10000)
+        Ib = meas_data;
+
+    meas_data = data.getLatest(ADC_V, PIN_VA);
+    if (meas_data < 10000 && meas_data > -10000)
+        Va = meas_data;
+
+    meas_data = data.getLatest(ADC_V, PIN_VB);
+    if (meas_data < 10000 && meas_data > -10000)
+        Vb = meas_data;
+
+    // the same sin/cos is used for the voltages and the currents
+    ab_to_dq(Va, Vb, pll.getSin(), pll.getCos(), v_dq);
+    ab_to_dq(Ia, Ib, pll.getSin(), pll.getCos(), i_dq);
+    pll.calculate(v_dq.q);
+
+    if (mode == IDLEMODE)
+    {
+        if (pwm_enable == true)
+        {
+            spin.pwm.stopDualOutput(PWMA);
+            spin.pwm.stopDualOutput(PWMC);
+            spin.pwm.stopDualOutput(PWMD);
+            spin.led.turnOff();
+            pwm_enable = false;
+        }
+        pi_d.reset();
+        pi_q.reset();
+    }
+    else if (mode == POWERMODE)
+    {
+        // PI on the dq currents, with decoupling and grid voltage feedforward
+        float32_t wL = pll.getW() * L;
+        u_dq.d = pi_d.calculateWithReturn(i_dq_ref.d, i_dq.d) - wL * i_dq.q + v_dq.d;
+        u_dq.q = pi_q.calculateWithReturn(i_dq_ref.q, i_dq.q) + wL * i_dq.d + v_dq.q;
+
+        // the voltages are applied during the next period: angle of the next period
+        dq_to_abc(u_dq, pll.getSin(), pll.getCos(), u_abc);
+
+        duty_abc.a = saturate(0.5F + u_abc.a / Udc, DUTY_MIN, DUTY_MAX);
+        duty_abc.b = saturate(0.5F + u_abc.b / Udc, DUTY_MIN, DUTY_MAX);
+        duty_abc.c = saturate(0.5F + u_abc.c / Udc, DUTY_MIN, DUTY_MAX);
+        spin.pwm.setDutyCycle(PWMA, duty_abc.a);
+        spin.pwm.setDutyCycle(PWMC, duty_abc.b);
+        spin.pwm.setDutyCycle(PWMD, duty_abc.c);
+
+        if (!pwm_enable)
+        {
+            pwm_enable = true;
+            spin.led.turnOn();
+            spin.pwm.startDualOutput(PWMA);
+            spin.pwm.startDualOutput(PWMC);
+            spin.pwm.startDualOutput(PWMD);
+        }
+    }
+}
+
+/**
+ * This is the main function of this example
+ * This function is generic and does not need editing.
+ */
+int main(void)
+{
+    setup_routine();
+
+    return 0;
+}
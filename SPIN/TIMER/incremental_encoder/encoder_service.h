@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) 2021-2024 LAAS-CNRS
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published by
+ *   the Free Software Foundation, either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGLPV2.1
+ */
+
+/**
+ * @brief  Position and speed of an incremental encoder, in the critical task.
+ *
+ *         The counter of TIM4 is 16 bits. `update()` is called at each tick
+ *         with its value, the difference with the previous one is taken
+ *         modulo 2^16 and added to a 32 bits position, so the position does
+ *         not wrap as long as the encoder turns by less than 32768 counts per
+ *         tick.
+ *
+ *         The speed is given by a tracking observer of the position, a
+ *         second order loop of bandwidth w:
+ *
+ *             e = position - angle
+ *             speed += w^2.Ts.e
+ *             angle += (speed + 2.w.e).Ts
+ *
+ *         Unlike the difference of two counts divided by Ts, it is not
+ *         quantised to 1/(counts.Ts) and it does not need to wait for an
+ *         edge at low speed. The observer follows a constant acceleration
+ *         with no static error; a higher w follows faster and filters less.
+ *
+ *         The estimated angle is kept as a 32 bits count plus a float32
+ *         fraction, moved to the count at each tick: the error is computed
+ *         on integers, so its resolution does not degrade when the position
+ *         grows past the 2^24 counts of a float32 mantissa.
+ *
+ *         The index pulse, if any, is read at each tick: its first rising
+ *         edge gives the origin of the position.
+ */
+
+#ifndef ENCODER_SERVICE_H_
+#define ENCODER_SERVICE_H_
+
+#include "arm_math.h" // float32_t
+
+class EncoderService
+{
+public:
+    /**
+     * @param counts_per_turn counts of the counter per turn.
+     * @param Ts              [s] period of the critical task.
+     * @param bandwidth       [rad/s] bandwidth of the speed observer.
+     */
+    EncoderService(uint32_t counts_per_turn, float32_t Ts, float32_t bandwidth)
+        : Ts(Ts), turn_per_count(1.0F / counts_per_turn),
+          k_speed(bandwidth * bandwidth * Ts), k_angle(2.0F * bandwidth)
+    {
+    }
+
+    /**
+     * @brief first value of the counter, before the first `update()`.
+     */
+    void init(uint32_t counter)
+    {
+        previous = (uint16_t) counter;
+        position = 0;
+        angle_base = 0;
+        angle_fraction = 0.0F;
+        speed = 0.0F;
+        indexed = false;
+        index_level = false;
+    }
+
+    /**
+     * @brief new value of the counter, once per tick.
+     *
+     * @param index level of the index pulse, false without index.
+     */
+    void update(uint32_t counter, bool index = false)
+    {
+        int16_t delta = (int16_t) ((uint16_t) counter - previous);
+        previous = (uint16_t) counter;
+        position += delta;
+
+        if (index && !index_level && !indexed) {
+            origin = position;
+            indexed = true;
+        }
+        index_level = index;
+
+        float32_t error = (float32_t) (position - angle_base) - angle_fraction;
+        speed += k_speed * error;
+        angle_fraction += (speed + k_angle * error) * Ts;
+
+        // whole counts of the fraction to the base, |fraction| < 1 count
+        int32_t whole = (int32_t) angle_fraction;
+        angle_base += whole;
+        angle_fraction -= (float32_t) whole;
+    }
+
+    /**
+     * @return [counts] position, from the index once it is seen.
+     */
+    int32_t getPosition() { return indexed ? position - origin : position; }
+
+    /**
+     * @return [turn] position.
+     */
+    float32_t getTurns() { return getPosition() * turn_per_count; }
+
+    /**
+     * @return [turn/s] speed.
+     */
+    float32_t getSpeed() { return speed * turn_per_count; }
+
+    bool isIndexed() { return indexed; }
+
+private:
+    const float32_t Ts;
+    const float32_t turn_per_count;
+    const float32_t k_speed; // w^2.Ts
+    const float32_t k_angle; // 2.w
+    uint16_t previous = 0;
+    int32_t position = 0;            // [counts]
+    int32_t origin = 0;              // [counts] position of the index
+    int32_t angle_base = 0;          // [counts] estimated position, whole part
+    float32_t angle_fraction = 0.0F; // [counts] estimated position, fraction
+    float32_t speed = 0.0F;          // [counts/s]
+    bool indexed = false;
+    bool index_level = false;
+};
+
+#endif // ENCODER_SERVICE_H_
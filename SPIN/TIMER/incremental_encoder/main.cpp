@@ -33,6 +33,7 @@
 #include "TaskAPI.h"
 #include "TwistAPI.h"
 #include "SpinAPI.h"
+#include "encoder_service.h"
 
 //--------------SETUP FUNCTIONS DECLARATION-------------------
 void setup_routine(); // Setups the hardware and software of the system
@@ -45,6 +46,17 @@ void loop_critical_task();     // Code to be executed in real time in the critic
 
 static uint32_t incremental_value;
 
+/* Position and speed updated at each tick of the critical task */
+#define ENCODER_SERVICE // Comment to print the raw counter from the background task
+
+#define ENCODER_COUNTS_PER_TURN 80 // 20 pulses per turn, 4 counts per pulse
+#define ENCODER_INDEX_PIN PC8      // index pulse (Z), if any
+
+static uint32_t control_task_period = 50; //[us] period of the critical task, 20 kHz
+static float32_t speed_bandwidth = 2.0F * PI * 20.0F; // [rad/s] of the speed observer
+static EncoderService encoder(ENCODER_COUNTS_PER_TURN, control_task_period * 1e-6F,
+                              speed_bandwidth);
+
 //--------------SETUP FUNCTIONS-------------------------------
 
 /**
@@ -62,11 +74,17 @@ void setup_routine()
 
     // Then declare tasks
     uint32_t background_task_number = task.createBackground(loop_background_task);
-    //task.createCritical(loop_critical_task, 500); // Uncomment if you use the critical task
+#ifdef ENCODER_SERVICE
+    spin.gpio.configurePin(ENCODER_INDEX_PIN, INPUT);
+    encoder.init(spin.timer.getTimer4IncrementalEncoderValue());
+    task.createCritical(loop_critical_task, control_task_period);
+#endif
 
     // Finally, start tasks
     task.startBackground(background_task_number);
-    //task.startCritical(); // Uncomment if you use the critical task
+#ifdef ENCODER_SERVICE
+    task.startCritical();
+#endif
 }
 
 //--------------LOOP FUNCTIONS--------------------------------
@@ -78,9 +96,14 @@ void setup_routine()
  */
 void loop_background_task()
 {
+#ifdef ENCODER_SERVICE
+    printk("%d:%f:%f:%u\n", encoder.getPosition(), encoder.getTurns(),
+           encoder.getSpeed(), encoder.isIndexed());
+#else
     incremental_value = spin.timer.getTimer4IncrementalEncoderValue();
     // Task content
     printk(" %u \n", incremental_value);
+#endif
 
     // Pause between two runs of the task
     task.suspendBackgroundMs(100);
@@ -94,7 +117,8 @@ void loop_background_task()
  */
 void loop_critical_task()
 {
-
+    encoder.update(spin.timer.getTimer4IncrementalEncoderValue(),
+                   spin.gpio.readPin(ENCODER_INDEX_PIN));
 }
 
 /**
@@ -0,0 +1,248 @@
+/*
+ * Copyright (c) 2021-2024 LAAS-CNRS
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published by
+ *   the Free Software Foundation, either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGLPV2.1
+ */
+
+/**
+ * @brief  Cascade of second order IIR sections (biquads).
+ *
+ *         Each section is H(z) = (b0 + b1.z^-1 + b2.z^-2) / (1 + a1.z^-1 + a2.z^-2),
+ *         computed in direct form II transposed (DF2T), two states per
+ *         section:
+ *
+ *             y  = b0.x + s1
+ *             s1 = b1.x - a1.y + s2
+ *             s2 = b2.x - a2.y
+ *
+ *         The coefficients are given by `biquadLowPass()` and
+ *         `biquadNotch()`, from the formulas of the Audio EQ Cookbook
+ *         (R. Bristow-Johnson), computed in double: for a cut-off far below
+ *         the sampling frequency the poles are very close to 1.
+ *
+ *         `BiquadCascade<N>` stores the coefficients and the states in
+ *         float32. `BiquadCascadeQ31<N>` stores the coefficients in Q2.30
+ *         (|a1| is up to 2) and the states in 64 bits, the products are
+ *         32 x 32 -> 64 bits multiply-accumulates (SMLAL); the input is a
+ *         fraction of `full_scale`. A state sums three products of up to
+ *         2^62: with `full_scale` twice the range of the measure, the input
+ *         stays below 2^30 and the sums below 2^63.
+ *
+ *         Both have a `calculateWithReturn()`, as LowPassFirstOrderFilter,
+ *         and can be set as the filter of a channel of `TwistMeasures`.
+ *
+ *         `reset(value)` sets the states for a constant input `value`, so
+ *         that the output starts at the steady state instead of 0.
+ */
+
+#ifndef BIQUAD_H_
+#define BIQUAD_H_
+
+#include <math.h>
+
+#include "arm_math.h" // float32_t
+
+#define BIQUAD_2PI 6.283185307179586
+
+struct biquad_coefficients
+{
+    double b0, b1, b2;
+    double a1, a2; // a0 normalised to 1
+};
+
+/**
+ * @brief second order low-pass, Q = 0.7071 for a Butterworth.
+ *
+ * @param Ts [s] sampling period.
+ * @param f0 [Hz] cut-off frequency.
+ */
+inline biquad_coefficients biquadLowPass(float32_t Ts, float32_t f0, float32_t Q = 0.7071F)
+{
+    double w = BIQUAD_2PI * (double) f0 * (double) Ts;
+    double alpha = sin(w) / (2.0 * (double) Q);
+    double a0 = 1.0 + alpha;
+    double c = cos(w);
+    return { (1.0 - c) / 2.0 / a0, (1.0 - c) / a0, (1.0 - c) / 2.0 / a0,
+             -2.0 * c / a0, (1.0 - alpha) / a0 };
+}
+
+/**
+ * @brief notch, the width of the rejected band at -3 dB is f0 / Q.
+ *
+ * @param Ts [s] sampling period.
+ * @param f0 [Hz] rejected frequency.
+ */
+inline biquad_coefficients biquadNotch(float32_t Ts, float32_t f0, float32_t Q)
+{
+    double w = BIQUAD_2PI * (double) f0 * (double) Ts;
+    double alpha = sin(w) / (2.0 * (double) Q);
+    double a0 = 1.0 + alpha;
+    double c = cos(w);
+    return { 1.0 / a0, -2.0 * c / a0, 1.0 / a0, -2.0 * c / a0, (1.0 - alpha) / a0 };
+}
+
+/* gain of a section for a constant input */
+inline double biquadDcGain(const biquad_coefficients &c)
+{
+    return (c.b0 + c.b1 + c.b2) / (1.0 + c.a1 + c.a2);
+}
+
+template <uint8_t N>
+class BiquadCascade
+{
+    static_assert(N >= 1, "at least one section");
+
+public:
+    /**
+     * @brief coefficients of the section k, the sections are in series
+     * from 0 to N - 1.
+     */
+    void setSection(uint8_t k, const biquad_coefficients &c)
+    {
+        section &s = sections[k];
+        s.b0 = (float32_t) c.b0;
+        s.b1 = (float32_t) c.b1;
+        s.b2 = (float32_t) c.b2;
+        s.a1 = (float32_t) c.a1;
+        s.a2 = (float32_t) c.a2;
+        dc_gain[k] = (float32_t) biquadDcGain(c);
+        s.s1 = 0.0F;
+        s.s2 = 0.0F;
+    }
+
+    /**
+     * @param value constant input of the steady state.
+     */
+    void reset(float32_t value = 0.0F)
+    {
+        for (uint8_t k = 0; k < N; k++) {
+            section &s = sections[k];
+            float32_t y = dc_gain[k] * value;
+            s.s1 = y - s.b0 * value;
+            s.s2 = s.b2 * value - s.a2 * y;
+            value = y;
+        }
+    }
+
+    float32_t calculateWithReturn(float32_t x)
+    {
+        for (uint8_t k = 0; k < N; k++) {
+            section &s = sections[k];
+            float32_t y = s.b0 * x + s.s1;
+            s.s1 = s.b1 * x - s.a1 * y + s.s2;
+            s.s2 = s.b2 * x - s.a2 * y;
+            x = y;
+        }
+        return x;
+    }
+
+private:
+    struct section
+    {
+        float32_t b0, b1, b2, a1, a2;
+        float32_t s1, s2;
+    };
+    section sections[N];
+    float32_t dc_gain[N];
+};
+
+template <uint8_t N>
+class BiquadCascadeQ31
+{
+    static_assert(N >= 1, "at least one section");
+
+public:
+    /**
+     * @param full_scale value of the input equal to 1.0 in Q31, twice the
+     *                   range of the measure.
+     */
+    explicit BiquadCascadeQ31(float32_t full_scale = 1.0F)
+        : to_q31(2147483648.0F / full_scale), to_value(full_scale / 2147483648.0F)
+    {
+    }
+
+    void setSection(uint8_t k, const biquad_coefficients &c)
+    {
+        section &s = sections[k];
+        s.b0 = q30(c.b0);
+        s.b1 = q30(c.b1);
+        s.b2 = q30(c.b2);
+        s.a1 = q30(c.a1);
+        s.a2 = q30(c.a2);
+        dc_gain[k] = biquadDcGain(c);
+        s.s1 = 0;
+        s.s2 = 0;
+    }
+
+    /**
+     * @param value constant input of the steady state.
+     */
+    void reset(float32_t value = 0.0F)
+    {
+        int32_t x = saturate((int64_t) (value * to_q31));
+        for (uint8_t k = 0; k < N; k++) {
+            section &s = sections[k];
+            int32_t y = saturate((int64_t) (dc_gain[k] * x));
+            s.s1 = ((int64_t) y << 30) - (int64_t) s.b0 * x;
+            s.s2 = (int64_t) s.b2 * x - (int64_t) s.a2 * y;
+            x = y;
+        }
+    }
+
+    /**
+     * @param x Q31 input.
+     * @return Q31 output.
+     */
+    int32_t calculateQ31(int32_t x)
+    {
+        for (uint8_t k = 0; k < N; k++) {
+            section &s = sections[k];
+            // the states are in Q2.30 x Q31 = Q33.61, the output back in Q31
+            int32_t y = saturate(((int64_t) s.b0 * x + s.s1) >> 30);
+            s.s1 = (int64_t) s.b1 * x - (int64_t) s.a1 * y + s.s2;
+            s.s2 = (int64_t) s.b2 * x - (int64_t) s.a2 * y;
+            x = y;
+        }
+        return x;
+    }
+
+    float32_t calculateWithReturn(float32_t value)
+    {
+        int32_t x = saturate((int64_t) (value * to_q31));
+        return calculateQ31(x) * to_value;
+    }
+
+private:
+    struct section
+    {
+        int32_t b0, b1, b2, a1, a2; // Q2.30
+        int64_t s1, s2;
+    };
+
+    static int32_t q30(double c) { return (int32_t) lround(c * 1073741824.0); }
+
+    static int32_t saturate(int64_t x)
+    {
+        return x > INT32_MAX ? INT32_MAX : (x < INT32_MIN ? INT32_MIN : (int32_t) x);
+    }
+
+    const float32_t to_q31;
+    const float32_t to_value;
+    section sections[N];
+    double dc_gain[N];
+};
+
+#endif // BIQUAD_H_
@@ -0,0 +1,84 @@
+"""
+Copyright (c) 2021-2024 LAAS-CNRS
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation, either version 2.1 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+SPDX-License-Identifier: LGLPV2.1
+"""
+
+"""
+@brief  Compare the output of the control loops benchmark with a baseline:
+
+            python compare_benchmark.py monitor.log --baseline baseline.json
+
+        Both files are logs of the serial monitor, only the JSON lines of
+        the benchmark are read. The script exits with 1 if a value raised
+        above the tolerance, so it can stop a CI job.
+"""
+
+import argparse
+import json
+import sys
+
+COMPARED = ['cycles_mean', 'cycles_max', 'stack_bytes', 'ram_bytes']  # lower is better
+
+
+def read_results(filename):
+    """ last result of each benchmark in the log """
+    results = {}
+    with open(filename, 'r', encoding='latin-1') as f:
+        for line in f:
+            line = line.strip()
+            if not line.startswith('{"bench"'):
+                continue
+            try:
+                result = json.loads(line)
+            except json.JSONDecodeError:
+                continue  # line cut by a reset
+            results[result['bench']] = result
+    results.pop('end', None)
+    return results
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser("compare_benchmark",
+                                     "compare_benchmark <log> [--baseline <log>] [--tolerance 5]")
+    parser.add_argument("log", help="output of the benchmark")
+    parser.add_argument("--baseline", help="output of a previous run")
+    parser.add_argument("--tolerance", type=float, default=5.0, help="[%%] allowed increase")
+    args = parser.parse_args()
+
+    results = read_results(args.log)
+    baseline = read_results(args.baseline) if args.baseline else {}
+    regressions = 0
+    print(f"{'bench':24}" + "".join(f"{name:>14}" for name in COMPARED + ['f_max_hz']))
+    for bench, result in results.items():
+        if bench == 'system':
+            continue
+        row = f"{bench:24}"
+        for name in COMPARED:
+            value = result[name]
+            cell = f"{value}"
+            if bench in baseline and baseline[bench].get(name):
+                change = 100.0 * (value - baseline[bench][name]) / baseline[bench][name]
+                cell += f" {change:+.0f}%"
+                if change > args.tolerance:
+                    cell += "!"
+                    regressions += 1
+            row += f"{cell:>14}"
+        row += f"{result['f_max_hz']:>14}"
+        print(row)
+    if regressions:
+        print(f"{regressions} values above the tolerance of {args.tolerance:g} %")
+    sys.exit(1 if regressions else 0)
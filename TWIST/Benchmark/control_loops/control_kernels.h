@@ -0,0 +1,558 @@
+/*
+ * Copyright (c) 2021-2024 LAAS-CNRS
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published by
+ *   the Free Software Foundation, either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGLPV2.1
+ */
+
+/**
+ * @brief  Critical task bodies of the examples, fed by synthetic measures.
+ *
+ *         Each kernel is the power mode branch of `loop_critical_task()` of
+ *         an example, with the same controllers, gains and period. The
+ *         kernels of grid_forming and grid_following call the control of the
+ *         example itself, `grid_forming_control.h` and
+ *         `grid_following_control.h`, byte-identical copies of the headers of
+ *         the examples, and run their tasks with the same MultirateScheduler,
+ *         scopes and telemetry:
+ *
+ *         - `init()` sets the controllers as `setup_routine()`,
+ *         - `restart()` starts the scope again before each run,
+ *         - `inject()` gives the measures of a converter at its operating
+ *           point (`SyntheticMeasures`), instead of the acquisition,
+ *         - `tick()` is the code of one period and returns the duty cycle.
+ *
+ *         The acquisition (`data.getLatest()` or `measures.acquire()`) and
+ *         the writes to the power stage (`twist.setAllDutyCycle()`, the
+ *         RS485 frames, the DMA of the peak references) are left out: the
+ *         kernels time the control library (`pid.h`, `pr.h`, `trigo.h`,
+ *         `filters.h`), the helpers of the examples and the scopes. The
+ *         records of the telemetry and of the continuous scope are dropped
+ *         as soon as they are written, in place of the background task
+ *         which sends them. A change of the critical task of the buck and
+ *         AC_peer_to_peer examples must be copied here, the grid_forming
+ *         and grid_following headers are copied as they are.
+ *
+ *         The scopes record BENCH_SCOPE_SIZE samples, less than the 1024 of
+ *         the examples so that all the kernels fit in RAM. The cost of
+ *         `acquire()` does not depend on the size.
+ */
+
+#ifndef CONTROL_KERNELS_H_
+#define CONTROL_KERNELS_H_
+
+#include <math.h>
+
+#include "pid.h"
+#include "pr.h"
+#include "trigo.h"
+#include "ScopeMimicry.h"
+#include "scope_stream.h"
+#include "telemetry.h"
+#include "multirate_scheduler.h"
+#include "twist_measures.h"
+#include "fixed_controllers.h"
+#include "quadrature_oscillator.h"
+#include "grid_forming_control.h"
+#include "grid_following_control.h"
+
+#define BENCH_SCOPE_SIZE 256 // [samples] of each scope, one run of the benchmark
+
+/* the scopes of the kernels record at each call of acquire() */
+inline bool bench_trigger()
+{
+    return true;
+}
+
+class SyntheticMeasures
+{
+public:
+    /**
+     * @param Ts [s] period of the critical task of the example.
+     * @param f0 [Hz] frequency of the AC measures.
+     */
+    void init(float32_t Ts, float32_t f0 = 50.0F)
+    {
+        step = 2.0F * PI * f0 * Ts;
+        angle = 0.0F;
+        seed = 1;
+    }
+
+    /**
+     * @brief buck at its operating point, the noise of the ADC on each
+     * channel.
+     */
+    void dc(twist_measures &m, float32_t V_low, float32_t I_low, float32_t V_high)
+    {
+        m.V1_low = V_low + noise(0.05F);
+        m.V2_low = V_low + noise(0.05F);
+        m.I1_low = I_low + noise(0.02F);
+        m.I2_low = I_low + noise(0.02F);
+        m.V_high = V_high + noise(0.1F);
+        m.I_high = I_low * V_low / V_high + noise(0.02F);
+    }
+
+    /**
+     * @brief inverter on a 50 Hz grid: V1_low - V2_low is a sine of
+     * amplitude V_ac, I1_low = -I2_low a sine of amplitude I_ac in phase.
+     */
+    void ac(twist_measures &m, float32_t V_ac, float32_t I_ac, float32_t V_high)
+    {
+        angle += step;
+        if (angle > PI) {
+            angle -= 2.0F * PI;
+        }
+        float32_t s = sinf(angle);
+        m.V1_low = 0.5F * V_high + 0.5F * V_ac * s + noise(0.05F);
+        m.V2_low = 0.5F * V_high - 0.5F * V_ac * s + noise(0.05F);
+        m.I1_low = I_ac * s + noise(0.02F);
+        m.I2_low = -m.I1_low;
+        m.V_high = V_high + 0.5F * sinf(2.0F * angle) + noise(0.1F); // 100 Hz ripple
+        m.I_high = 0.5F * I_ac * V_ac / V_high + noise(0.02F);
+    }
+
+private:
+    /* uniform in [-amplitude, amplitude], linear congruential generator */
+    float32_t noise(float32_t amplitude)
+    {
+        seed = seed * 1664525U + 1013904223U;
+        return amplitude * ((float32_t) (int32_t) seed * (1.0F / 2147483648.0F));
+    }
+
+    float32_t step;
+    float32_t angle;
+    uint32_t seed;
+};
+
+//--------------buck_voltage_mode-----------------------------
+
+inline constexpr float32_t BUCK_VOLTAGE_TS = 100e-6F;
+inline constexpr pid_coefficients buck_voltage_pid =
+    pidCoefficients(BUCK_VOLTAGE_TS, 0.000215F, 7.5175e-5F, 0.0F, 0.0F, 0.0F, 1.0F);
+
+/* FixedPid of the output voltage (FIXED_PID), telemetry of the measures at
+ * 500 Hz (TELEMETRY) */
+struct BuckVoltageKernel
+{
+    static constexpr const char *name = "buck_voltage_mode";
+    static constexpr uint32_t period_us = 100;
+    static constexpr uint32_t scope_bytes = 0;
+    static constexpr uint16_t telemetry_decimation = 2000 / period_us;
+
+    FixedPid<buck_voltage_pid> pid;
+    Telemetry<256, 6> telemetry;
+    float32_t voltage_reference = 15.0F;
+    float32_t duty_cycle;
+    uint16_t telemetry_counter;
+    twist_measures meas;
+
+    BuckVoltageKernel()
+    {
+        telemetry.connectChannel(meas.I1_low, "I1_low_value", 1000.0F); // [mA]
+        telemetry.connectChannel(meas.V1_low, "V1_low_value", 100.0F);  // [10 mV]
+        telemetry.connectChannel(meas.I2_low, "I2_low_value", 1000.0F);
+        telemetry.connectChannel(meas.V2_low, "V2_low_value", 100.0F);
+        telemetry.connectChannel(meas.I_high, "I_high_value", 1000.0F);
+        telemetry.connectChannel(meas.V_high, "V_high_value", 100.0F);
+    }
+
+    void init()
+    {
+        pid.reset();
+        telemetry_counter = 0;
+    }
+
+    void restart() { telemetry.discard(); }
+
+    void inject(SyntheticMeasures &s, twist_measures &m) { s.dc(m, 14.9F, 1.0F, 30.0F); }
+
+    float32_t tick(const twist_measures &m)
+    {
+        meas = m;
+        duty_cycle = pid.calculateWithReturn(voltage_reference, meas.V1_low);
+        if (++telemetry_counter >= telemetry_decimation) {
+            telemetry_counter = 0;
+            telemetry.sample();
+            telemetry.discard(); // sent by the background task
+        }
+        return duty_cycle;
+    }
+};
+
+//--------------buck_current_mode-----------------------------
+
+#define BUCK_CURRENT_SWITCHING_CYCLES 20 // switching periods per control period
+
+/* Pid of the voltage, peak references of the next switching periods
+ * (PEAK_REFERENCE_DMA), as PeakReferenceStream::refill() */
+struct BuckCurrentKernel
+{
+    static constexpr const char *name = "buck_current_mode";
+    static constexpr uint32_t period_us = 100;
+    static constexpr uint32_t scope_bytes = 0;
+
+    Pid pid;
+    float32_t Vref = 15.0F;
+    float32_t Iref;
+    float32_t PeakRef;
+    float32_t previous_peak;
+    uint32_t words[2][BUCK_CURRENT_SWITCHING_CYCLES]; // the two legs
+    uint32_t str_step = 0x00010000; // STR without the start value, a drop of 1 LSB
+    float32_t lsb_per_volt = 4096.0F / 2.048F;
+
+    void init()
+    {
+        PidParams pid_params(period_us * 1e-6F, 0.1F, 8.0e-4F, 0.0F, 0.0F, -10.0F, 10.0F);
+        pid.init(pid_params);
+        previous_peak = 1.024F;
+    }
+
+    void restart() {}
+
+    void inject(SyntheticMeasures &s, twist_measures &m) { s.dc(m, 14.9F, 2.0F, 30.0F); }
+
+    float32_t tick(const twist_measures &m)
+    {
+        Iref = pid.calculateWithReturn(Vref, m.V1_low);
+        PeakRef = 0.1 * Iref + 1.024; // Convert the current in voltage for slope compensation
+        float32_t step = (PeakRef - previous_peak) * (1.0F / BUCK_CURRENT_SWITCHING_CYCLES);
+        for (uint8_t leg = 0; leg < 2; leg++) {
+            for (uint16_t k = 0; k < BUCK_CURRENT_SWITCHING_CYCLES; k++) {
+                float32_t v = (previous_peak + step * (k + 1)) * lsb_per_volt;
+                v = v < 0.0F ? 0.0F : (v > 4095.0F ? 4095.0F : v);
+                words[leg][k] = str_step | (uint32_t) v;
+            }
+        }
+        previous_peak = PeakRef;
+        return PeakRef;
+    }
+};
+
+//--------------grid_forming----------------------------------
+
+/* GridFormingControl, V_high through the biquads of the acquisition
+ * (BIQUAD_FILTERS) or the first order low-pass of filters.h, and the tasks of
+ * the MultirateScheduler: amplitude ramp at 1 kHz, scope every 300 us,
+ * continuous scope and telemetry at 1 kHz (TELEMETRY) */
+template <bool BIQUAD>
+struct GridFormingKernel
+{
+    static constexpr const char *name = BIQUAD ? "grid_forming" : "grid_forming_low_pass";
+    static constexpr uint32_t period_us = 100;
+    static constexpr uint32_t scope_bytes = BENCH_SCOPE_SIZE * 9 * sizeof(float32_t);
+    static constexpr float32_t Ts = period_us * 1e-6F;
+    static constexpr float32_t f0 = 50.0F;
+    static constexpr float32_t w0 = 2.0F * PI * f0;
+    static constexpr float32_t Udc = 40.0F;
+    static constexpr uint16_t amplitude_decimation = 1000 / period_us;
+    static constexpr uint16_t scope_decimation = 300 / period_us;
+    static constexpr uint16_t continuous_decimation = 1000 / period_us;
+    static constexpr uint16_t telemetry_decimation = 1000 / period_us;
+
+    GridFormingControl control{Ts, w0};
+    BiquadCascade<2> vHighBiquad;
+    LowPassFirstOrderFilter vHighFilter = vHighLowPass(Ts);
+    MultirateScheduler scheduler;
+    ScopeMimicry scope{BENCH_SCOPE_SIZE, 9};
+    ContinuousScope<4096, 4> continuous_scope;
+    Telemetry<256, 4> telemetry;
+    float32_t V_high_filt;
+    float32_t duty_cycle;
+    float32_t spying_mode = 1.0F; // POWERMODE
+    twist_measures meas;
+
+    GridFormingKernel()
+    {
+        self = this;
+        scope.connectChannel(meas.I1_low, "I1_low_value");
+        scope.connectChannel(meas.I_high, "iHigh");
+        scope.connectChannel(meas.V1_low, "V1_low_value");
+        scope.connectChannel(meas.V2_low, "V2_low_value");
+        scope.connectChannel(V_high_filt, "V_high_filt");
+        scope.connectChannel(duty_cycle, "duty_cycle");
+        scope.connectChannel(control.Vgrid_ref, "Vgrid_ref");
+        scope.connectChannel(control.Vgrid_amplitude, "Vgrid_amplitude");
+        scope.connectChannel(spying_mode, "mode");
+        scope.set_delay(0.0F);
+        scope.set_trigger(bench_trigger);
+        continuous_scope.connectChannel(meas.I1_low, "I1_low_value", 1000.0F); // [mA]
+        continuous_scope.connectChannel(meas.V1_low, "V1_low_value", 100.0F);  // [10 mV]
+        continuous_scope.connectChannel(meas.V2_low, "V2_low_value", 100.0F);
+        continuous_scope.connectChannel(control.Vgrid_ref, "Vgrid_ref", 100.0F);
+        telemetry.connectChannel(control.Vgrid_amplitude, "Vgrid_amplitude", 100.0F); // [10 mV]
+        telemetry.connectChannel(meas.V1_low, "V1_low_value", 100.0F);
+        telemetry.connectChannel(meas.I1_low, "I1_low_value", 1000.0F);      // [mA]
+        scheduler.add(amplitudeTask, "amplitude", amplitude_decimation, 2);
+        scheduler.add(scopeTask, "scope", scope_decimation, 1);
+        scheduler.add(continuousScopeTask, "continuous scope", continuous_decimation, 0);
+        scheduler.add(telemetryTask, "telemetry", telemetry_decimation, 0);
+    }
+
+    void init()
+    {
+        control.initPr(Ts, Udc);
+        designVHighBiquad(vHighBiquad, Ts, f0);
+        vHighBiquad.reset(Udc);
+        vHighFilter.reset(Udc);
+        control.oscillator.reset();
+        control.idle();
+        control.Vgrid_amplitude_ref = 12.0F;
+    }
+
+    void restart()
+    {
+        scope.start();
+        continuous_scope.start();
+        telemetry.discard();
+    }
+
+    void inject(SyntheticMeasures &s, twist_measures &m) { s.ac(m, 12.0F, 1.0F, Udc); }
+
+    float32_t tick(const twist_measures &m)
+    {
+        meas = m;
+        if constexpr (BIQUAD) {
+            V_high_filt = vHighBiquad.calculateWithReturn(meas.V_high); // by the acquisition
+        } else {
+            V_high_filt = vHighFilter.calculateWithReturn(meas.V_high);
+        }
+        duty_cycle = control.dutyCycle(meas, V_high_filt);
+        scheduler.run();
+        return duty_cycle;
+    }
+
+private:
+    /* the tasks of the scheduler are functions, of the only kernel of each
+     * filter */
+    static inline GridFormingKernel *self = nullptr;
+
+    static void amplitudeTask() { self->control.rampAmplitude(Ts * amplitude_decimation); }
+
+    static void scopeTask() { self->scope.acquire(); }
+
+    static void continuousScopeTask()
+    {
+        self->continuous_scope.acquire();
+        if (self->continuous_scope.isReady()) {
+            self->continuous_scope.releaseBlock(); // sent by the background task
+        }
+    }
+
+    static void telemetryTask()
+    {
+        self->telemetry.sample();
+        self->telemetry.discard(); // sent by the background task
+    }
+};
+
+//--------------grid_following--------------------------------
+
+/* GridFollowingControl: SOGI-FLL and its lock detector (PLL_SOGI_FLL), Pr of
+ * the current, packed one-shot scope at each tick (PACKED_SCOPE) */
+struct GridFollowingKernel
+{
+    static constexpr const char *name = "grid_following";
+    static constexpr uint32_t period_us = 100;
+    static constexpr uint32_t scope_bytes = 0; // the OneShotScope is in the kernel
+    static constexpr float32_t Ts = period_us * 1e-6F;
+    static constexpr float32_t w0 = 2.0F * PI * 50.0F;
+    static constexpr float32_t Udc = 40.0F;
+    static constexpr lock_criterion criterion = {0.05F, 2.F * PI * 3.0F, 5.0F, 2e-3F, 5e-3F};
+
+    GridFollowingControl control{Ts, w0, criterion};
+    OneShotScope<BENCH_SCOPE_SIZE * 9 * sizeof(int16_t), 9> scope;
+    float32_t Iref_amplitude = 0.5F;
+    bool pll_is_locked;
+    twist_measures meas;
+
+    GridFollowingKernel() { control.connectScope(scope, meas); }
+
+    void init() { control.initPr(Ts, Udc); }
+
+    void restart() { scope.start(); }
+
+    void inject(SyntheticMeasures &s, twist_measures &m) { s.ac(m, 16.0F, 0.5F, Udc); }
+
+    float32_t tick(const twist_measures &m)
+    {
+        meas = m;
+        pll_is_locked = control.synchronise(meas, true, Iref_amplitude);
+        scope.acquire();
+        // the FLL locks after a few periods, the Pr runs from then on
+        if (pll_is_locked) {
+            control.dutyCycle(meas);
+        }
+        return control.duty_cycle;
+    }
+};
+
+//--------------AC_peer_to_peer-------------------------------
+
+/* references_msg of AC_peer_to_peer, sent on the RS485 */
+struct bench_references
+{
+    float32_t P_ref_fromSERVER;
+    float32_t Vac_ref_fromSERVER;
+    float32_t angle_fromSERVER;
+    uint16_t tick;
+    uint8_t status;
+};
+
+/* SERVER: oscillator, duty cycle and references of the CLIENT, scope at
+ * each tick */
+struct PeerToPeerServerKernel
+{
+    static constexpr const char *name = "AC_peer_to_peer_server";
+    static constexpr uint32_t period_us = 100;
+    static constexpr uint32_t scope_bytes = BENCH_SCOPE_SIZE * 9 * sizeof(float32_t);
+    static constexpr float32_t Ts = period_us * 1e-6F;
+    static constexpr float32_t w0 = 2.0F * PI * 50.0F;
+    static constexpr float32_t Udc = 50.0F;
+
+    QuadratureOscillator oscillator{Ts, w0};
+    ScopeMimicry scope{BENCH_SCOPE_SIZE, 9};
+    bench_references tx_references; // the payload of the frame
+    float32_t P_ref = 10.0F;
+    float32_t Vac_ref = 15.0F;
+    float32_t duty_cycle;
+    uint16_t tick_counter;
+    twist_measures meas;
+
+    PeerToPeerServerKernel()
+    {
+        scope.connectChannel(meas.I1_low, "I1_low");
+        scope.connectChannel(meas.I2_low, "I2_low");
+        scope.connectChannel(meas.V1_low, "V1_low");
+        scope.connectChannel(meas.V2_low, "V2_low");
+        scope.connectChannel(meas.V_high, "V_high");
+        scope.connectChannel(meas.I_high, "I_high");
+        scope.connectChannel(duty_cycle, "duty_cycle");
+        scope.connectChannel(Vac_ref, "Vac_ref");
+        scope.connectChannel(P_ref, "P_ref");
+        scope.set_delay(0.0F);
+        scope.set_trigger(bench_trigger);
+    }
+
+    void init()
+    {
+        oscillator.reset();
+        tick_counter = 0;
+    }
+
+    void restart() { scope.start(); }
+
+    void inject(SyntheticMeasures &s, twist_measures &m) { s.ac(m, 15.0F, 0.5F, Udc); }
+
+    float32_t tick(const twist_measures &m)
+    {
+        meas = m;
+        if (meas.V_high < 10.0F) meas.V_high = 10.0F; // to prevent div by 0.
+        oscillator.calculate();
+        duty_cycle = 0.5 + Vac_ref * oscillator.getSin() / (2.0 * Udc);
+
+        tx_references.status = 2;
+        tx_references.P_ref_fromSERVER = P_ref;
+        tx_references.Vac_ref_fromSERVER = Vac_ref;
+        tx_references.tick = tick_counter++;
+
+        scope.acquire();
+        return duty_cycle;
+    }
+};
+
+/* CLIENT: references of the SERVER, PI of the DC voltage and Pr of the
+ * current, scope every 4 ticks (CLIENT_ANGLE_FROM_SERVER not defined) */
+struct PeerToPeerClientKernel
+{
+    static constexpr const char *name = "AC_peer_to_peer_client";
+    static constexpr uint32_t period_us = 100;
+    static constexpr uint32_t scope_bytes = BENCH_SCOPE_SIZE * 9 * sizeof(float32_t);
+    static constexpr float32_t Ts = period_us * 1e-6F;
+    static constexpr float32_t w0 = 2.0F * PI * 50.0F;
+    static constexpr float32_t Udc = 50.0F;
+    static constexpr float32_t Rdc = 115.0F;
+    static constexpr uint16_t scope_decimation = 4;
+
+    Pid pid_current_control;
+    Pr pr;
+    ScopeMimicry scope{BENCH_SCOPE_SIZE, 9};
+    bench_references references = {10.0F, 15.0F, 0.0F, 0, 2};
+    float32_t P_ref;
+    float32_t Vac_ref;
+    float32_t v_dc_ref;
+    float32_t Vac_meas;
+    float32_t gain_current;
+    float32_t I_ac_ref;
+    float32_t duty_cycle;
+    uint16_t tick_counter;
+    twist_measures meas;
+
+    PeerToPeerClientKernel()
+    {
+        scope.connectChannel(meas.I1_low, "I1_low");
+        scope.connectChannel(meas.I2_low, "I2_low");
+        scope.connectChannel(meas.V1_low, "V1_low");
+        scope.connectChannel(meas.V2_low, "V2_low");
+        scope.connectChannel(meas.V_high, "V_high");
+        scope.connectChannel(duty_cycle, "duty_cycle");
+        scope.connectChannel(I_ac_ref, "I_ac_ref");
+        scope.connectChannel(gain_current, "gain_current");
+        scope.connectChannel(v_dc_ref, "v_dc_ref");
+        scope.set_delay(0.0F);
+        scope.set_trigger(bench_trigger);
+    }
+
+    void init()
+    {
+        gain_current = -0.20F;
+        PidParams pid_params(Ts, 0.01F, 0.1F, 0.0F, 0.0F, -2.0F, 2.0F);
+        pid_current_control.init(pid_params);
+        pid_current_control.reset(-gain_current);
+        pr.init(PrParams(Ts, 0.2F, 3000.0F, w0, 0.0F, -50.0F, 50.0F));
+        tick_counter = 0;
+    }
+
+    void restart() { scope.start(); }
+
+    void inject(SyntheticMeasures &s, twist_measures &m)
+    {
+        s.ac(m, 15.0F, 0.5F, 34.0F);
+        references.tick = tick_counter - 1; // sent by the SERVER on the previous tick
+    }
+
+    float32_t tick(const twist_measures &m)
+    {
+        meas = m;
+        if (meas.V_high < 10.0F) meas.V_high = 10.0F; // to prevent div by 0.
+        // a reference popped at each tick
+        P_ref = references.P_ref_fromSERVER;
+        Vac_ref = references.Vac_ref_fromSERVER;
+
+        v_dc_ref = sqrt(P_ref * Rdc); // V_dc²/R = P
+        Vac_meas = meas.V1_low - meas.V2_low;
+        gain_current = pid_current_control.calculateWithReturn(v_dc_ref, meas.V_high);
+        I_ac_ref = -gain_current * Vac_meas;
+        duty_cycle = (Vac_meas + pr.calculateWithReturn(I_ac_ref, meas.I1_low))
+                   / (2.0F * Udc) + 0.5F;
+
+        if (tick_counter % scope_decimation == 0) {
+            scope.acquire();
+        }
+        tick_counter++;
+        return duty_cycle;
+    }
+};
+
+#endif // CONTROL_KERNELS_H_
@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2021-2024 LAAS-CNRS
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published by
+ *   the Free Software Foundation, either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGLPV2.1
+ */
+
+/**
+ * @brief  Cycles, stack and RAM of the kernels of `control_kernels.h`.
+ *
+ *         `run(kernel)` calls `tick()` BENCH_NB_RUNS x BENCH_RUN_TICKS
+ *         times, the scope being started again before each run. Each tick
+ *         is timed with the DWT cycle counter, the interrupts masked; the
+ *         synthetic measures are computed outside of the timed code, and
+ *         the cost of reading the counter is removed.
+ *
+ *         The stack of a tick is measured by painting BENCH_STACK_PAINT
+ *         bytes below the stack pointer of the thread with a pattern: the
+ *         lowest word overwritten by `tick()` gives its depth. The thread
+ *         must have room for it, its bounds are read from
+ *         CONFIG_THREAD_STACK_INFO (see app.conf).
+ *
+ *         `print()` writes one JSON object per line, read by
+ *         `compare_benchmark.py`:
+ *
+ *             {"bench":"grid_forming","period_us":100,"ticks":9984,
+ *              "cycles_min":...,"cycles_mean":...,"cycles_max":...,
+ *              "f_max_hz":...,"load_percent":...,"stack_bytes":...,"ram_bytes":...}
+ *
+ *         `f_max_hz` is the frequency of the critical task for which the
+ *         longest tick still fits in the period. `ram_bytes` is the state
+ *         of the kernel and the buffer of its scope.
+ */
+
+#ifndef CYCLE_BENCHMARK_H_
+#define CYCLE_BENCHMARK_H_
+
+#include <soc.h> // DWT cycle counter, SystemCoreClock, __get_PSP()
+
+#include "zephyr/kernel.h"
+#include "zephyr/linker/linker-defs.h" // _image_ram_start, _image_ram_end
+
+#include "control_kernels.h"
+
+#define BENCH_RUN_TICKS BENCH_SCOPE_SIZE // ticks between two starts of the scope
+#define BENCH_NB_RUNS 40
+#define BENCH_STACK_PAINT 1024 // [bytes] painted below the stack pointer
+#define BENCH_STACK_MARGIN 64  // [bytes] left above the bottom of the stack
+#define BENCH_STACK_PATTERN 0xA5A5A5A5U
+
+struct bench_result
+{
+    const char *name;
+    uint32_t period_us;
+    uint32_t nb_ticks;
+    uint32_t cycles_min;
+    uint32_t cycles_max;
+    uint64_t cycles_sum;
+    uint32_t stack_bytes; // BENCH_STACK_PAINT if the paint was too short
+    uint32_t ram_bytes;
+};
+
+class CycleBenchmark
+{
+public:
+    /**
+     * @brief enable the cycle counter and measure its own cost.
+     */
+    void init()
+    {
+        CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+        DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+        overhead = UINT32_MAX;
+        for (uint8_t k = 0; k < 16; k++) {
+            unsigned int key = irq_lock();
+            uint32_t t0 = DWT->CYCCNT;
+            uint32_t t1 = DWT->CYCCNT;
+            irq_unlock(key);
+            overhead = (t1 - t0) < overhead ? (t1 - t0) : overhead;
+        }
+    }
+
+    template <typename K>
+    bench_result run(K &kernel)
+    {
+        bench_result r = {K::name, K::period_us, 0, UINT32_MAX, 0, 0, 0,
+                          (uint32_t) sizeof(K) + K::scope_bytes};
+        twist_measures m = {};
+        synthetic.init(K::period_us * 1e-6F);
+        kernel.init();
+
+        for (uint32_t run = 0; run < BENCH_NB_RUNS; run++) {
+            kernel.restart();
+            for (uint32_t k = 0; k < BENCH_RUN_TICKS; k++) {
+                kernel.inject(synthetic, m);
+                if (run == 0) {
+                    // the stack on the first run, the cycles on the next ones
+                    uint32_t depth = stackDepth(kernel, m);
+                    r.stack_bytes = depth > r.stack_bytes ? depth : r.stack_bytes;
+                    continue;
+                }
+                unsigned int key = irq_lock();
+                uint32_t t0 = DWT->CYCCNT;
+                sink = kernel.tick(m);
+                uint32_t t1 = DWT->CYCCNT;
+                irq_unlock(key);
+
+                uint32_t cycles = t1 - t0 - overhead;
+                r.cycles_min = cycles < r.cycles_min ? cycles : r.cycles_min;
+                r.cycles_max = cycles > r.cycles_max ? cycles : r.cycles_max;
+                r.cycles_sum += cycles;
+                r.nb_ticks++;
+            }
+        }
+        return r;
+    }
+
+    static void printSystem()
+    {
+        printk("{\"bench\":\"system\",\"core_hz\":%u,\"ram_bytes\":%u,\"ram_used_bytes\":%u,"
+               "\"stack_bytes\":%u}\n",
+               SystemCoreClock, CONFIG_SRAM_SIZE * 1024U,
+               (uint32_t) (_image_ram_end - _image_ram_start),
+               (uint32_t) k_current_get()->stack_info.size);
+    }
+
+    static void print(const bench_result &r)
+    {
+        const uint32_t period = SystemCoreClock / 1000000 * r.period_us; // [cycles]
+        uint32_t mean = r.nb_ticks ? (uint32_t) (r.cycles_sum / r.nb_ticks) : 0;
+        uint32_t f_max = r.cycles_max ? SystemCoreClock / r.cycles_max : 0;
+        printk("{\"bench\":\"%s\",\"period_us\":%u,\"ticks\":%u,\"cycles_min\":%u,"
+               "\"cycles_mean\":%u,\"cycles_max\":%u,\"f_max_hz\":%u,\"load_percent\":%.1f,"
+               "\"stack_bytes\":%u,\"ram_bytes\":%u}\n",
+               r.name, r.period_us, r.nb_ticks, r.cycles_min, mean, r.cycles_max, f_max,
+               (double) (100.0F * mean / period), r.stack_bytes, r.ram_bytes);
+    }
+
+private:
+    /* not inlined, so that the frame of tick() is below the painted stack pointer */
+    template <typename K>
+    static __attribute__((noinline)) float32_t callTick(K &kernel, const twist_measures &m)
+    {
+        return kernel.tick(m);
+    }
+
+    template <typename K>
+    uint32_t stackDepth(K &kernel, const twist_measures &m)
+    {
+        // volatile: the paint is not turned into a call of memset, which
+        // would run in the painted words
+        volatile uint32_t *sp = (volatile uint32_t *) (uintptr_t) __get_PSP();
+        volatile uint32_t *bottom = (volatile uint32_t *) k_current_get()->stack_info.start
+                                  + BENCH_STACK_MARGIN / 4;
+        uint32_t nb_words = BENCH_STACK_PAINT / 4;
+        if (sp - bottom < (int32_t) nb_words) {
+            nb_words = sp > bottom ? sp - bottom : 0;
+        }
+        volatile uint32_t *low = sp - nb_words;
+
+        unsigned int key = irq_lock();
+        for (volatile uint32_t *p = low; p < sp; p++) {
+            *p = BENCH_STACK_PATTERN;
+        }
+        sink = callTick(kernel, m);
+        irq_unlock(key);
+
+        volatile uint32_t *p = low;
+        while (p < sp && *p == BENCH_STACK_PATTERN) {
+            p++;
+        }
+        return (uint32_t) (sp - p) * 4;
+    }
+
+    SyntheticMeasures synthetic;
+    uint32_t overhead = 0; // [cycles] of reading the counter
+    volatile float32_t sink; // the output of tick() is not optimised out
+};
+
+#endif // CYCLE_BENCHMARK_H_
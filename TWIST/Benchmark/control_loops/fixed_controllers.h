@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2021-2024 LAAS-CNRS
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published by
+ *   the Free Software Foundation, either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGLPV2.1
+ */
+
+/**
+ * @brief  PID and PR controllers with coefficients computed at compile time.
+ *
+ *         When the gains and the sampling period are constants, the discrete
+ *         coefficients are computed by a constexpr function and the
+ *         controller is a template of them:
+ *
+ *             static constexpr pid_coefficients pid_coeffs =
+ *                 pidCoefficients(Ts, kp, Ti, Td, N, lower_bound, upper_bound);
+ *             static FixedPid<pid_coeffs> pid;
+ *
+ *         The coefficients are immediate values of the code of
+ *         `calculateWithReturn()`, which is a fixed sequence of
+ *         multiply-accumulates; the unused terms (no derivative, no
+ *         integral) are removed by the compiler.
+ *
+ *         PID: u = Kp.e + Kp/Ti.integral(e) + Kp.Td.s/(1 + s.Td/N).e
+ *         - integral by forward Euler, clamped to the bounds of the output,
+ *         - derivative filtered by Td/N, by backward Euler.
+ *
+ *         PR: u = Kp.e + Kr.s/(s^2 + w0^2).e
+ *         - resonant term by Tustin, prewarped at w0, so the resonance stays
+ *           exactly at w0 whatever Ts.
+ *
+ *         The output is saturated to [lower_bound, upper_bound].
+ */
+
+#ifndef FIXED_CONTROLLERS_H_
+#define FIXED_CONTROLLERS_H_
+
+#include "trigo.h" // float32_t, as the control library
+
+struct pid_coefficients
+{
+    float32_t kp;
+    float32_t ki;  // Kp.Ts/Ti
+    float32_t kd;  // Kp.Td.N/(Td + N.Ts)
+    float32_t ad;  // Td/(Td + N.Ts), pole of the derivative filter
+    float32_t lower_bound;
+    float32_t upper_bound;
+};
+
+struct pr_coefficients
+{
+    float32_t kp;
+    float32_t b0;  // r(k) = b0.(e(k) - e(k-2)) - a1.r(k-1) - r(k-2)
+    float32_t a1;
+    float32_t lower_bound;
+    float32_t upper_bound;
+};
+
+constexpr pid_coefficients pidCoefficients(float32_t Ts, float32_t Kp, float32_t Ti,
+                                           float32_t Td, float32_t N,
+                                           float32_t lower_bound, float32_t upper_bound)
+{
+    return {
+        Kp,
+        Ti > 0.0F ? Kp * Ts / Ti : 0.0F,
+        Td > 0.0F ? Kp * Td * N / (Td + N * Ts) : 0.0F,
+        Td > 0.0F ? Td / (Td + N * Ts) : 0.0F,
+        lower_bound,
+        upper_bound,
+    };
+}
+
+/* tan(x) by its Taylor series in double, for |x| < 0.5 */
+constexpr double fixedTan(double x)
+{
+    double x2 = x * x;
+    double s = x * (1.0 - x2 / 6.0 * (1.0 - x2 / 20.0 * (1.0 - x2 / 42.0 * (1.0 - x2 / 72.0 * (1.0 - x2 / 110.0)))));
+    double c = 1.0 - x2 / 2.0 * (1.0 - x2 / 12.0 * (1.0 - x2 / 30.0 * (1.0 - x2 / 56.0 * (1.0 - x2 / 90.0))));
+    return s / c;
+}
+
+constexpr pr_coefficients prCoefficients(float32_t Ts, float32_t Kp, float32_t Kr, float32_t w0,
+                                         float32_t lower_bound, float32_t upper_bound)
+{
+    // s = K.(1 - z^-1)/(1 + z^-1), K = w0 / tan(w0.Ts/2)
+    double w = (double) w0;
+    double K = w / fixedTan(w * (double) Ts / 2.0);
+    double den = K * K + w * w;
+    return {
+        Kp,
+        (float32_t) ((double) Kr * K / den),
+        (float32_t) (2.0 * (w * w - K * K) / den),
+        lower_bound,
+        upper_bound,
+    };
+}
+
+template <const pid_coefficients &C>
+class FixedPid
+{
+public:
+    /**
+     * @param value initial value of the output.
+     */
+    void reset(float32_t value = 0.0F)
+    {
+        integral = value;
+        derivative = 0.0F;
+        previous_error = 0.0F;
+    }
+
+    float32_t calculateWithReturn(float32_t reference, float32_t measurement)
+    {
+        float32_t error = reference - measurement;
+        float32_t output = C.kp * error + integral;
+        if constexpr (C.kd != 0.0F) {
+            derivative = C.ad * derivative + C.kd * (error - previous_error);
+            previous_error = error;
+            output += derivative;
+        }
+        if constexpr (C.ki != 0.0F) {
+            integral += C.ki * error;
+            integral = integral > C.upper_bound ? C.upper_bound : integral;
+            integral = integral < C.lower_bound ? C.lower_bound : integral;
+        }
+        output = output > C.upper_bound ? C.upper_bound : output;
+        output = output < C.lower_bound ? C.lower_bound : output;
+        return output;
+    }
+
+private:
+    float32_t integral = 0.0F;
+    float32_t derivative = 0.0F;
+    float32_t previous_error = 0.0F;
+};
+
+template <const pr_coefficients &C>
+class FixedPr
+{
+public:
+    void reset()
+    {
+        e1 = 0.0F;
+        e2 = 0.0F;
+        r1 = 0.0F;
+        r2 = 0.0F;
+    }
+
+    float32_t calculateWithReturn(float32_t reference, float32_t measurement)
+    {
+        float32_t error = reference - measurement;
+        float32_t r = C.b0 * (error - e2) - C.a1 * r1 - r2;
+        e2 = e1;
+        e1 = error;
+        r2 = r1;
+        r1 = r;
+        float32_t output = C.kp * error + r;
+        output = output > C.upper_bound ? C.upper_bound : output;
+        output = output < C.lower_bound ? C.lower_bound : output;
+        return output;
+    }
+
+private:
+    float32_t e1 = 0.0F; // e(k-1)
+    float32_t e2 = 0.0F; // e(k-2)
+    float32_t r1 = 0.0F; // r(k-1)
+    float32_t r2 = 0.0F; // r(k-2)
+};
+
+#endif // FIXED_CONTROLLERS_H_
@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2021-2024 LAAS-CNRS
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published by
+ *   the Free Software Foundation, either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGLPV2.1
+ */
+
+/**
+ * @brief  Benchmark of the critical tasks of the examples, without power
+ *         stage: the control code of each example is run against synthetic
+ *         measures and its cycles per tick, maximum control frequency, stack
+ *         and RAM are printed as JSON lines.
+ *
+ *         It only needs a SPIN board: the PWM is not started. Compare the
+ *         output with a baseline by `compare_benchmark.py`.
+ */
+
+//--------------OWNTECH APIs----------------------------------
+#include "TaskAPI.h"
+#include "SpinAPI.h"
+
+#include "control_kernels.h"
+#include "cycle_benchmark.h"
+
+#include "zephyr/console/console.h"
+
+//--------------SETUP FUNCTIONS DECLARATION-------------------
+void setup_routine(); // Setups the hardware and software of the system
+
+//--------------LOOP FUNCTIONS DECLARATION--------------------
+void loop_communication_task(); // code to be executed in the slow communication task
+void loop_application_task();   // Code to be executed in the background task
+
+//--------------USER VARIABLES DECLARATIONS-------------------
+uint8_t received_serial_char;
+
+static CycleBenchmark benchmark;
+static BuckVoltageKernel buck_voltage_mode;
+static BuckCurrentKernel buck_current_mode;
+static GridFormingKernel<true> grid_forming;
+static GridFormingKernel<false> grid_forming_low_pass;
+static GridFollowingKernel grid_following;
+static PeerToPeerServerKernel peer_to_peer_server;
+static PeerToPeerClientKernel peer_to_peer_client;
+
+static volatile bool benchmark_asked = true; // once at start, then on 'b'
+static const uint32_t START_DELAY_MS = 2000; // [ms] to open the serial monitor
+
+//--------------SETUP FUNCTIONS-------------------------------
+
+/**
+ * This is the setup routine.
+ * It is used to call functions that will initialize your spin, twist, data and/or tasks.
+ * In this example, we setup the version of the spin board and two background tasks.
+ * The critical task is not used, the benchmark runs in the application task.
+ */
+void setup_routine()
+{
+    // Setup the hardware first
+    spin.version.setBoardVersion(SPIN_v_1_0);
+
+    benchmark.init();
+
+    // Then declare tasks
+    uint32_t app_task_number = task.createBackground(loop_application_task);
+    uint32_t com_task_number = task.createBackground(loop_communication_task);
+
+    // Finally, start tasks
+    task.startBackground(app_task_number);
+    task.startBackground(com_task_number);
+}
+
+//--------------LOOP FUNCTIONS--------------------------------
+
+void loop_communication_task()
+{
+    while (1)
+    {
+        received_serial_char = console_getchar();
+        switch (received_serial_char)
+        {
+        case 'h':
+            //----------SERIAL INTERFACE MENU-----------------------
+            printk(" ________________________________________\n");
+            printk("|     ---- MENU control loops bench ---- |\n");
+            printk("|     press b : run the benchmark        |\n");
+            printk("|________________________________________|\n\n");
+            //------------------------------------------------------
+            break;
+        case 'b':
+            benchmark_asked = true;
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+/**
+ * This is the code loop of the background task
+ * It runs the kernels one after the other, the interrupts are masked during
+ * each timed tick only, so the console stays alive.
+ */
+void loop_application_task()
+{
+    static bool first = true;
+    if (first) {
+        first = false;
+        task.suspendBackgroundMs(START_DELAY_MS);
+        return;
+    }
+    if (benchmark_asked)
+    {
+        benchmark_asked = false;
+        spin.led.turnOn();
+        CycleBenchmark::printSystem();
+        CycleBenchmark::print(benchmark.run(buck_voltage_mode));
+        CycleBenchmark::print(benchmark.run(buck_current_mode));
+        CycleBenchmark::print(benchmark.run(grid_forming));
+        CycleBenchmark::print(benchmark.run(grid_forming_low_pass));
+        CycleBenchmark::print(benchmark.run(grid_following));
+        CycleBenchmark::print(benchmark.run(peer_to_peer_server));
+        CycleBenchmark::print(benchmark.run(peer_to_peer_client));
+        printk("{\"bench\":\"end\"}\n");
+        spin.led.turnOff();
+    }
+    task.suspendBackgroundMs(100);
+}
+
+/**
+ * This is the main function of this example
+ * This function is generic and does not need editing.
+ */
+int main(void)
+{
+    setup_routine();
+
+    return 0;
+}
@@ -0,0 +1,223 @@
+/*
+ * Copyright (c) 2021-2024 LAAS-CNRS
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published by
+ *   the Free Software Foundation, either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGLPV2.1
+ */
+
+/**
+ * @brief  Periodic tasks at integer divisions of the critical task rate.
+ *
+ *         Each task is a function run every `divider` ticks of the critical
+ *         task:
+ *
+ *             scheduler.add(scope_task, "scope", 3);  // every 3 ticks
+ *             ...
+ *             void loop_critical_task()
+ *             {
+ *                 // fast control
+ *                 scheduler.run();
+ *             }
+ *
+ *         All the tasks run in the critical task, one after the other: the
+ *         tasks of the same tick are run by decreasing priority, a task does
+ *         not preempt another one. Each task has a down counter instead of a
+ *         modulo of the tick counter, and the tasks of the same divider are
+ *         shifted to start on different ticks, so that the slow tasks do not
+ *         all fall on the same tick.
+ *
+ *         The execution time of each task and of the ticks is measured with
+ *         the DWT cycle counter. The background task asks a report with
+ *         `requestReport()` and prints it with `printReport()`, as for
+ *         `TaskProfiler`.
+ */
+
+#ifndef MULTIRATE_SCHEDULER_H_
+#define MULTIRATE_SCHEDULER_H_
+
+#include <soc.h> // DWT cycle counter and SystemCoreClock
+
+#include "zephyr/kernel.h"
+
+#define MULTIRATE_MAX_TASKS 8
+
+typedef void (*multirate_function_t)();
+
+struct multirate_stats
+{
+    uint32_t nb_runs;
+    uint32_t exec_max;  // [cycles]
+    uint64_t exec_sum;  // [cycles]
+};
+
+class MultirateScheduler
+{
+public:
+    /**
+     * @param function  code of the task.
+     * @param name      printed in the report.
+     * @param divider   run every `divider` ticks, at least 1.
+     * @param priority  order in a tick, the highest first.
+     * @return the index of the task, -1 if the scheduler is full.
+     */
+    int8_t add(multirate_function_t function, const char *name, uint16_t divider,
+               uint8_t priority = 0)
+    {
+        if (nb_tasks >= MULTIRATE_MAX_TASKS) {
+            return -1;
+        }
+        CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+        DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+        // keep the tasks sorted by decreasing priority
+        uint8_t k = nb_tasks;
+        while (k > 0 && tasks[k - 1].priority < priority) {
+            tasks[k] = tasks[k - 1];
+            order[tasks[k].index] = k;
+            k--;
+        }
+        multirate_task &t = tasks[k];
+        t.function = function;
+        t.name = name;
+        t.priority = priority;
+        t.index = nb_tasks;
+        order[nb_tasks] = k;
+        nb_tasks++;
+        setDivider(t.index, divider);
+        clear(t.stats);
+        clear(t.report);
+        return t.index;
+    }
+
+    /**
+     * @brief change the divider of the task `index`, e.g. when the period of
+     * the critical task is changed.
+     */
+    void setDivider(int8_t index, uint16_t divider)
+    {
+        multirate_task &t = tasks[order[index]];
+        t.divider = divider ? divider : 1;
+        // first run shifted by the number of other tasks of this divider
+        uint16_t shift = 0;
+        for (uint8_t k = 0; k < nb_tasks; k++) {
+            if (&tasks[k] != &t && tasks[k].divider == t.divider) {
+                shift++;
+            }
+        }
+        t.counter = shift % t.divider;
+    }
+
+    /**
+     * @brief run the tasks due on this tick, at the end of the critical task.
+     */
+    void run()
+    {
+        if (report_asked) {
+            for (uint8_t k = 0; k < nb_tasks; k++) {
+                tasks[k].report = tasks[k].stats;
+                clear(tasks[k].stats);
+            }
+            report_tick_max = tick_max;
+            tick_max = 0;
+            report_asked = false;
+            report_ready = true;
+        }
+
+        uint32_t tick_start = DWT->CYCCNT;
+        for (uint8_t k = 0; k < nb_tasks; k++) {
+            multirate_task &t = tasks[k];
+            if (t.counter != 0) {
+                t.counter--;
+                continue;
+            }
+            t.counter = t.divider - 1;
+            uint32_t start = DWT->CYCCNT;
+            t.function();
+            uint32_t exec = DWT->CYCCNT - start;
+            t.stats.nb_runs++;
+            t.stats.exec_sum += exec;
+            if (exec > t.stats.exec_max) {
+                t.stats.exec_max = exec;
+            }
+        }
+        uint32_t tick = DWT->CYCCNT - tick_start;
+        if (tick > tick_max) {
+            tick_max = tick;
+        }
+    }
+
+    void requestReport()
+    {
+        report_ready = false;
+        report_asked = true;
+    }
+
+    /**
+     * @brief print the rate and the execution times of each task, once
+     * copied by the critical task.
+     *
+     * @param period_us [us] period of the critical task.
+     * @return true if the report was printed.
+     */
+    bool printReport(uint32_t period_us)
+    {
+        if (!report_ready) {
+            return false;
+        }
+        report_ready = false;
+
+        const float32_t us = 1e6F / (float32_t) SystemCoreClock;
+        printk("task             | rate [Hz] | runs     | mean [us] | max [us]\n");
+        for (uint8_t k = 0; k < nb_tasks; k++) {
+            multirate_stats &s = tasks[k].report;
+            float32_t mean = s.nb_runs ? (float32_t) (s.exec_sum / s.nb_runs) * us : 0.0F;
+            printk("%-16s | %9.1f | %8u | %9.2f | %8.2f\n", tasks[k].name,
+                   1e6F / (float32_t) (period_us * tasks[k].divider),
+                   s.nb_runs, mean, s.exec_max * us);
+        }
+        printk("worst tick: %.2f us of the %u us period\n", report_tick_max * us, period_us);
+        return true;
+    }
+
+private:
+    struct multirate_task
+    {
+        multirate_function_t function;
+        const char *name;
+        uint16_t divider;
+        uint16_t counter;  // ticks before the next run
+        uint8_t priority;
+        uint8_t index;     // returned by add()
+        multirate_stats stats;
+        multirate_stats report;
+    };
+
+    static void clear(multirate_stats &s)
+    {
+        s.nb_runs = 0;
+        s.exec_max = 0;
+        s.exec_sum = 0;
+    }
+
+    multirate_task tasks[MULTIRATE_MAX_TASKS];
+    uint8_t order[MULTIRATE_MAX_TASKS]; // index -> position in tasks
+    uint8_t nb_tasks = 0;
+    uint32_t tick_max = 0;         // [cycles] all the tasks of a tick
+    uint32_t report_tick_max = 0;
+    volatile bool report_asked = false;
+    volatile bool report_ready = false;
+};
+
+#endif // MULTIRATE_SCHEDULER_H_
@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2021-2024 LAAS-CNRS
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published by
+ *   the Free Software Foundation, either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGLPV2.1
+ */
+
+/**
+ * @brief  SOGI-FLL synchronisation and lock detector for single phase grids.
+ *
+ *         The second order generalised integrator (SOGI) gives v', the
+ *         fundamental of the grid voltage v, and qv', the same signal
+ *         delayed by 90 degrees. The frequency locked loop (FLL) adapts the
+ *         frequency of the SOGI: it is driven by the error v - v' multiplied
+ *         by qv' and normalised by the square of the amplitude, so its
+ *         dynamic does not depend on the grid voltage.
+ *
+ *         v = V.sin(theta) gives v' = V.sin(theta) and qv' = -V.cos(theta),
+ *         so the sine of the grid angle is v' / V without any trigonometric
+ *         function.
+ *
+ *         The lock detector filters the normalised error |v - v'| / V and the
+ *         frequency deviation. The grid is locked when both stay under their
+ *         limits during `hold_time`, and unlocked as soon as one of them is
+ *         over twice its limit, or the amplitude is too low.
+ */
+
+#ifndef SOGI_FLL_H_
+#define SOGI_FLL_H_
+
+#include <math.h>
+#include "trigo.h" // float32_t, as the other control library modules
+
+class SogiFll
+{
+public:
+    /**
+     * @param Ts    [s] sampling period.
+     * @param w0    [rad/s] nominal pulsation, initial value of the FLL.
+     * @param k     damping of the SOGI, sqrt(2) is a good trade-off between
+     *              its speed and its filtering.
+     * @param gamma [1/s] gain of the FLL, its settling time is about 5 / gamma.
+     */
+    SogiFll(float32_t Ts, float32_t w0, float32_t k = 1.41F, float32_t gamma = 100.0F)
+        : Ts(Ts), w0(w0), k(k), gamma(gamma)
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        v_in = 0.0F;
+        v_quad = 0.0F;
+        error = 0.0F;
+        w = w0;
+        amplitude = 0.0F;
+        sin_theta = 0.0F;
+        cos_theta = 1.0F;
+    }
+
+    /**
+     * @param v [V] grid voltage.
+     */
+    void calculate(float32_t v)
+    {
+        error = v - v_in;
+        // semi implicit Euler: qv' uses the updated v', the oscillation is
+        // not amplified by the discretisation.
+        v_in += Ts * w * (k * error - v_quad);
+        v_quad += Ts * w * v_in;
+
+        float32_t square = v_in * v_in + v_quad * v_quad;
+        amplitude = sqrtf(square);
+        if (square > 1e-3F) {
+            w -= Ts * gamma * k * w * error * v_quad / square;
+            // with this discretisation v' leads v by one sample: the angle
+            // is brought back by w.Ts (first order rotation).
+            float32_t inv = 1.0F / amplitude;
+            float32_t dtheta = w * Ts;
+            sin_theta = (v_in + dtheta * v_quad) * inv;
+            cos_theta = (dtheta * v_in - v_quad) * inv;
+        }
+    }
+
+    float32_t getSin() { return sin_theta; }
+    float32_t getCos() { return cos_theta; }
+    float32_t getAngle() { return atan2f(sin_theta, cos_theta); } // in [-pi, pi]
+    float32_t getAmplitude() { return amplitude; }
+    float32_t getW() { return w; }
+    float32_t getError() { return error; }
+
+private:
+    const float32_t Ts;
+    const float32_t w0;
+    const float32_t k;
+    const float32_t gamma;
+    float32_t v_in;   // v'
+    float32_t v_quad; // qv'
+    float32_t error;  // v - v'
+    float32_t w;
+    float32_t amplitude;
+    float32_t sin_theta;
+    float32_t cos_theta;
+};
+
+struct lock_criterion
+{
+    float32_t max_error;     // max of the filtered |v - v'| / V
+    float32_t max_dw;        // [rad/s] max of the filtered |w - w0|
+    float32_t min_amplitude; // [V]
+    float32_t tau;           // [s] time constant of the filters
+    float32_t hold_time;     // [s] time inside the limits before lock
+};
+
+class LockDetector
+{
+public:
+    LockDetector(float32_t Ts, float32_t w0, const lock_criterion &criterion)
+        : Ts(Ts), w0(w0), criterion(criterion), alpha(Ts / (criterion.tau + Ts))
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        filtered_error = 1.0F;
+        filtered_dw = criterion.max_dw * 2.0F;
+        counter = 0;
+        locked = false;
+    }
+
+    /**
+     * @brief update the metric, to be called after `fll.calculate()`.
+     *
+     * @return true when the grid is locked.
+     */
+    bool calculate(SogiFll &fll)
+    {
+        float32_t amplitude = fll.getAmplitude();
+        float32_t error = amplitude > criterion.min_amplitude
+                        ? fabsf(fll.getError()) / amplitude : 1.0F;
+        // first order low pass filters
+        filtered_error += alpha * (error - filtered_error);
+        filtered_dw += alpha * (fabsf(fll.getW() - w0) - filtered_dw);
+
+        bool inside = filtered_error < criterion.max_error
+                   && filtered_dw < criterion.max_dw
+                   && amplitude > criterion.min_amplitude;
+        bool outside = filtered_error > 2.0F * criterion.max_error
+                    || filtered_dw > 2.0F * criterion.max_dw
+                    || amplitude < criterion.min_amplitude;
+
+        if (!locked) {
+            counter = inside ? counter + 1 : 0;
+            if (counter * Ts >= criterion.hold_time) {
+                locked = true;
+            }
+        } else if (outside) {
+            locked = false;
+            counter = 0;
+        }
+        return locked;
+    }
+
+    bool isLocked() { return locked; }
+    float32_t getFilteredError() { return filtered_error; }
+    float32_t getFilteredDw() { return filtered_dw; }
+
+private:
+    const float32_t Ts;
+    const float32_t w0;
+    const lock_criterion criterion;
+    const float32_t alpha; // coefficient of the filters
+    float32_t filtered_error;
+    float32_t filtered_dw;
+    uint32_t counter;
+    bool locked;
+};
+
+#endif // SOGI_FLL_H_
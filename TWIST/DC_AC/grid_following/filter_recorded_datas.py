@@ -18,92 +18,43 @@ SPDX-License-Identifier: LGLPV2.1
 """
 
 """
-@brief  This is a class for the factory test of Twitst 1.4.1
+@brief  This is a class for filtering recorded data from the SPIN board
 
-@author Regis Ruelland <rruelland@laas.fr>
+@author Regis Ruelland <regis.ruelland@laas.fr>
 """
 
 from platformio.public import DeviceMonitorFilterBase
-from datetime import datetime
-import struct
-import io 
-IDLE = 0
-RECORD = 1
+import os
+import sys
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from scope_decoder import ScopeDecoder  # noqa: E402
+
+OUTPUT_FORMAT = 'txt'  # 'txt', 'parquet' (pyarrow) or 'hdf5' (h5py), see scope_decoder.py
+
 
 class RecordedDatas(DeviceMonitorFilterBase):
     """
-    1. It waits for "begin record" character sequence
-    2. then we assume each line as a 8 bytes in hexa
-    the 8 bytes are translated to float and recorded in a file.
-    3. It waits for "end record" character sequence to finish writing file.
-    """
-    NAME="recorded_datas"
+    Saves the scope records and the telemetry sent in binary frames by
+    `scope_stream.h` and `telemetry.h`, decoded by `ScopeDecoder`, and
+    passes the text printed by the board to the monitor.
 
-    # TODO: make more test, because not sure of its robustness... :-/
+    The serial monitor must not decode the bytes as utf-8, so in platformio.ini:
+    monitor_encoding = latin-1
+    """
+    NAME = "recorded_datas"
 
     def __init__(self, *args, **kwargs):
         super().__init__(*args, **kwargs)
-        self.f = None
-        self.state = IDLE
-        self.buffer = ""
-        self.f = io.StringIO()
-
+        self.decoder = ScopeDecoder(OUTPUT_FORMAT)
         print("recorded filter is loaded")
 
     def rx(self, text):
-        self.buffer += text
-        if '\n' in self.buffer:
-            datas_left = ''
-            cr_idx = self.buffer.rfind('\n')
-            txt_to_read = self.buffer[:cr_idx]
-            if 'begin record' in txt_to_read:
-                idx = self.buffer.find('begin record\r\n') # FIXME: no so clear with \n
-                txt_to_read = txt_to_read[idx+14:]
-                self.state = RECORD
-                
-            if 'end record' in txt_to_read:
-                idx = txt_to_read.find('end record')
-                txt_to_read = txt_to_read[:idx]
-                lines = txt_to_read.split("\r\n")
-                datas_left = self.save_datas(lines)
-                self.state  = IDLE
-
-                with open(f"{datetime.now().strftime('%Y-%m-%d_%H-%M-%S')}-record.txt", "w+") as ff:
-                    ff.write(self.f.getvalue())
-                self.f.close()
-                self.f = io.StringIO()
-
-            if self.state == RECORD:
-                lines = txt_to_read.split("\r\n")
-                datas_left = self.save_datas(lines)
-
-            self.buffer = datas_left + self.buffer[cr_idx:] 
-        return text
+        datas = text.encode('latin-1', errors='replace')
+        return self.decoder.feed(datas).decode('latin-1')
 
     def tx(self, text):
         return text
 
     def __del__(self):
-        if self.f:
-            if not self.f.closed:
-                self.f.close()
-
-
-    def save_datas(self, lines):
-        datas_left = ''
-        # the last data should be '' 
-        if lines[-1] != '':
-            datas_left = lines.pop()
-        else:
-            lines.pop()
-        for k, line in enumerate(lines):
-            if "#" in line:
-                self.f.write("{}\n".format(line[1:]))
-            else:
-                try:
-                    nombre = struct.unpack('>f', bytes.fromhex(line))[0]
-                    self.f.write("{}\n".format(nombre))
-                except:
-                    nombre = 0.0
-                    self.f.write("{}\n".format(line))
-        return datas_left
+        self.decoder.close()
@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2021-2024 LAAS-CNRS
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published by
+ *   the Free Software Foundation, either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGLPV2.1
+ */
+
+/**
+ * @brief  Control of the grid following inverter, run by the critical task.
+ *
+ *         `synchronise()` runs the SOGI-FLL and its lock detector at each
+ *         tick and gives the reference of the current in phase with the
+ *         grid voltage. Once locked, `dutyCycle()` is the power mode: the Pr
+ *         of the current, added to the grid voltage. `connectScope()` gives
+ *         the channels of the packed scope (PACKED_SCOPE).
+ *
+ *         The benchmark of TWIST/Benchmark/control_loops includes a copy of
+ *         this file: its `GridFollowingKernel` runs the same code against
+ *         synthetic measures, a change of the control is timed without
+ *         being copied.
+ */
+
+#ifndef GRID_FOLLOWING_CONTROL_H_
+#define GRID_FOLLOWING_CONTROL_H_
+
+#include "pr.h"
+#include "sogi_fll.h"
+#include "scope_stream.h"
+#include "twist_measures.h"
+
+#define GRID_FOLLOWING_KP 0.2F // Pr of the current
+#define GRID_FOLLOWING_KR 3000.0F
+
+class GridFollowingControl
+{
+public:
+    /**
+     * @param Ts        [s] period of the critical task.
+     * @param w0        [rad/s] pulsation of the grid.
+     * @param criterion lock criterion of the SOGI-FLL.
+     */
+    GridFollowingControl(float32_t Ts, float32_t w0, const lock_criterion &criterion)
+        : fll(Ts, w0), lock(Ts, w0, criterion), w0(w0)
+    {
+    }
+
+    /**
+     * @brief discretise the Pr with Ts.
+     *
+     * @param Udc [V] assumed DC voltage, bound of the output of the Pr.
+     */
+    void initPr(float32_t Ts, float32_t Udc)
+    {
+        this->Udc = Udc;
+        prop_res.init(PrParams(Ts, GRID_FOLLOWING_KP, GRID_FOLLOWING_KR, w0, 0.0F, -Udc, Udc));
+    }
+
+    /**
+     * @brief SOGI-FLL, at each tick: it is already synchronised when the
+     * power is asked and it is not reset after a loss of lock.
+     *
+     * @param power_asked    the reference of the current is given.
+     * @param Iref_amplitude [A] amplitude of the current.
+     * @return true when locked and the power asked.
+     */
+    bool synchronise(const twist_measures &meas, bool power_asked, float32_t Iref_amplitude)
+    {
+        fll.calculate(meas.V1_low - meas.V2_low);
+        bool locked = lock.calculate(fll) && power_asked;
+        if (power_asked) {
+            Iref = Iref_amplitude * fll.getSin();
+            pll_w = fll.getW();
+            pll_angle = fll.getAngle();
+        }
+        return locked;
+    }
+
+    /**
+     * @brief power mode, once locked.
+     *
+     * @return the duty cycle of the two legs.
+     */
+    float32_t dutyCycle(const twist_measures &meas)
+    {
+        pr_value = prop_res.calculateWithReturn(Iref, meas.I1_low);
+        Vgrid = meas.V1_low - meas.V2_low;
+        duty_cycle = (Vgrid + pr_value) / (2.0 * Udc) + 0.5F;
+        return duty_cycle;
+    }
+
+    /**
+     * @brief channels of the packed scope, int16 in 1 mA and 10 mV steps,
+     * Q15 duty cycle, Q12 angle and Q6 pulsation.
+     */
+    void connectScope(ContinuousScopeBase &scope, twist_measures &meas)
+    {
+        scope.connectChannel(meas.I1_low, "I1_low_value", 1000.0F);
+        scope.connectChannel(meas.I2_low, "I2_low_value", 1000.0F);
+        scope.connectChannel(meas.V1_low, "V1_low_value", 100.0F);
+        scope.connectChannel(meas.V2_low, "V2_low_value", 100.0F);
+        scope.connectChannel(meas.V_high, "V_high", 100.0F);
+        scope.connectChannel(duty_cycle, "duty_cycle", 32768.0F);
+        scope.connectChannel(Vgrid, "Vgrid", 100.0F);
+        scope.connectChannel(pll_angle, "pll_angle", 4096.0F);
+        scope.connectChannel(pll_w, "pll_w", 64.0F);
+    }
+
+    SogiFll fll;
+    LockDetector lock;
+    Pr prop_res;            // of the current
+    float32_t Iref = 0.0F;  // [A]
+    float32_t Vgrid = 0.0F; // [V]
+    float32_t pll_w = 0.0F;     // [rad/s]
+    float32_t pll_angle = 0.0F; // [rad]
+    float32_t pr_value = 0.0F;
+    float32_t duty_cycle = 0.0F;
+
+private:
+    const float32_t w0;
+    float32_t Udc = 1.0F;
+};
+
+#endif // GRID_FOLLOWING_CONTROL_H_
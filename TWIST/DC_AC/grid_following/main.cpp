@@ -36,6 +36,11 @@
 #include "trigo.h"
 #include "filters.h"
 #include "ScopeMimicry.h"
+#include "scope_stream.h"
+#include "twist_measures.h"
+#include "sogi_fll.h"
+#include "grid_following_control.h"
+#include "setpoints.h"
 #include "zephyr/console/console.h"
 
 //--------------SETUP FUNCTIONS DECLARATION-------------------
@@ -45,6 +50,15 @@ void setup_routine(); // Setups the hardware and software of the system
 void loop_communication_task(); // code to be executed in the slow communication task
 void loop_application_task();   // Code to be executed in the background task
 void loop_critical_task();     // Code to be executed in real time in the critical task
+void lock_benchmark();         // lock time after phase steps, in idle mode
+
+// Comment to use the PllSinus of the control library, it is reset at each
+// connection and is locked after 400 ticks in a fixed window.
+#define PLL_SOGI_FLL
+
+// Comment to record float32 samples with ScopeMimicry: the packed scope
+// records int16 samples, twice as many in the same memory.
+#define PACKED_SCOPE
 
 //--------------USER VARIABLES DECLARATIONS-------------------
 static uint32_t control_task_period = 100; //[us] period of the control task
@@ -53,12 +67,8 @@ static bool pwm_enable = false;            //[bool] state of the PWM (ctrl task)
 uint8_t received_serial_char;
 
 /* Measure variables */
-static float32_t V1_low_value; //[V]
-static float32_t V2_low_value; //[V]
-static float32_t I1_low_value; //[A]
-static float32_t I2_low_value; //[A]
-static float32_t V_high; //[V]
-static float32_t I_high; //[A]
+static twist_measures meas; // latest measures, updated by the critical task
+static TwistMeasures measures; // acquisition of the measures
 
 static float32_t I1_offset = 0.0F;
 static float32_t I2_offset = 0.0F;
@@ -67,56 +77,45 @@ static float32_t I2_offset_tmp = 0.F;
 static const uint32_t NB_OFFSET = 100;
 static const float32_t INV_NB_OFFSET = 1.0F/((float32_t) NB_OFFSET);
 
-static float32_t Iref; // [A] 
-static float32_t Vgrid; //[V]
 static float32_t Vgrid_amplitude = 16.0F; // amplitude of the voltage in [V]
-static float meas_data; // temp storage meas value (ctrl task)
-static float32_t Iref_amplitude = 0.5F; // [A]
-/* duty_cycle*/
-static float32_t duty_cycle;
+static float32_t Iref_amplitude = 0.5F; // [A] copy of the setpoints, for the critical task
 static const float32_t Udc = 40.0F; // Vhigh assumed to be around 40V
 /* Sinewave settings */
 static const float f0 = 50.0F;
 static const float w0 = 2.F * PI * f0; 
 
 //------------- PR RESONANT -------------------------------------
-static Pr prop_res;
 static PllSinus pll;
 static PllDatas pll_datas;
-static float32_t pll_w;
-static float32_t pll_angle;
 static uint32_t pll_counter = 0;
 static bool pll_is_locked = false;
-static float32_t pr_value;
 static float32_t Ts = control_task_period * 1.0e-6F;
-static float32_t Kp = 0.2F;
-static float32_t Kr = 3000.0F;
+
+//------------- SOGI-FLL ----------------------------------------
+// lock criterion: filtered normalised error, filtered frequency deviation,
+// amplitude, time constant of the filters and hold time.
+static const lock_criterion criterion = {0.05F, 2.F * PI * 3.0F, 5.0F, 2e-3F, 5e-3F};
+// SOGI-FLL, its lock detector and the Pr of the current
+static GridFollowingControl control(Ts, w0, criterion);
 
 uint32_t control_loop_counter;
 
 //---------------------------------------------------------------
+#ifdef PACKED_SCOPE
+// 2048 samples of 9 int16 channels, the memory of ScopeMimicry(1024, 9)
+static OneShotScope<1024 * 9 * sizeof(float32_t), 9> scope;
+#else
 static ScopeMimicry scope(1024, 9);
+#endif
+static ScopeStream scope_stream; // send the records in binary frames
 bool is_downloading = false;
 
+#ifndef PACKED_SCOPE
 bool a_trigger() {
     return true;
 }
+#endif
 
-void dump_scope_datas(ScopeMimicry &scope)  {
-    uint8_t *buffer = scope.get_buffer();
-    uint16_t buffer_size = scope.get_buffer_size() >> 2; // we divide by 4 (4 bytes per float data) 
-    printk("begin record\n");
-    printk("#");
-    for (uint16_t k=0;k < scope.get_nb_channel(); k++) {
-        printk("%s,", scope.get_channel_name(k));
-    }
-    printk("\n");
-    for (uint16_t k=0;k < buffer_size; k++) {
-        printk("%08x\n", *((uint32_t *)buffer + k));
-        task.suspendBackgroundUs(100);
-    }
-    printk("end record\n");
-}
 
 enum serial_interface_menu_mode // LIST OF POSSIBLE MODES FOR THE OWNTECH CONVERTER
 {
@@ -125,7 +124,15 @@ enum serial_interface_menu_mode // LIST OF POSSIBLE MODES FOR THE OWNTECH CONVER
 };
 
 uint8_t mode = IDLEMODE;
-uint8_t mode_asked = IDLEMODE;
+uint8_t mode_asked = IDLEMODE; // copy of the setpoints, for the critical task
+
+struct grid_following_setpoints // given by the communication task
+{
+    uint8_t mode_asked;
+    float32_t Iref_amplitude; // [A]
+};
+
+static SetpointBlock<grid_following_setpoints> setpoints({IDLEMODE, 0.5F});
 
 //--------------SETUP FUNCTIONS-------------------------------
 
@@ -147,19 +154,26 @@ void setup_routine()
     twist.initLegBuck(LEG1);
     twist.initLegBoost(LEG2);
 
-    scope.connectChannel(I1_low_value, "I1_low_value");
-    scope.connectChannel(I2_low_value, "I2_low_value");
-    scope.connectChannel(V1_low_value, "V1_low_value");
-    scope.connectChannel(V2_low_value, "V2_low_value");
-    scope.connectChannel(V_high, "V_high");
-    scope.connectChannel(duty_cycle, "duty_cycle");
-    scope.connectChannel(Vgrid, "Vgrid");
-    scope.connectChannel(pll_angle, "pll_angle");
-    scope.connectChannel(pll_w, "pll_w");
-
+#ifdef PACKED_SCOPE
+    control.connectScope(scope, meas);
+#else
+    scope.connectChannel(meas.I1_low, "I1_low_value");
+    scope.connectChannel(meas.I2_low, "I2_low_value");
+    scope.connectChannel(meas.V1_low, "V1_low_value");
+    scope.connectChannel(meas.V2_low, "V2_low_value");
+    scope.connectChannel(meas.V_high, "V_high");
+    scope.connectChannel(control.duty_cycle, "duty_cycle");
+    scope.connectChannel(control.Vgrid, "Vgrid");
+    scope.connectChannel(control.pll_angle, "pll_angle");
+    scope.connectChannel(control.pll_w, "pll_w");
+#endif
+
+#ifndef PACKED_SCOPE
     scope.set_delay(0.0F);
     scope.set_trigger(a_trigger);
+#endif
     scope.start();
+    scope_stream.init();
     
     // Then declare tasks
     uint32_t app_task_number = task.createBackground(loop_application_task);
@@ -172,16 +186,100 @@ void setup_routine()
     task.startCritical(); // Uncomment if you use the critical task
 
     // Proportional resonant initialisation.
-    PrParams params(Ts, Kp, Kr, w0, 0.0F, -Udc, Udc);
-    prop_res.init(params);
+    control.initPr(Ts, Udc);
     float32_t rise_time = 50e-3;
     pll.init(Ts, Vgrid_amplitude, f0, rise_time);
 }
 
+//--------------BENCHMARK-----------------------------------------
+
+static const uint32_t BENCH_MAX_TICKS = 10000; // 1 s at 100 us
+
+/* synthetic grid voltage, with a phase step at tick `step_tick` */
+static float32_t bench_voltage(uint32_t tick, uint32_t step_tick, float32_t step)
+{
+    float32_t phase = tick < step_tick ? 0.0F : step;
+    return Vgrid_amplitude * sinf(w0 * Ts * (float32_t) tick + phase);
+}
+
+/**
+ * Lock time after a phase step of a 16 V, 50 Hz voltage computed in the
+ * background task, with the same period as the critical task.
+ *
+ * The SOGI-FLL runs until locked, then the phase steps: we count the ticks
+ * before the detector unlocks and before it locks again (it may also stay
+ * locked if the step is absorbed by the filters).
+ * The PllSinus is reset at the step, as it is on each new connection, and we
+ * count the ticks before the 400 ticks criterion is satisfied.
+ */
+void lock_benchmark()
+{
+    const float32_t ms = Ts * 1e3F;
+    printk("lock time after a phase step [ms]\n");
+    printk("step | SOGI-FLL lock, unlock, relock | PllSinus reset, relock\n");
+    for (int32_t deg = 30; deg <= 90; deg += 30)
+    {
+        float32_t step = (float32_t) deg * PI / 180.0F;
+
+        SogiFll bench_fll(Ts, w0);
+        LockDetector bench_lock(Ts, w0, criterion);
+        uint32_t tick = 0;
+        bool locked = false;
+        while (!locked && tick < BENCH_MAX_TICKS)
+        {
+            bench_fll.calculate(bench_voltage(tick, UINT32_MAX, 0.0F));
+            locked = bench_lock.calculate(bench_fll);
+            tick++;
+        }
+        uint32_t first_lock = tick;
+        uint32_t unlock = 0;
+        uint32_t relock = 0;
+        for (uint32_t k = 1; k <= BENCH_MAX_TICKS; k++, tick++)
+        {
+            bench_fll.calculate(bench_voltage(tick, first_lock, step));
+            locked = bench_lock.calculate(bench_fll);
+            if (!locked && unlock == 0) {
+                unlock = k;
+            }
+            if (locked && unlock != 0) {
+                relock = k;
+                break;
+            }
+        }
+
+        PllSinus bench_pll;
+        PllDatas datas;
+        bench_pll.init(Ts, Vgrid_amplitude, f0, 50e-3F);
+        bench_pll.reset(f0);
+        uint32_t counter = 0;
+        uint32_t legacy = 0;
+        for (uint32_t k = 1; k <= BENCH_MAX_TICKS; k++)
+        {
+            datas = bench_pll.calculateWithReturn(bench_voltage(k, 0, step));
+            if ((datas.error < 2.5F) && (datas.error > -2.5F) && (datas.w < 333.0F) && (datas.w > 295.0F)) {
+                counter++;
+            }
+            if (counter > 400) {
+                legacy = k;
+                break;
+            }
+        }
+
+        printk("%3d  | %6.1f", deg, first_lock * ms);
+        if (unlock == 0) {
+            printk(" still locked   ");
+        } else {
+            printk(" %6.1f %6.1f", unlock * ms, relock * ms);
+        }
+        printk(" | %6.1f\n", legacy * ms);
+    }
+}
+
 //--------------LOOP FUNCTIONS--------------------------------
 
 void loop_communication_task()
 {
+    grid_following_setpoints &asked = setpoints.edit();
     while (1)
     {
         received_serial_char = console_getchar();
@@ -196,32 +294,56 @@ void loop_communication_task()
             printk("|     press u : Iref up                  |\n");
             printk("|     press d : Iref down                |\n");
             printk("|     press r : retrieve data recorded   |\n");
+            printk("|     press b : lock time benchmark      |\n");
             printk("|________________________________________|\n\n");
             //------------------------------------------------------
             break;
         case 'i':
             printk("idle mode\n");
-            mode_asked = IDLEMODE;
-            scope.start();
-            Iref_amplitude = 0.4F;
+            if (!is_downloading)
+                scope.start();
+            asked.mode_asked = IDLEMODE;
+            asked.Iref_amplitude = 0.4F;
+            setpoints.publish();
             break;
         case 'p':
             if (!is_downloading)
             {
                 printk("power mode\n");
-                mode_asked = POWERMODE;
+                asked.mode_asked = POWERMODE;
+                setpoints.publish();
             }
             break;
         case 'u':
-            if (Iref_amplitude < 0.5F)
-                Iref_amplitude += 0.1F;
+            if (asked.Iref_amplitude < 0.5F)
+                asked.Iref_amplitude += 0.1F;
+            setpoints.publish();
             break;
         case 'd':
-            if (Iref_amplitude > 0.2F)
-                Iref_amplitude -= 0.1F;
+            if (asked.Iref_amplitude > 0.2F)
+                asked.Iref_amplitude -= 0.1F;
+            setpoints.publish();
+            break;
+        case 'b':
+            if (mode == IDLEMODE && mode_asked == IDLEMODE)
+            {
+                lock_benchmark();
+            }
             break;
         case 'r': 
-            is_downloading = true;
+            if (!is_downloading)
+            {
+#ifdef PACKED_SCOPE
+                if (!scope.isReady())
+                {
+                    printk("record not finished\n");
+                    break;
+                }
+#endif
+                scope_stream.begin(scope, 1, control_task_period);
+                is_downloading = true;
+            }
+            break;
         default:
             break;
         }
@@ -236,25 +358,24 @@ void loop_communication_task()
  */
 void loop_application_task()
 {
+    if (is_downloading)
+    {
+        is_downloading = scope_stream.poll();
+        task.suspendBackgroundMs(1);
+        return;
+    }
+
     if (mode == IDLEMODE)
     {
-        if (!is_downloading)
-        {
-            printk("I1_offset = %f:", I1_offset);
-            printk("I2_offset = %f\n", I2_offset);
-        }
-        else 
-        {
-            dump_scope_datas(scope);
-            is_downloading = false;
-        }
+        printk("I1_offset = %f:", I1_offset);
+        printk("I2_offset = %f\n", I2_offset);
     }
     else if (mode == POWERMODE)
     {
 
         printk("%f:", Iref_amplitude);
-        printk("%f:", duty_cycle);
-        printk("%f:", V1_low_value);
+        printk("%f:", control.duty_cycle);
+        printk("%f:", meas.V1_low);
         printk("\n");
     }
     task.suspendBackgroundMs(100);
@@ -269,36 +390,28 @@ void loop_application_task()
 void loop_critical_task()
 {
 
-    meas_data = data.getLatest(I1_LOW);
-    if (meas_data < 10000 && meas_data > -10000)
-        I1_low_value = meas_data - I1_offset;
-
-    meas_data = data.getLatest(V1_LOW);
-    if (meas_data < 10000 && meas_data > -10000)
-        V1_low_value = meas_data;
+    measures.acquire(meas);
 
-    meas_data = data.getLatest(V2_LOW);
-    if (meas_data < 10000 && meas_data > -10000)
-        V2_low_value = meas_data;
-
-    meas_data = data.getLatest(I2_LOW);
-    if (meas_data < 10000 && meas_data > -10000)
-        I2_low_value = meas_data - I2_offset;
-
-    meas_data = data.getLatest(V_HIGH);
-    if (meas_data != -10000)
-        V_high = meas_data;
-
-    meas_data = data.getLatest(I_HIGH);
-    if (meas_data != -10000)
-        I_high = meas_data;
+    // the setpoints of the communication task change on the same tick
+    const grid_following_setpoints &setpoints_read = setpoints.read();
+    mode_asked = setpoints_read.mode_asked;
+    Iref_amplitude = setpoints_read.Iref_amplitude;
 
+#ifdef PLL_SOGI_FLL
+    // the FLL always runs, it is already synchronised when the power is asked
+    // and it is not reset after a loss of lock.
+    pll_is_locked = control.synchronise(meas, mode_asked == POWERMODE, Iref_amplitude);
+    if (mode_asked == POWERMODE)
+    {
+        scope.acquire();
+    }
+#else
     if (mode_asked == POWERMODE)
     { // we must launch the PLL and wait its locking.
-        pll_datas = pll.calculateWithReturn(V1_low_value - V2_low_value);
-        Iref = Iref_amplitude * ot_sin(pll_datas.angle);
-        pll_w = pll_datas.w;
-        pll_angle = pll_datas.angle;
+        pll_datas = pll.calculateWithReturn(meas.V1_low - meas.V2_low);
+        control.Iref = Iref_amplitude * ot_sin(pll_datas.angle);
+        control.pll_w = pll_datas.w;
+        control.pll_angle = pll_datas.angle;
         scope.acquire();
     }
     else
@@ -315,13 +428,11 @@ void loop_critical_task()
     if (pll_counter > 400) {
         pll_is_locked = true;
     }
+#endif
     if (pll_is_locked)
     {
         mode = POWERMODE;
-        pr_value = prop_res.calculateWithReturn(Iref, I1_low_value);
-        Vgrid = V1_low_value - V2_low_value;
-        duty_cycle = (Vgrid + pr_value) / (2.0 * Udc) + 0.5F;
-        twist.setAllDutyCycle(duty_cycle);
+        twist.setAllDutyCycle(control.dutyCycle(meas));
         if (!pwm_enable)
         {
             pwm_enable = true;
@@ -336,20 +447,22 @@ void loop_critical_task()
         if (pwm_enable == true)
         {
             twist.stopAll();
-            duty_cycle = 0;
+            control.duty_cycle = 0;
             spin.led.turnOff();
             pwm_enable = false;
         }
         if (control_loop_counter < NB_OFFSET)
         {
-            I1_offset_tmp += INV_NB_OFFSET * I1_low_value;
-            I2_offset_tmp += INV_NB_OFFSET * I2_low_value;
+            I1_offset_tmp += INV_NB_OFFSET * meas.I1_low;
+            I2_offset_tmp += INV_NB_OFFSET * meas.I2_low;
             spin.led.turnOn();
         } 
         if (control_loop_counter == NB_OFFSET)
         {
             I1_offset = I1_offset_tmp;
             I2_offset = I2_offset_tmp;
+            measures.setOffset(MEAS_I1_LOW, I1_offset);
+            measures.setOffset(MEAS_I2_LOW, I2_offset);
             spin.led.turnOff();
         } 
         if (control_loop_counter > NB_OFFSET) {
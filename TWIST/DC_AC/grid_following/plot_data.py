@@ -25,17 +25,14 @@ SPDX-License-Identifier: LGLPV2.1
 
 import argparse 
 import matplotlib.pyplot as plt
-import numpy as np
+
+from scope_decoder import read
 
 if __name__ == '__main__':
     parser = argparse.ArgumentParser("plot_records", "plot_records <filename>")
-    parser.add_argument("filename")
+    parser.add_argument("filename", help="record or telemetry, .txt, .parquet or .h5")
     args = parser.parse_args()
-    with open(args.filename, 'r') as f:
-        line1 = f.readline()
-        datas = np.fromiter(f, dtype=float)
-    names = line1.split(',')
-    datas = datas.reshape(-1, len(names)-1)
+    names, datas = read(args.filename)
     plt.plot(datas)
     plt.legend(names)
     plt.grid()
@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2021-2024 LAAS-CNRS
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published by
+ *   the Free Software Foundation, either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGLPV2.1
+ */
+
+/**
+ * @brief  Setpoints given by a background task to the critical task.
+ *
+ *         The setpoints are gathered in one struct. The background task
+ *         (the only writer) changes its own copy with `edit()` and makes all
+ *         the changes visible at once with `publish()`:
+ *
+ *             setpoints.edit().mode_asked = IDLEMODE;
+ *             setpoints.edit().Iref_amplitude = 0.4F;
+ *             setpoints.publish();
+ *
+ *         and the critical task (the only reader) gets them at the beginning
+ *         of its tick with `read()`.
+ *
+ *         The shared copy is protected by a sequence counter (seqlock): it is
+ *         odd while `publish()` writes. The critical task preempts the
+ *         writer, so it can not wait for the end of a write: when it finds
+ *         the counter odd, or changed during its copy, it keeps the previous
+ *         setpoints and gets the new ones at the next tick. `read()` is one
+ *         copy of the struct, its time is bounded and no interrupt is
+ *         disabled.
+ */
+
+#ifndef SETPOINTS_H_
+#define SETPOINTS_H_
+
+#include <soc.h> // __DMB()
+
+template <typename T>
+class SetpointBlock
+{
+public:
+    SetpointBlock(const T &initial) : working(initial), shared(initial), latest(initial) {}
+
+    /**
+     * @brief copy of the writer, to change before `publish()`.
+     */
+    T &edit() { return working; }
+
+    /**
+     * @brief make the changes visible to the reader, all together.
+     */
+    void publish()
+    {
+        sequence = sequence + 1; // odd: write in progress
+        __DMB();
+        copy((volatile uint8_t *) &shared, (const volatile uint8_t *) &working);
+        __DMB();
+        sequence = sequence + 1;
+    }
+
+    /**
+     * @brief the latest consistent setpoints, to be called by the critical
+     * task at the beginning of its tick.
+     */
+    const T &read()
+    {
+        uint32_t before = sequence;
+        if (before == last_sequence) {
+            return latest; // nothing new
+        }
+        if ((before & 1U) == 0) {
+            __DMB();
+            T candidate;
+            copy((volatile uint8_t *) &candidate, (const volatile uint8_t *) &shared);
+            __DMB();
+            if (sequence == before) {
+                latest = candidate;
+                last_sequence = before;
+                return latest;
+            }
+        }
+        nb_torn++; // written during the read, taken at the next tick
+        return latest;
+    }
+
+    /**
+     * @brief number of reads postponed by a write in progress.
+     */
+    uint32_t getNbTorn() { return nb_torn; }
+
+private:
+    /* volatile copy, the compiler keeps it between the barriers */
+    static void copy(volatile uint8_t *dst, const volatile uint8_t *src)
+    {
+        for (uint32_t k = 0; k < sizeof(T); k++) {
+            dst[k] = src[k];
+        }
+    }
+
+    T working;           // writer copy
+    volatile T shared;   // protected by `sequence`
+    T latest;            // reader copy
+    volatile uint32_t sequence = 0;
+    uint32_t last_sequence = 0;
+    uint32_t nb_torn = 0;
+};
+
+#endif // SETPOINTS_H_
@@ -0,0 +1,191 @@
+/*
+ * Copyright (c) 2021-2024 LAAS-CNRS
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published by
+ *   the Free Software Foundation, either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGLPV2.1
+ */
+
+/**
+ * @brief  Acquisition of all the TWIST measures in one call.
+ *
+ *         Replaces the sequence repeated at the beginning of the critical task:
+ *
+ *             meas_data = data.getLatest(I1_LOW);
+ *             if (meas_data < 10000 && meas_data > -10000)
+ *                 I1_low_value = meas_data;
+ *
+ *         by a loop over a table of the enabled channels which fills one
+ *         `twist_measures` struct. A value out of ]-10000, 10000[ (no new
+ *         value, or a wrong one) keeps the previous measure and clears its
+ *         bit in `valid`. The test is done without branch: the comparisons
+ *         give 0 or 1 and the update is a select, so the time of the
+ *         acquisition does not depend on the measures.
+ *
+ *         An offset can be given for each channel, it is subtracted from
+ *         the new values. A filter can be given too, any object with a
+ *         `float32_t calculateWithReturn(float32_t)` as LowPassFirstOrderFilter
+ *         or a biquad cascade: the new values go through it, the measure is
+ *         the output of the filter.
+ */
+
+#ifndef TWIST_MEASURES_H_
+#define TWIST_MEASURES_H_
+
+#include "DataAPI.h"
+
+#define TWIST_MEASURES_LIMIT 10000.0F // no value is given as -10000
+
+enum twist_measure_idx
+{
+    MEAS_V1_LOW_IDX = 0,
+    MEAS_V2_LOW_IDX,
+    MEAS_I1_LOW_IDX,
+    MEAS_I2_LOW_IDX,
+    MEAS_V_HIGH_IDX,
+    MEAS_I_HIGH_IDX,
+    TWIST_NB_MEASURES
+};
+
+/* masks of the channels, used to enable them and in `twist_measures.valid` */
+#define MEAS_V1_LOW (1U << MEAS_V1_LOW_IDX)
+#define MEAS_V2_LOW (1U << MEAS_V2_LOW_IDX)
+#define MEAS_I1_LOW (1U << MEAS_I1_LOW_IDX)
+#define MEAS_I2_LOW (1U << MEAS_I2_LOW_IDX)
+#define MEAS_V_HIGH (1U << MEAS_V_HIGH_IDX)
+#define MEAS_I_HIGH (1U << MEAS_I_HIGH_IDX)
+#define MEAS_ALL ((1U << TWIST_NB_MEASURES) - 1)
+
+struct twist_measures
+{
+    float32_t V1_low; // [V]
+    float32_t V2_low; // [V]
+    float32_t I1_low; // [A]
+    float32_t I2_low; // [A]
+    float32_t V_high; // [V]
+    float32_t I_high; // [A]
+    uint32_t valid;   // channels updated by the last acquisition
+};
+
+class TwistMeasures
+{
+public:
+    /**
+     * @param mask channels to acquire, e.g. MEAS_V1_LOW | MEAS_V2_LOW.
+     *             The channels must be enabled in the data API.
+     */
+    TwistMeasures(uint32_t mask = MEAS_ALL)
+    {
+        static const channel_t channels[TWIST_NB_MEASURES] = {
+            V1_LOW, V2_LOW, I1_LOW, I2_LOW, V_HIGH, I_HIGH
+        };
+        static float32_t twist_measures::*const fields[TWIST_NB_MEASURES] = {
+            &twist_measures::V1_low, &twist_measures::V2_low,
+            &twist_measures::I1_low, &twist_measures::I2_low,
+            &twist_measures::V_high, &twist_measures::I_high
+        };
+        for (uint8_t k = 0; k < TWIST_NB_MEASURES; k++) {
+            if (mask & (1U << k)) {
+                table[nb_enabled].channel = channels[k];
+                table[nb_enabled].field = fields[k];
+                table[nb_enabled].offset = 0.0F;
+                table[nb_enabled].bit = 1U << k;
+                table[nb_enabled].filter = nullptr;
+                table[nb_enabled].apply = nullptr;
+                nb_enabled++;
+            }
+        }
+    }
+
+    /**
+     * @brief set the offset subtracted from the measures of a channel.
+     *
+     * @param measure one of the MEAS_xxx masks.
+     */
+    void setOffset(uint32_t measure, float32_t offset)
+    {
+        for (uint8_t k = 0; k < nb_enabled; k++) {
+            if (table[k].bit == measure) {
+                table[k].offset = offset;
+            }
+        }
+    }
+
+    /**
+     * @brief filter the measures of a channel, nullptr for no filter. The
+     * filter is called by `acquire()`, on the valid values only.
+     *
+     * @param measure one of the MEAS_xxx masks.
+     */
+    template <class Filter>
+    void setFilter(uint32_t measure, Filter *filter)
+    {
+        for (uint8_t k = 0; k < nb_enabled; k++) {
+            if (table[k].bit == measure) {
+                table[k].filter = filter;
+                table[k].apply = filter ? &applyFilter<Filter> : nullptr;
+            }
+        }
+    }
+
+    /**
+     * @brief get the latest value of every enabled channel. To be called
+     * at the beginning of the critical task.
+     *
+     * @return the mask of the channels updated, also stored in `meas.valid`.
+     */
+    uint32_t acquire(twist_measures &meas)
+    {
+        uint32_t valid = 0;
+        for (uint8_t k = 0; k < nb_enabled; k++) {
+            const entry &e = table[k];
+            float32_t value = data.getLatest(e.channel);
+            // & instead of && so that both comparisons are evaluated without branch
+            uint32_t ok = (uint32_t) (value < TWIST_MEASURES_LIMIT) &
+                          (uint32_t) (value > -TWIST_MEASURES_LIMIT);
+            float32_t measure = value - e.offset;
+            if (e.apply && ok) {
+                measure = e.apply(e.filter, measure);
+            }
+            float32_t &field = meas.*(e.field);
+            field = ok ? measure : field;
+            valid |= e.bit & (0U - ok);
+        }
+        meas.valid = valid;
+        return valid;
+    }
+
+private:
+    typedef float32_t (*filter_function_t)(void *filter, float32_t value);
+
+    template <class Filter>
+    static float32_t applyFilter(void *filter, float32_t value)
+    {
+        return static_cast<Filter *>(filter)->calculateWithReturn(value);
+    }
+
+    struct entry
+    {
+        channel_t channel;
+        float32_t twist_measures::*field;
+        float32_t offset;
+        uint32_t bit;
+        void *filter;
+        filter_function_t apply;
+    };
+    entry table[TWIST_NB_MEASURES];
+    uint8_t nb_enabled = 0;
+};
+
+#endif // TWIST_MEASURES_H_
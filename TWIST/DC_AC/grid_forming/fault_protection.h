@@ -0,0 +1,277 @@
+/*
+ * Copyright (c) 2021-2024 LAAS-CNRS
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published by
+ *   the Free Software Foundation, either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGLPV2.1
+ */
+
+/**
+ * @brief  Overcurrent protection by the comparators and the fault inputs of
+ *         the HRTIM.
+ *
+ *         Each channel is a comparator of the G4: its + input is the pin of
+ *         a current sensor, its - input a DAC channel holding the threshold.
+ *         Its output is an internal fault input of the HRTIM, enabled on the
+ *         timers of the legs: when the current crosses the threshold the
+ *         HRTIM puts the outputs in their fault state (inactive) without
+ *         the CPU, within the delay of the comparator and of the digital
+ *         filter of the fault input, well below a microsecond. The outputs
+ *         stay off until they are enabled again by `twist.startAll()`.
+ *
+ *         The fault flags of the HRTIM are latched. `update()`, called in a
+ *         background task, reads them and runs the recovery:
+ *
+ *             ARMED --fault--> TRIPPED --currents below--> CLEARING
+ *               ^                 ^                          |    |
+ *               |                 +--------current above-----+    | recovery_ms
+ *               +------------ clear() ------------- CLEARABLE <---+
+ *
+ *         After `max_trips` trips the state is LOCKED until the board is
+ *         reset. `getLatched()` gives the channels which tripped since the
+ *         last `clear()`.
+ *
+ *         The threshold is given in A and converted with the linear
+ *         conversion of the sensor, A = gain.raw + offset: the DAC and the
+ *         ADC have the same reference, a code of the DAC is a raw value of
+ *         the ADC.
+ */
+
+#ifndef FAULT_PROTECTION_H_
+#define FAULT_PROTECTION_H_
+
+#include <soc.h> // COMP_TypeDef, DAC_TypeDef, HRTIM registers
+#include <stm32_ll_bus.h>
+#include <stm32_ll_comp.h>
+#include <stm32_ll_dac.h>
+#include <stm32_ll_hrtim.h>
+
+#include "arm_math.h" // float32_t
+#include "zephyr/kernel.h"
+
+enum protection_state
+{
+    PROTECTION_ARMED = 0, // the comparators watch the currents
+    PROTECTION_TRIPPED,   // fault latched, a current is still above its threshold
+    PROTECTION_CLEARING,  // the currents are below, waiting for recovery_ms
+    PROTECTION_CLEARABLE, // can be armed again by clear()
+    PROTECTION_LOCKED,    // too many trips, reset the board
+};
+
+struct protection_channel
+{
+    const char *name;
+    COMP_TypeDef *comp;
+    uint32_t input_plus;  // LL_COMP_INPUT_PLUS_x, pin of the sensor
+    uint32_t input_minus; // LL_COMP_INPUT_MINUS_DACx_CHy
+    DAC_TypeDef *dac;     // DAC of input_minus
+    uint32_t dac_channel; // LL_DAC_CHANNEL_x
+    uint32_t fault;       // LL_HRTIM_FAULT_x fed by the comparator
+    uint32_t isr_flag;    // HRTIM_ISR_FLTx
+    uint32_t clear_flag;  // HRTIM_ICR_FLTxC
+    float32_t gain;       // [A/LSB] conversion of the sensor
+    float32_t offset;     // [A] current of the raw value 0
+};
+
+template <uint8_t MAX_CHANNEL>
+class FaultProtection
+{
+public:
+    /**
+     * @param recovery_ms [ms] the currents stay below their thresholds
+     *                    before the protection can be cleared.
+     * @param max_trips   trips before the protection is locked.
+     */
+    void init(uint32_t recovery_ms, uint8_t max_trips)
+    {
+        this->recovery_ms = recovery_ms;
+        this->max_trips = max_trips;
+        LL_APB2_GRP1_EnableClock(LL_APB2_GRP1_PERIPH_SYSCFG); // comparators
+    }
+
+    /**
+     * @brief program the comparator and the DAC of a channel, and enable
+     * its fault on the timers, to be called before the outputs are started.
+     *
+     * @param timers    LL_HRTIM_TIMER_x of the legs, or-ed.
+     * @param outputs   LL_HRTIM_OUTPUT_x of the legs, or-ed.
+     * @param threshold [A]
+     * @return index of the channel, -1 if there is no room.
+     */
+    int8_t addChannel(const protection_channel &channel, uint32_t timers, uint32_t outputs,
+                      float32_t threshold)
+    {
+        if (nb_channel >= MAX_CHANNEL) {
+            return -1;
+        }
+        uint8_t k = nb_channel++;
+        channels[k] = channel;
+        const protection_channel &ch = channels[k];
+
+        LL_AHB2_GRP1_EnableClock(ch.dac == DAC1 ? LL_AHB2_GRP1_PERIPH_DAC1
+                                                : LL_AHB2_GRP1_PERIPH_DAC3);
+        LL_DAC_SetHighFrequencyMode(ch.dac, LL_DAC_HIGH_FREQ_MODE_ABOVE_160MHZ);
+        LL_DAC_SetOutputConnection(ch.dac, ch.dac_channel, LL_DAC_OUTPUT_CONNECT_INTERNAL);
+        LL_DAC_SetOutputBuffer(ch.dac, ch.dac_channel, LL_DAC_OUTPUT_BUFFER_DISABLE);
+        LL_DAC_DisableTrigger(ch.dac, ch.dac_channel); // DHR copied at once
+        LL_DAC_Enable(ch.dac, ch.dac_channel);
+        k_busy_wait(10); // [us] wake up of the DAC
+        setThreshold(k, threshold);
+
+        LL_COMP_SetInputPlus(ch.comp, ch.input_plus);
+        LL_COMP_SetInputMinus(ch.comp, ch.input_minus);
+        LL_COMP_SetInputHysteresis(ch.comp, LL_COMP_HYSTERESIS_20MV);
+        LL_COMP_SetOutputPolarity(ch.comp, LL_COMP_OUTPUTPOL_NONINVERTED);
+        LL_COMP_SetOutputBlankingSource(ch.comp, LL_COMP_BLANKINGSRC_NONE);
+        LL_COMP_Enable(ch.comp);
+        k_busy_wait(5); // [us] start up of the comparator
+
+        // a few samples of f_HRTIM reject the spikes of the commutations
+        LL_HRTIM_FLT_SetSrc(HRTIM1, ch.fault, LL_HRTIM_FLT_SRC_INTERNAL);
+        LL_HRTIM_FLT_SetPolarity(HRTIM1, ch.fault, LL_HRTIM_FLT_POLARITY_HIGH);
+        LL_HRTIM_FLT_SetFilter(HRTIM1, ch.fault, LL_HRTIM_FLT_FILTER_3);
+        HRTIM1->sCommonRegs.ICR = ch.clear_flag; // trips of the start up
+        LL_HRTIM_FLT_Enable(HRTIM1, ch.fault);
+
+        for (uint32_t timer = LL_HRTIM_TIMER_A; timer <= LL_HRTIM_TIMER_F; timer <<= 1) {
+            if (timers & timer) {
+                LL_HRTIM_TIM_EnableFault(HRTIM1, timer, ch.fault);
+            }
+        }
+        for (uint32_t output = 1; output != 0 && output <= outputs; output <<= 1) {
+            if (outputs & output) {
+                LL_HRTIM_OUT_SetFaultState(HRTIM1, output, LL_HRTIM_OUT_FAULTSTATE_INACTIVE);
+            }
+        }
+        return k;
+    }
+
+    /**
+     * @param threshold [A] current of the channel k which trips the outputs.
+     */
+    void setThreshold(uint8_t k, float32_t threshold)
+    {
+        const protection_channel &ch = channels[k];
+        float32_t code = (threshold - ch.offset) / ch.gain;
+        code = code < 0.0F ? 0.0F : (code > 4095.0F ? 4095.0F : code);
+        LL_DAC_ConvertData12RightAligned(ch.dac, ch.dac_channel, (uint32_t) code);
+        thresholds[k] = threshold;
+    }
+
+    /**
+     * @brief run the recovery, in a background task.
+     *
+     * @param now_ms [ms] uptime.
+     */
+    void update(uint32_t now_ms)
+    {
+        uint32_t flags = readFlags();
+        latched |= flags;
+        switch (state) {
+        case PROTECTION_ARMED:
+            if (flags != 0) {
+                nb_trips++;
+                state = nb_trips >= max_trips ? PROTECTION_LOCKED : PROTECTION_TRIPPED;
+            }
+            break;
+        case PROTECTION_TRIPPED:
+            if (!isAboveThreshold()) {
+                below_since_ms = now_ms;
+                state = PROTECTION_CLEARING;
+            }
+            break;
+        case PROTECTION_CLEARING:
+            if (isAboveThreshold()) {
+                state = PROTECTION_TRIPPED;
+            } else if (now_ms - below_since_ms >= recovery_ms) {
+                state = PROTECTION_CLEARABLE;
+            }
+            break;
+        case PROTECTION_CLEARABLE:
+        case PROTECTION_LOCKED:
+            break;
+        }
+    }
+
+    /**
+     * @brief arm the protection again, once CLEARABLE.
+     *
+     * @return false if the protection cannot be cleared yet.
+     */
+    bool clear()
+    {
+        if (state != PROTECTION_CLEARABLE) {
+            return false;
+        }
+        for (uint8_t k = 0; k < nb_channel; k++) {
+            HRTIM1->sCommonRegs.ICR = channels[k].clear_flag;
+        }
+        latched = 0;
+        state = PROTECTION_ARMED;
+        return true;
+    }
+
+    bool isTripped() { return state != PROTECTION_ARMED; }
+    uint8_t getState() { return state; }
+    uint32_t getLatched() { return latched; } // bit k: the channel k tripped
+    uint32_t getNbTrips() { return nb_trips; }
+
+    void print()
+    {
+        static const char *names[] = { "armed", "tripped", "clearing", "clearable", "locked" };
+        printk("protection %s, %u trips\n", names[state], nb_trips);
+        for (uint8_t k = 0; k < nb_channel; k++) {
+            printk("  %-8s threshold %.2f A, %s%s\n", channels[k].name, (double) thresholds[k],
+                   LL_COMP_ReadOutputLevel(channels[k].comp) == LL_COMP_OUTPUT_LEVEL_HIGH
+                       ? "above" : "below",
+                   (latched & (1U << k)) ? ", tripped" : "");
+        }
+    }
+
+private:
+    /* bit k: the fault of the channel k is latched by the HRTIM */
+    uint32_t readFlags()
+    {
+        uint32_t isr = HRTIM1->sCommonRegs.ISR;
+        uint32_t flags = 0;
+        for (uint8_t k = 0; k < nb_channel; k++) {
+            if (isr & channels[k].isr_flag) {
+                flags |= 1U << k;
+            }
+        }
+        return flags;
+    }
+
+    bool isAboveThreshold()
+    {
+        for (uint8_t k = 0; k < nb_channel; k++) {
+            if (LL_COMP_ReadOutputLevel(channels[k].comp) == LL_COMP_OUTPUT_LEVEL_HIGH) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    protection_channel channels[MAX_CHANNEL];
+    float32_t thresholds[MAX_CHANNEL];
+    uint8_t nb_channel = 0;
+    uint32_t recovery_ms = 0;
+    uint8_t max_trips = 1;
+    uint8_t state = PROTECTION_ARMED;
+    uint32_t latched = 0;
+    uint32_t nb_trips = 0;
+    uint32_t below_since_ms = 0;
+};
+
+#endif // FAULT_PROTECTION_H_
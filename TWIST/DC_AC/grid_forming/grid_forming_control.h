@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2021-2024 LAAS-CNRS
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published by
+ *   the Free Software Foundation, either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGLPV2.1
+ */
+
+/**
+ * @brief  Control of the grid forming inverter, run by the critical task.
+ *
+ *         `dutyCycle()` is the power mode: the oscillator gives the sine of
+ *         the voltage reference, the Pr of the grid voltage gives the duty
+ *         cycle, divided by the filtered V_high. `rampAmplitude()` brings the
+ *         amplitude to its reference, from a slower task. The filters of
+ *         V_high are designed by `designVHighBiquad()` (BIQUAD_FILTERS) or
+ *         `vHighLowPass()`.
+ *
+ *         The benchmark of TWIST/Benchmark/control_loops includes a copy of
+ *         this file: its `GridFormingKernel` runs the same code against
+ *         synthetic measures, a change of the control is timed without
+ *         being copied.
+ */
+
+#ifndef GRID_FORMING_CONTROL_H_
+#define GRID_FORMING_CONTROL_H_
+
+#include "pr.h"
+#include "filters.h"
+#include "biquad.h"
+#include "quadrature_oscillator.h"
+#include "twist_measures.h"
+
+#define GRID_FORMING_KP 0.02F               // Pr of the grid voltage
+#define GRID_FORMING_KR 4000.0F
+#define GRID_FORMING_AMPLITUDE_RATE 10.0F   // [V/s] ramp of the amplitude
+#define GRID_FORMING_V_HIGH_NOTCH_Q 2.0F    // rejected band of 50 Hz around the ripple
+#define GRID_FORMING_V_HIGH_LOW_PASS 10.0F  // [Hz] second order low-pass after the notch
+#define GRID_FORMING_V_HIGH_TAU 0.1F        // [s] of the first order low-pass
+
+/**
+ * @return value moved by `step` towards ref, kept within 1e-3 of it.
+ */
+inline float32_t rateLimiter(float32_t ref, float32_t value, float32_t step)
+{
+    if (ref - value > 1e-3F) {
+        return value + step;
+    }
+    if (ref - value < -1e-3F) {
+        return value - step;
+    }
+    return value;
+}
+
+/**
+ * @brief V_high through a notch at twice the grid frequency, the ripple of
+ * the single-phase power, then a second order low-pass.
+ */
+inline void designVHighBiquad(BiquadCascade<2> &biquad, float32_t Ts, float32_t f0)
+{
+    biquad.setSection(0, biquadNotch(Ts, 2.0F * f0, GRID_FORMING_V_HIGH_NOTCH_Q));
+    biquad.setSection(1, biquadLowPass(Ts, GRID_FORMING_V_HIGH_LOW_PASS));
+}
+
+/**
+ * @brief first order low-pass of V_high, slow enough to attenuate the ripple
+ * alone.
+ */
+inline LowPassFirstOrderFilter vHighLowPass(float32_t Ts)
+{
+    return LowPassFirstOrderFilter(Ts, GRID_FORMING_V_HIGH_TAU);
+}
+
+class GridFormingControl
+{
+public:
+    /**
+     * @param Ts [s] period of the critical task.
+     * @param w0 [rad/s] pulsation of the grid.
+     */
+    GridFormingControl(float32_t Ts, float32_t w0) : oscillator(Ts, w0), w0(w0) {}
+
+    /**
+     * @brief discretise the Pr with Ts, at start and when the period changes.
+     *
+     * @param Udc [V] bound of the output of the Pr.
+     */
+    void initPr(float32_t Ts, float32_t Udc)
+    {
+        prop_res.init(PrParams(Ts, GRID_FORMING_KP, GRID_FORMING_KR, w0, 0.0F, -Udc, Udc));
+    }
+
+    /**
+     * @brief out of the power mode: the amplitude starts again from 0.
+     */
+    void idle()
+    {
+        Vgrid_amplitude = 0.0F;
+        prop_res.reset();
+    }
+
+    /**
+     * @brief power mode, once per tick.
+     *
+     * @param V_high_filt [V] filtered DC voltage.
+     * @return the duty cycle of the two legs.
+     */
+    float32_t dutyCycle(const twist_measures &meas, float32_t V_high_filt)
+    {
+        oscillator.calculate();
+        Vgrid_ref = Vgrid_amplitude * oscillator.getSin();
+        pr_value = prop_res.calculateWithReturn(Vgrid_ref, meas.V1_low - meas.V2_low);
+        return pr_value / (2.0F * V_high_filt) + 0.5F;
+    }
+
+    /**
+     * @brief ramp of the amplitude.
+     *
+     * @param period [s] between two calls.
+     */
+    void rampAmplitude(float32_t period)
+    {
+        Vgrid_amplitude = rateLimiter(Vgrid_amplitude_ref, Vgrid_amplitude,
+                                      GRID_FORMING_AMPLITUDE_RATE * period);
+    }
+
+    QuadratureOscillator oscillator; // sin(w0.t)
+    Pr prop_res;                     // of the grid voltage
+    float32_t Vgrid_amplitude_ref = 0.0F; // [V]
+    float32_t Vgrid_amplitude = 0.0F;     // [V]
+    float32_t Vgrid_ref = 0.0F;           // [V]
+    float32_t pr_value = 0.0F;
+
+private:
+    const float32_t w0;
+};
+
+#endif // GRID_FORMING_CONTROL_H_
@@ -39,12 +39,25 @@
 #include "trigo.h"
 #include "filters.h"
 #include "ScopeMimicry.h"
+#include "scope_stream.h"
+#include "twist_measures.h"
+#include "biquad.h"
+#include "quadrature_oscillator.h"
+#include "grid_forming_control.h"
+#include "task_profiler.h"
+#include "multirate_scheduler.h"
+#include "telemetry.h"
+#include "retune_registry.h"
+#include "fault_protection.h"
 
 #include "zephyr/console/console.h"
+#include <soc.h> // DWT cycle counter, used by the sine and filter benchmarks
 
 #define DUTY_MIN 0.1F
 #define DUTY_MAX 0.9F
 #define UDC_STARTUP 15.0F
+
+// #define PWM_SYNC_CONTROL // uncomment to run the control at 20 kHz, synchronised with the PWM
 //--------------SETUP FUNCTIONS DECLARATION-------------------
 void setup_routine(); // Setups the hardware and software of the system
 
@@ -54,49 +67,67 @@ void loop_application_task();   // Code to be executed in the background task
 void loop_critical_task();     // Code to be executed in real time in the critical task
 
 //--------------USER VARIABLES DECLARATIONS-------------------
-static const uint32_t control_task_period = 100; //[us] period of the control task
+#ifdef PWM_SYNC_CONTROL
+static uint32_t control_task_period = 50; //[us] 10 periods of the 200 kHz PWM
+#else
+static uint32_t control_task_period = 100; //[us] period of the control task
+#endif
+static const uint32_t PERIOD_STEP = 10; //[us] step of the period changed at runtime
+static RetuneRegistry retune(20, 500); // period from 20 to 500 us, re-discretise the controllers
+static TaskProfiler profiler; // execution time and jitter of the critical task
 static bool pwm_enable = false;            //[bool] state of the PWM (ctrl task)
 
 uint8_t received_serial_char;
 
 /* Measure variables */
-static float32_t V1_low_value; // [V]
-static float32_t V2_low_value; // [V]
-static float32_t I1_low_value; // [A]
-static float32_t I2_low_value; // [A]
-static float32_t V_high; // [V]
-static float32_t I_high; // [A]
+static twist_measures meas; // latest measures, updated by the critical task
+static TwistMeasures measures; // acquisition of the measures
 static float32_t V_high_filt; // [V]
 
-
-
-static float meas_data; // temp storage meas value (ctrl task)
-
 /* duty_cycle*/
 static float32_t duty_cycle;// [No unit]
 
 static float32_t Udc = 40.0F; // dc voltage supply assumed [V]
 static const float f0 = 50.0F; // fundamental frequency [Hz]
 static const float32_t w0 = 2.0F * PI * f0;   // pulsation [rad/s]
-/* Sinewave settings */
-static float32_t Vgrid_ref; //[V]
-static float32_t Vgrid_amplitude_ref = 0.0F; // [V] 
-static float32_t Vgrid_amplitude = 0.0F; // [V]
-static float angle = 0.F; // [rad]
-//------------- PR RESONANT -------------------------------------
-static Pr prop_res; // proportional resonant regulator instance
-static float32_t pr_value; // value returned by the calculation of the prop_res
-static float32_t Kp = 0.02F; // prop_res parameter
-static float32_t Kr = 4000.0F; // prop_res parameter
+/* Sinewave settings, oscillator and proportional resonant regulator, see
+ * grid_forming_control.h, shared with the benchmark of the control loops */
+static GridFormingControl control(control_task_period * 1.0e-6F, w0);
 static float32_t Ts = control_task_period * 1.0e-6F;
 
+#define BIQUAD_FILTERS // Comment to filter V_high with the first order low-pass
+#ifdef BIQUAD_FILTERS
+// V_high filtered in the acquisition: a notch at the 100 Hz ripple of the
+// single-phase power, then a second order low-pass, faster than the 0.1 s
+// of the first order filter which has to attenuate the ripple alone
+static BiquadCascade<2> vHighBiquad;
+#else
 // comes from "filters.h"
-LowPassFirstOrderFilter vHighFilter(Ts, 0.1F);
-static uint32_t critical_task_counter; 
+LowPassFirstOrderFilter vHighFilter = vHighLowPass(Ts);
+#endif
+// slower tasks run by the critical task every few ticks
+static MultirateScheduler scheduler;
+static int8_t amplitude_task_index, scope_task_index, continuous_task_index;
+static uint16_t amplitude_decimation = 1000 / control_task_period; // ramp of the amplitude at 1 kHz
+
+// binary telemetry at 1 kHz instead of the text printed every 100 ms
+#define TELEMETRY // Comment to print the variables as text
+// 3 int16 channels and the index: 8 bytes per ms, 70 % of a 115200 bit/s console
+static Telemetry<256, 4> telemetry;
+static int8_t telemetry_task_index;
+static uint16_t telemetry_decimation = 1000 / control_task_period;
 
 // the scope help us to record datas during the critical task
 // its a library which must be included in platformio.ini
 static ScopeMimicry scope(1024, 9); 
+static uint16_t scope_decimation = 300 / control_task_period; // one acquisition every 300 us
+// continuous record: 2 blocks of 4096 bytes sent while running, the channels
+// are packed in int16 so a block holds 512 samples of 4 channels.
+// the link must carry 4 channels * 2 bytes every ms
+static ContinuousScope<4096, 4> continuous_scope;
+static uint16_t continuous_decimation = 1000 / control_task_period;
+// send the scope records in binary frames, see `filter_recorded_datas.py`
+static ScopeStream scope_stream;
 static bool is_downloading;
 //---------------------------------------------------------------
 
@@ -113,33 +144,35 @@ static uint8_t mode_asked = IDLEMODE;
 static float32_t spying_mode = 0; 
 static const float32_t MAX_CURRENT = 8.0F;
 
+#define HARDWARE_PROTECTION // Comment to check the currents in software at each tick
+#ifdef HARDWARE_PROTECTION
+// the comparators of the current mode, free in voltage mode, trip the HRTIM
+// when I1_low > MAX_CURRENT or I2_low > MAX_CURRENT. The load is between the
+// two legs, I2_low = -I1_low: the two channels cover the two half waves.
+static const float32_t I_LOW_GAIN = 0.005F;   // [A/LSB] conversion of the sensors,
+static const float32_t I_LOW_OFFSET = -10.0F; // [A] to match the data API calibration
+static const protection_channel I1_LOW_PROTECTION = {
+    "I1_low", COMP1, LL_COMP_INPUT_PLUS_IO1 /* PA1 */, LL_COMP_INPUT_MINUS_DAC3_CH1,
+    DAC3, LL_DAC_CHANNEL_1, LL_HRTIM_FAULT_4, HRTIM_ISR_FLT4, HRTIM_ICR_FLT4C,
+    I_LOW_GAIN, I_LOW_OFFSET,
+};
+static const protection_channel I2_LOW_PROTECTION = {
+    "I2_low", COMP3, LL_COMP_INPUT_PLUS_IO2 /* PC1 */, LL_COMP_INPUT_MINUS_DAC1_CH1,
+    DAC1, LL_DAC_CHANNEL_1, LL_HRTIM_FAULT_5, HRTIM_ISR_FLT5, HRTIM_ICR_FLT5C,
+    I_LOW_GAIN, I_LOW_OFFSET,
+};
+static const uint32_t LEG_TIMERS = LL_HRTIM_TIMER_A | LL_HRTIM_TIMER_C; // LEG1, LEG2
+static const uint32_t LEG_OUTPUTS = LL_HRTIM_OUTPUT_TA1 | LL_HRTIM_OUTPUT_TA2
+                                  | LL_HRTIM_OUTPUT_TC1 | LL_HRTIM_OUTPUT_TC2;
+static FaultProtection<2> protection;
+static const uint32_t PROTECTION_RECOVERY_MS = 500; // [ms] below the thresholds before 'i'
+static const uint8_t PROTECTION_MAX_TRIPS = 3;      // then locked until a reset
+#endif
+
 bool a_trigger() {
     return (mode == POWERMODE);
 }
 
-/**
- * @brief print recorded data of the ScopeMimicry instance to console
- * we use this function in coordination with a miniterm python filter on the host side.
- * `filter_recorded_data.py` to save the data in a file and format them in float.
- *
- * @param scope 
- */
-void dump_scope_datas(ScopeMimicry &scope)  {
-    uint8_t *buffer = scope.get_buffer();
-    uint16_t buffer_size = scope.get_buffer_size() >> 2; // we divide by 4 (4 bytes per float data) 
-    printk("begin record\n");
-    printk("#");
-    for (uint16_t k=0;k < scope.get_nb_channel(); k++) {
-        printk("%s,", scope.get_channel_name(k));
-    }
-    printk("\n");
-    for (uint16_t k=0;k < buffer_size; k++) {
-        printk("%08x\n", *((uint32_t *)buffer + k));
-        task.suspendBackgroundUs(100);
-    }
-    printk("end record\n");
-}
-
 // UTILS FUNCTIONS FOR CONTROL
 float32_t saturate(const float32_t x, float32_t min, float32_t max) {
     if (x > max) { 
@@ -151,19 +184,225 @@ float32_t saturate(const float32_t x, float32_t min, float32_t max) {
     return x;
 }
 
-float32_t sign(float32_t x, float32_t tol=1e-3) {
-    if (x > tol) {
-        return 1.0F;
+float32_t rate_limiter(const float32_t ref, float32_t value, const float32_t rate) {
+    return rateLimiter(ref, value, Ts * rate);
+}
+
+/* functions given to the retune registry, called with the new Ts */
+void retune_sampling(float32_t new_Ts)
+{
+    Ts = new_Ts;
+    control_task_period = (uint32_t) (new_Ts * 1.0e6F + 0.5F);
+    scope_decimation = 300 / control_task_period;
+    scope_decimation = scope_decimation ? scope_decimation : 1;
+    continuous_decimation = 1000 / control_task_period;
+    continuous_decimation = continuous_decimation ? continuous_decimation : 1;
+    amplitude_decimation = 1000 / control_task_period;
+    amplitude_decimation = amplitude_decimation ? amplitude_decimation : 1;
+    scheduler.setDivider(amplitude_task_index, amplitude_decimation);
+    scheduler.setDivider(scope_task_index, scope_decimation);
+    scheduler.setDivider(continuous_task_index, continuous_decimation);
+#ifdef TELEMETRY
+    telemetry_decimation = 1000 / control_task_period;
+    telemetry_decimation = telemetry_decimation ? telemetry_decimation : 1;
+    scheduler.setDivider(telemetry_task_index, telemetry_decimation);
+#endif
+    profiler.init(control_task_period);
+}
+
+void retune_pr(float32_t new_Ts)
+{
+    control.initPr(new_Ts, Udc);
+}
+
+#ifdef BIQUAD_FILTERS
+void design_v_high_filter(float32_t new_Ts)
+{
+    designVHighBiquad(vHighBiquad, new_Ts, f0);
+}
+#endif
+
+void retune_filter(float32_t new_Ts)
+{
+#ifdef BIQUAD_FILTERS
+    design_v_high_filter(new_Ts);
+    vHighBiquad.reset(V_high_filt);
+#else
+    vHighFilter = vHighLowPass(new_Ts);
+#endif
+}
+
+void retune_oscillator(float32_t new_Ts)
+{
+    control.oscillator.setSamplingPeriod(new_Ts);
+}
+
+/* tasks of the scheduler, run by the critical task */
+void amplitude_task()
+{
+    if (mode == POWERMODE) {
+        // applied once every amplitude_decimation ticks
+        control.rampAmplitude(Ts * amplitude_decimation);
     }
-    if (x < -tol) {
-        return -1.0F;
+}
+
+void scope_task()
+{
+    spying_mode = (float32_t) mode;
+    scope.acquire();
+}
+
+void continuous_scope_task()
+{
+    continuous_scope.acquire();
+}
+
+void telemetry_task()
+{
+    telemetry.sample();
+}
+
+/**
+ * Change the period of the critical task by `step` us, in idle mode only.
+ */
+void change_period(int32_t step)
+{
+    if (mode != IDLEMODE || mode_asked != IDLEMODE) {
+        printk("period can be changed in idle mode only\n");
+        return;
+    }
+    uint32_t period = control_task_period + step;
+#ifdef PWM_SYNC_CONTROL
+    bool changed = retune.changePeriod(loop_critical_task, period, source_hrtim);
+#else
+    bool changed = retune.changePeriod(loop_critical_task, period);
+#endif
+    printk("control period: %u us\n", control_task_period);
+    if (!changed) {
+        printk("out of range\n");
     }
-    return 0.0F; 
 }
 
-float32_t rate_limiter(const float32_t ref, float32_t value, const float32_t rate) {
-    value += Ts * rate * sign(ref - value);
-    return value;
+/**
+ * Compare the oscillator with ot_sin(ot_modulo_2pi(angle + w0 * Ts)) during
+ * one second of control periods: the max error against a double precision
+ * sine, and the cycles per control period. The interrupts are masked during
+ * each timed chunk, so it is only available in idle mode.
+ */
+void sine_benchmark()
+{
+    const uint32_t nb_ticks = 1000000 / control_task_period;
+    const uint32_t chunk = 100;
+    QuadratureOscillator osc(Ts, w0);
+    float32_t bench_angle = 0.0F;
+    double ref_angle = 0.0;
+    float32_t error_osc = 0.0F;
+    float32_t error_ot_sin = 0.0F;
+    uint32_t cycles_osc = 0;
+    uint32_t cycles_ot_sin = 0;
+    volatile float32_t sink;
+
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    // accuracy
+    for (uint32_t k = 0; k < nb_ticks; k++) {
+        osc.calculate();
+        bench_angle = ot_modulo_2pi(bench_angle + w0 * Ts);
+        ref_angle += (double) (w0 * Ts);
+        float32_t ref = (float32_t) sin(ref_angle);
+        error_osc = fmaxf(error_osc, fabsf(osc.getSin() - ref));
+        error_ot_sin = fmaxf(error_ot_sin, fabsf(ot_sin(bench_angle) - ref));
+    }
+
+    // cycles
+    for (uint32_t k = 0; k < nb_ticks; k += chunk) {
+        unsigned int key = irq_lock();
+        uint32_t start = DWT->CYCCNT;
+        for (uint32_t n = 0; n < chunk; n++) {
+            osc.calculate();
+            sink = osc.getSin();
+        }
+        uint32_t middle = DWT->CYCCNT;
+        for (uint32_t n = 0; n < chunk; n++) {
+            bench_angle = ot_modulo_2pi(bench_angle + w0 * Ts);
+            sink = ot_sin(bench_angle);
+        }
+        uint32_t end = DWT->CYCCNT;
+        irq_unlock(key);
+        cycles_osc += middle - start;
+        cycles_ot_sin += end - middle;
+    }
+    (void) sink;
+
+    printk("sine over %u ticks: oscillator %u cycles, max error %e\n",
+           nb_ticks, cycles_osc / nb_ticks, (double) error_osc);
+    printk("                    ot_sin     %u cycles, max error %e\n",
+           cycles_ot_sin / nb_ticks, (double) error_ot_sin);
+}
+
+/**
+ * Cycles per sample of biquad cascades of 1, 2 and 4 sections, float32 and
+ * Q31, filtering a V_high with a 100 Hz ripple. The interrupts are masked
+ * during each timed chunk, so it is only available in idle mode.
+ */
+template <uint8_t NB>
+static void biquad_benchmark(uint32_t nb_samples)
+{
+    const uint32_t chunk = 100;
+    BiquadCascade<NB> filter;
+    BiquadCascadeQ31<NB> filter_q31(2.0F * 100.0F); // twice the range of V_high
+    for (uint8_t k = 0; k < NB; k++) {
+        filter.setSection(k, biquadLowPass(Ts, 1000.0F));
+        filter_q31.setSection(k, biquadLowPass(Ts, 1000.0F));
+    }
+    uint32_t cycles = 0;
+    uint32_t cycles_q31 = 0;
+    float32_t diff = 0.0F;
+    float32_t bench_angle = 0.0F;
+    volatile float32_t sink;
+    for (uint32_t k = 0; k < nb_samples; k += chunk) {
+        float32_t x[chunk];
+        for (uint32_t n = 0; n < chunk; n++) {
+            bench_angle = ot_modulo_2pi(bench_angle + 2.0F * w0 * Ts);
+            x[n] = 40.0F + 2.0F * ot_sin(bench_angle);
+        }
+        float32_t last = 0.0F;
+        float32_t last_q31 = 0.0F;
+        unsigned int key = irq_lock();
+        uint32_t start = DWT->CYCCNT;
+        for (uint32_t n = 0; n < chunk; n++) {
+            last = filter.calculateWithReturn(x[n]);
+        }
+        uint32_t middle = DWT->CYCCNT;
+        for (uint32_t n = 0; n < chunk; n++) {
+            last_q31 = filter_q31.calculateWithReturn(x[n]);
+        }
+        uint32_t end = DWT->CYCCNT;
+        irq_unlock(key);
+        cycles += middle - start;
+        cycles_q31 += end - middle;
+        diff = fmaxf(diff, fabsf(last - last_q31));
+        sink = last;
+    }
+    (void) sink;
+
+    printk("  %u sections: float32 %u cycles (%u per section), Q31 %u cycles (%u per section), max difference %e\n",
+           NB, cycles / nb_samples, cycles / nb_samples / NB,
+           cycles_q31 / nb_samples, cycles_q31 / nb_samples / NB, (double) diff);
+}
+
+void filter_benchmark()
+{
+    const uint32_t nb_samples = 100000;
+
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    printk("biquad cascades over %u samples:\n", nb_samples);
+    biquad_benchmark<1>(nb_samples);
+    biquad_benchmark<2>(nb_samples);
+    biquad_benchmark<4>(nb_samples);
 }
 
 //--------------SETUP FUNCTIONS-------------------------------
@@ -187,35 +426,80 @@ void setup_routine()
     spin.gpio.resetPin(PC6);
     spin.gpio.resetPin(PB7);
 
-    scope.connectChannel(I1_low_value, "I1_low_value");
-    scope.connectChannel(I_high, "iHigh");
-    scope.connectChannel(V1_low_value, "V1_low_value");
-    scope.connectChannel(V2_low_value, "V2_low_value");
+    scope.connectChannel(meas.I1_low, "I1_low_value");
+    scope.connectChannel(meas.I_high, "iHigh");
+    scope.connectChannel(meas.V1_low, "V1_low_value");
+    scope.connectChannel(meas.V2_low, "V2_low_value");
     scope.connectChannel(V_high_filt, "V_high_filt");
     scope.connectChannel(duty_cycle, "duty_cycle");
-    scope.connectChannel(Vgrid_ref, "Vgrid_ref");
-    scope.connectChannel(Vgrid_amplitude, "Vgrid_amplitude");
+    scope.connectChannel(control.Vgrid_ref, "Vgrid_ref");
+    scope.connectChannel(control.Vgrid_amplitude, "Vgrid_amplitude");
     scope.connectChannel(spying_mode, "mode");
     scope.set_delay(0.0F);
     scope.set_trigger(a_trigger);
     scope.start();
+    continuous_scope.connectChannel(meas.I1_low, "I1_low_value", 1000.0F); // [mA]
+    continuous_scope.connectChannel(meas.V1_low, "V1_low_value", 100.0F);  // [10 mV]
+    continuous_scope.connectChannel(meas.V2_low, "V2_low_value", 100.0F);
+    continuous_scope.connectChannel(control.Vgrid_ref, "Vgrid_ref", 100.0F);
+    scope_stream.init();
     
+#ifdef BIQUAD_FILTERS
+    design_v_high_filter(Ts);
+    measures.setFilter(MEAS_V_HIGH, &vHighBiquad);
+#endif
+
     // PR initialisation.
-    PrParams params = PrParams(Ts, Kp, Kr, w0, 0.0F, -Udc, Udc);
-    prop_res.init(params);
+    control.initPr(Ts, Udc);
+
+    // discretised with Ts: re-computed when the period changes
+    retune.add(retune_sampling);
+    retune.add(retune_pr);
+    retune.add(retune_filter);
+    retune.add(retune_oscillator);
+
+    amplitude_task_index = scheduler.add(amplitude_task, "amplitude", amplitude_decimation, 2);
+    scope_task_index = scheduler.add(scope_task, "scope", scope_decimation, 1);
+    continuous_task_index = scheduler.add(continuous_scope_task, "continuous scope",
+                                          continuous_decimation, 0);
+#ifdef TELEMETRY
+    telemetry.connectChannel(control.Vgrid_amplitude, "Vgrid_amplitude", 100.0F); // [10 mV]
+    telemetry.connectChannel(meas.V1_low, "V1_low_value", 100.0F);
+    telemetry.connectChannel(meas.I1_low, "I1_low_value", 1000.0F);      // [mA]
+    telemetry_task_index = scheduler.add(telemetry_task, "telemetry", telemetry_decimation, 0);
+#endif
 
     /* buck voltage mode */
     twist.initLegBuck(LEG1);
     twist.initLegBoost(LEG2);
 
+#ifdef HARDWARE_PROTECTION
+    // the outputs are not started yet, their fault state can be set
+    protection.init(PROTECTION_RECOVERY_MS, PROTECTION_MAX_TRIPS);
+    protection.addChannel(I1_LOW_PROTECTION, LEG_TIMERS, LEG_OUTPUTS, MAX_CURRENT);
+    protection.addChannel(I2_LOW_PROTECTION, LEG_TIMERS, LEG_OUTPUTS, MAX_CURRENT);
+#endif
+
+#ifdef PWM_SYNC_CONTROL
+    // the measures are triggered at the crest of the carrier, in the middle of
+    // the PWM period, where the current is equal to its mean value
+    twist.setAllTriggerValue(0.95F);
+#endif
+
     // Then declare tasks
     uint32_t app_task_number = task.createBackground(loop_application_task);
     uint32_t com_task_number = task.createBackground(loop_communication_task);
+#ifdef PWM_SYNC_CONTROL
+    // the critical task is started by the HRTIM every 10 PWM periods
+    task.createCritical(loop_critical_task, control_task_period, source_hrtim);
+#else
     task.createCritical(loop_critical_task, control_task_period); // Uncomment if you use the critical task
+#endif
 
     // Finally, start tasks
     task.startBackground(app_task_number);
     task.startBackground(com_task_number);
+    profiler.init(control_task_period);
     task.startCritical(); // Uncomment if you use the critical task
 
     
@@ -237,7 +521,18 @@ void loop_communication_task()
             printk("|     press i : idle mode                |\n");
             printk("|     press p : power mode               |\n");
             printk("|     press u : vgrid up                 |\n");
-            printk("|     press p : vgrid down               |\n");
+            printk("|     press d : vgrid down               |\n");
+            printk("|     press r : retrieve data recorded   |\n");
+            printk("|     press c : continuous record on/off |\n");
+            printk("|     press b : sine benchmark (idle)    |\n");
+            printk("|     press f : filter benchmark (idle)  |\n");
+#ifdef HARDWARE_PROTECTION
+            printk("|     press e : overcurrent protection   |\n");
+#endif
+            printk("|     press t : critical task timing     |\n");
+            printk("|     press m : multirate tasks timing   |\n");
+            printk("|     press + : slower control (idle)    |\n");
+            printk("|     press - : faster control (idle)    |\n");
             printk("|________________________________________|\n\n");
             //------------------------------------------------------
             break;
@@ -253,16 +548,55 @@ void loop_communication_task()
                 }
             break;
         case 'u': 
-            if (Vgrid_amplitude_ref < 50.0F)
-                    Vgrid_amplitude_ref += .5F;
+            if (control.Vgrid_amplitude_ref < 50.0F)
+                    control.Vgrid_amplitude_ref += .5F;
             break;
         case 'd': 
-            if (Vgrid_amplitude_ref > 0.5F)
-                    Vgrid_amplitude_ref -= .5F;
+            if (control.Vgrid_amplitude_ref > 0.5F)
+                    control.Vgrid_amplitude_ref -= .5F;
             break;
         case 'r':
-            is_downloading = true;
+            if (!is_downloading) {
+                scope_stream.begin(scope, scope_decimation, control_task_period);
+                is_downloading = true;
+            }
+            break;
+        case 'c':
+            if (!is_downloading) {
+                continuous_scope.start();
+                scope_stream.begin(continuous_scope, continuous_decimation, control_task_period);
+                is_downloading = true;
+            } else {
+                continuous_scope.stop(); // the stream ends after the last full block
+            }
+            break;
+        case 't':
+            profiler.requestReport();
+            break;
+        case 'm':
+            scheduler.requestReport();
             break;
+        case '+':
+            change_period(PERIOD_STEP);
+            break;
+        case '-':
+            change_period(-(int32_t) PERIOD_STEP);
+            break;
+        case 'b':
+            if (mode == IDLEMODE) {
+                sine_benchmark();
+            }
+            break;
+        case 'f':
+            if (mode == IDLEMODE) {
+                filter_benchmark();
+            }
+            break;
+#ifdef HARDWARE_PROTECTION
+        case 'e':
+            protection.print();
+            break;
+#endif
         default:
             break;
         }
@@ -277,6 +611,14 @@ void loop_communication_task()
  */
 void loop_application_task()
 {
+#ifdef HARDWARE_PROTECTION
+    // the HRTIM has already stopped the outputs, the state follows
+    protection.update(k_uptime_get_32());
+    if (protection.isTripped() && mode != ERRORMODE) {
+        mode = ERRORMODE;
+        printk("overcurrent, protection tripped\n");
+    }
+#endif
 /* --- STATE MACHINE --------------------------------------------------------*/
 // mode is the STATE variable
 // in each state we compute the transitions
@@ -295,78 +637,86 @@ switch (mode) {
             }
         break;
         case ERRORMODE:
+#ifdef HARDWARE_PROTECTION
+            // back to idle once the protection is armed again
+            if (mode_asked == IDLEMODE && protection.clear()) {
+                mode = IDLEMODE;
+            }
+#else
+            if (mode_asked == IDLEMODE) mode = IDLEMODE;
+#endif
         break;
     }
-    if (mode_asked == IDLEMODE) mode = IDLEMODE; // global return to idle possible
+    if (mode_asked == IDLEMODE && mode != ERRORMODE) mode = IDLEMODE; // global return to idle possible
 /* --- END OF STATE MACHINE -------------------------------------------------*/
 
+    if (is_downloading)
+    {
+        // the records can be sent in any mode, the scope is not restarted
+        // before the end of the transfer, the continuous scope runs until
+        // it is stopped.
+        is_downloading = scope_stream.poll();
+        task.suspendBackgroundMs(1);
+        return;
+    }
+
+    profiler.printReport();
+    scheduler.printReport(control_task_period);
+
+#ifdef TELEMETRY
+    // one frame at each run, of the records the UART can send in 10 ms
+    telemetry.poll(scope_stream, telemetry_decimation, control_task_period);
+    task.suspendBackgroundMs(10);
+#else
     if (mode == IDLEMODE)
     {
-        if (!is_downloading) {
-            printk("%d:", mode);
-            printk("% 7.3f:", Vgrid_amplitude_ref);
-            printk("% 7.3f:", I1_low_value);
-            printk("% 7.3f:", I2_low_value);
-            printk("% 7.3f:", V1_low_value);
-            printk("\n");
-        } else {
-            dump_scope_datas(scope);
-            is_downloading = false;
-        }
+        printk("%d:", mode);
+        printk("% 7.3f:", control.Vgrid_amplitude_ref);
+        printk("% 7.3f:", meas.I1_low);
+        printk("% 7.3f:", meas.I2_low);
+        printk("% 7.3f:", meas.V1_low);
+        printk("\n");
     }
     else 
     {
         printk("%d:", mode);
-        printk("% 6.2f:", Vgrid_amplitude_ref);
-        printk("% 6.2f:", Vgrid_amplitude);
-        printk("% 6.2f:\n", V1_low_value);
+        printk("% 6.2f:", control.Vgrid_amplitude_ref);
+        printk("% 6.2f:", control.Vgrid_amplitude);
+        printk("% 6.2f:\n", meas.V1_low);
     }
     task.suspendBackgroundMs(100);
+#endif
 }
 
 /**
  * This is the code loop of the critical task
- * It is executed every 100 micro-seconds defined in the setup_software function.
+ * It is executed every control_task_period micro-seconds defined in the setup_software function.
  * You can use it to execute an ultra-fast code with the highest priority which cannot be interruped.
  * It is from it that you will control your power flow.
  */
 void loop_critical_task()
 {
-    // RETRIEVE MEASUREMENTS 
-    meas_data = data.getLatest(I1_LOW);
-    if (meas_data < 10000 && meas_data > -10000)
-        I1_low_value = meas_data;
-
-    meas_data = data.getLatest(V1_LOW);
-    if (meas_data < 10000 && meas_data > -10000)
-        V1_low_value = meas_data;
-
-    meas_data = data.getLatest(V2_LOW);
-    if (meas_data < 10000 && meas_data > -10000)
-        V2_low_value = meas_data;
-
-    meas_data = data.getLatest(I2_LOW);
-    if (meas_data < 10000 && meas_data > -10000)
-        I2_low_value = meas_data;
+    profiler.start();
 
-    meas_data = data.getLatest(V_HIGH);
-    if (meas_data != -10000)
-        V_high = meas_data;
-
-    meas_data = data.getLatest(I_HIGH);
-    if (meas_data != -10000)
-        I_high = meas_data;
-
-    V_high_filt = vHighFilter.calculateWithReturn(V_high);
-
-    // MANAGE OVERCURRENT
-    if (I1_low_value > MAX_CURRENT 
-        || I1_low_value < -MAX_CURRENT 
-        || I2_low_value > MAX_CURRENT 
-        || I2_low_value < -MAX_CURRENT)
+    // RETRIEVE MEASUREMENTS 
+    measures.acquire(meas);
+
+#ifdef BIQUAD_FILTERS
+    V_high_filt = meas.V_high; // filtered by the acquisition
+#else
+    V_high_filt = vHighFilter.calculateWithReturn(meas.V_high);
+#endif
+
+#ifndef HARDWARE_PROTECTION
+    // MANAGE OVERCURRENT, the hardware protection trips the HRTIM instead
+    if (meas.I1_low > MAX_CURRENT 
+        || meas.I1_low < -MAX_CURRENT 
+        || meas.I2_low > MAX_CURRENT 
+        || meas.I2_low < -MAX_CURRENT)
     {
         mode = ERRORMODE;
     }
+#endif
 
 
     if (mode == IDLEMODE || mode == ERRORMODE)
@@ -378,9 +728,8 @@ void loop_critical_task()
             spin.led.turnOff();
             pwm_enable = false;
         }
-        Vgrid_amplitude = 0.F;
+        control.idle();
         duty_cycle = DUTY_MIN;
-        prop_res.reset();
     }
 
     if (mode == STARTUPMODE) { // ramp up the common voltage to Udc/2
@@ -399,19 +748,14 @@ void loop_critical_task()
     }
     if (mode == POWERMODE)
     {
-        angle = ot_modulo_2pi(angle + w0 * Ts); 
-        Vgrid_amplitude = rate_limiter(Vgrid_amplitude_ref, Vgrid_amplitude, 10.F); 
-        Vgrid_ref = Vgrid_amplitude * ot_sin(angle);
-        pr_value = prop_res.calculateWithReturn(Vgrid_ref, V1_low_value - V2_low_value);
-        duty_cycle = pr_value / (2.0F * V_high_filt) + 0.5F; 
+        duty_cycle = control.dutyCycle(meas, V_high_filt);
         twist.setAllDutyCycle(duty_cycle);
 
     }
-    if (critical_task_counter%3 == 0) {
-        spying_mode = (float32_t) mode;
-        scope.acquire();
-    }
-    critical_task_counter++;
+    // amplitude ramp, scope and continuous scope at their own rate
+    scheduler.run();
+
+    profiler.stop();
 }
 
 /**
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2021-2024 LAAS-CNRS
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published by
+ *   the Free Software Foundation, either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGLPV2.1
+ */
+
+/**
+ * @brief  Change of the period of the critical task at runtime.
+ *
+ *         The controllers and filters are discretised with the sampling
+ *         period Ts. Each of them registers a function which discretises it
+ *         again for a new Ts, for example:
+ *
+ *             void retune_pr(float32_t Ts)
+ *             {
+ *                 prop_res.init(PrParams(Ts, Kp, Kr, w0, 0.0F, -Udc, Udc));
+ *             }
+ *
+ *             retune.add(retune_pr);
+ *
+ *         `changePeriod()` stops the critical task, calls all the registered
+ *         functions with the new Ts, then starts the critical task again
+ *         with the new period. It must be called from a background task
+ *         while the converter is idle: the controllers are re-initialised.
+ */
+
+#ifndef RETUNE_REGISTRY_H_
+#define RETUNE_REGISTRY_H_
+
+#include "TaskAPI.h"
+
+#define RETUNE_MAX_FUNCTIONS 8
+
+typedef void (*retune_function_t)(float32_t Ts);
+
+class RetuneRegistry
+{
+public:
+    /**
+     * @param min_period_us [us] shortest period accepted.
+     * @param max_period_us [us] longest period accepted.
+     */
+    RetuneRegistry(uint32_t min_period_us, uint32_t max_period_us)
+        : min_period_us(min_period_us), max_period_us(max_period_us)
+    {
+    }
+
+    /**
+     * @brief register a function called with the new Ts at each change.
+     *
+     * @return false if the registry is full.
+     */
+    bool add(retune_function_t function)
+    {
+        if (nb_functions >= RETUNE_MAX_FUNCTIONS) {
+            return false;
+        }
+        functions[nb_functions++] = function;
+        return true;
+    }
+
+    /**
+     * @brief call all the registered functions with Ts.
+     */
+    void retune(float32_t Ts)
+    {
+        for (uint8_t k = 0; k < nb_functions; k++) {
+            functions[k](Ts);
+        }
+    }
+
+    /**
+     * @brief restart the critical task with a new period.
+     *
+     * @param critical_task function of the critical task.
+     * @param period_us     [us] new period.
+     * @param source        interrupt source of the critical task.
+     * @return false if the period is out of range, nothing is changed.
+     */
+    bool changePeriod(task_function_t critical_task, uint32_t period_us,
+                      scheduling_interrupt_source_t source = source_tim6)
+    {
+        if (period_us < min_period_us || period_us > max_period_us) {
+            return false;
+        }
+        task.stopCritical();
+        retune((float32_t) period_us * 1.0e-6F);
+        task.createCritical(critical_task, period_us, source);
+        task.startCritical();
+        return true;
+    }
+
+private:
+    const uint32_t min_period_us;
+    const uint32_t max_period_us;
+    retune_function_t functions[RETUNE_MAX_FUNCTIONS];
+    uint8_t nb_functions = 0;
+};
+
+#endif // RETUNE_REGISTRY_H_
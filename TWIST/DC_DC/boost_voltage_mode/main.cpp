@@ -34,6 +34,7 @@
 #include "TwistAPI.h"
 #include "SpinAPI.h"
 #include "pid.h"
+#include "twist_measures.h"
 
 #include "zephyr/console/console.h"
 
@@ -53,15 +54,8 @@ static bool pwm_enable = false;            //[bool] state of the PWM (ctrl task)
 uint8_t received_serial_char;
 
 /* Measure variables */
-
-static float32_t V1_low_value;
-static float32_t V2_low_value;
-static float32_t I1_low_value;
-static float32_t I2_low_value;
-static float32_t I_high;
-static float32_t V_high;
-
-static float meas_data; // temp storage meas value (ctrl task)
+static twist_measures meas; // latest measures, updated by the critical task
+static TwistMeasures measures; // acquisition of the measures
 
 float32_t duty_cycle = 0.3;
 
@@ -176,12 +170,12 @@ void loop_application_task()
     {
         spin.led.turnOn();
 
-        printk("%f:", I1_low_value);
-        printk("%f:", V1_low_value);
-        printk("%f:", I2_low_value);
-        printk("%f:", V2_low_value);
-        printk("%f:", I_high);
-        printk("%f\n", V_high);
+        printk("%f:", meas.I1_low);
+        printk("%f:", meas.V1_low);
+        printk("%f:", meas.I2_low);
+        printk("%f:", meas.V2_low);
+        printk("%f:", meas.I_high);
+        printk("%f\n", meas.V_high);
     }
 
     task.suspendBackgroundMs(1000);
@@ -195,31 +189,7 @@ void loop_application_task()
  */
 void loop_critical_task()
 {
-    meas_data = data.getLatest(I1_LOW);
-    if (meas_data < 10000 && meas_data > -10000)
-        I1_low_value = meas_data;
-
-    meas_data = data.getLatest(V1_LOW);
-    if (meas_data != -10000)
-        V1_low_value = meas_data;
-
-    meas_data = data.getLatest(V2_LOW);
-    if (meas_data != -10000)
-        V2_low_value = meas_data;
-
-    meas_data = data.getLatest(I2_LOW);
-    if (meas_data < 10000 && meas_data > -10000)
-        I2_low_value = meas_data;
-
-    meas_data = data.getLatest(I_HIGH);
-    if (meas_data < 10000 && meas_data > -10000)
-        I_high = meas_data;
-
-    meas_data = data.getLatest(V_HIGH);
-    if (meas_data != -10000)
-        V_high = meas_data;
-
-
+    measures.acquire(meas);
 
     if (mode == IDLEMODE)
     {
@@ -231,7 +201,7 @@ void loop_critical_task()
     }
     else if (mode == POWERMODE)
     {
-        duty_cycle = pid.calculateWithReturn(voltage_reference, V_high);
+        duty_cycle = pid.calculateWithReturn(voltage_reference, meas.V_high);
         twist.setAllDutyCycle(duty_cycle);
 
         /* Set POWER ON */
@@ -36,6 +36,8 @@
 
 #include "zephyr/console/console.h"
 #include "pid.h"
+#include "twist_measures.h"
+#include "peak_reference_dma.h"
 //--------------SETUP FUNCTIONS DECLARATION-------------------
 void setup_routine(); // Setups the hardware and software of the system
 
@@ -53,9 +55,8 @@ static uint32_t control_task_period = 100; //[us] period of the control task
 bool pwm_enable = false;
 
 /* Measure variables */
-float32_t meas_data;
-static float32_t V1_low_value;
-static float32_t V2_low_value;
+static twist_measures meas; // latest measures, updated by the critical task
+static TwistMeasures measures(MEAS_V1_LOW | MEAS_V2_LOW); // acquisition of the measures
 
 static float32_t Ts = control_task_period * 1e-6F;
 static float32_t Kp = 0.1;
@@ -72,6 +73,16 @@ static PidParams pid_params(Ts, Kp, Ti, Td, N, lower_bound, upper_bound);
 static float32_t Vref = 15.0;
 static float32_t Iref;
 static float32_t PeakRef;
+static const float32_t SLOPE_DROP = 0.5; // [V] drop of the slope compensation over a switching period
+
+/* Peak reference of each switching period written by DMA */
+#define PEAK_REFERENCE_DMA // Comment to set the slope compensation once per control period
+
+#define SWITCHING_CYCLES 20 // switching periods per control period, 200 kHz / 10 kHz
+
+/* DAC and HRTIM timer of the slope compensation of each leg */
+static PeakReferenceStream<SWITCHING_CYCLES> leg1_peak; // DAC3, timer A
+static PeakReferenceStream<SWITCHING_CYCLES> leg2_peak; // DAC1, timer C
 
 
 //---------------------------------------------------------------
@@ -101,13 +112,21 @@ void setup_routine()
 
     data.enableTwistDefaultChannels();
 
-    /* initial setting slope compensation*/
-    twist.setAllSlopeCompensation(1.4, 1.0);
+    /* initial setting slope compensation, the drop is kept by PEAK_REFERENCE_DMA */
+    twist.setAllSlopeCompensation(1.4, 1.4 - SLOPE_DROP);
 
     // Then declare tasks
     uint32_t app_task_number = task.createBackground(loop_application_task);
     uint32_t com_task_number = task.createBackground(loop_communication_task);
+#ifdef PEAK_REFERENCE_DMA
+    leg1_peak.init(DAC3, LL_DMA_CHANNEL_1, LL_DMAMUX_REQ_HRTIM1_A, LL_HRTIM_TIMER_A, 1.4);
+    leg2_peak.init(DAC1, LL_DMA_CHANNEL_2, LL_DMAMUX_REQ_HRTIM1_C, LL_HRTIM_TIMER_C, 1.4);
+
+    // the DMA and the critical task must stay in phase
+    task.createCritical(loop_critical_task, control_task_period, source_hrtim);
+#else
     task.createCritical(loop_critical_task, 100); // Uncomment if you use the critical task
+#endif
 
     // Finally, start tasks
     task.startBackground(app_task_number);
@@ -135,6 +154,7 @@ void loop_communication_task()
             printk("|     press p : power mode               |\n");
             printk("|     press u : voltage reference UP     |\n");
             printk("|     press d : voltage reference DOWN   |\n");
+            printk("|     press s : DMA slips                |\n");
             printk("|________________________________________|\n\n");
             //------------------------------------------------------
             break;
@@ -152,6 +172,10 @@ void loop_communication_task()
         case 'd':
             Vref -= 0.5;
             break;
+        case 's':
+            printk("DMA slips: leg1 %u, leg2 %u\n",
+                   leg1_peak.getNbSlips(), leg2_peak.getNbSlips());
+            break;
         default:
             break;
         }
@@ -173,8 +197,8 @@ void loop_application_task()
     {
         spin.led.turnOn();
 
-        printk("%f:", V1_low_value);
-        printk("%f:", V2_low_value);
+        printk("%f:", meas.V1_low);
+        printk("%f:", meas.V2_low);
         printk("%f\n", PeakRef);
     }
     task.suspendBackgroundMs(1000);
@@ -189,31 +213,34 @@ void loop_application_task()
 void loop_critical_task()
 {
 
-    meas_data = data.getLatest(V1_LOW);
-    if (meas_data != -10000)
-        V1_low_value = meas_data;
-
-    meas_data = data.getLatest(V2_LOW);
-    if (meas_data != -10000)
-        V2_low_value = meas_data;
-
+    measures.acquire(meas);
 
     if (mode == IDLEMODE)
     {
         if (pwm_enable == true)
         {
             twist.stopAll();
+#ifdef PEAK_REFERENCE_DMA
+            leg1_peak.pause();
+            leg2_peak.pause();
+#endif
         }
         pwm_enable = false;
     }
     else if (mode == POWERMODE)
     {
-        Iref = pid.calculateWithReturn(Vref, V1_low_value);
+        Iref = pid.calculateWithReturn(Vref, meas.V1_low);
 
         PeakRef = 0.1 * Iref + 1.024; // Convert the current in voltage for slope compensation
 
+#ifdef PEAK_REFERENCE_DMA
+        /* references of the next 20 switching periods */
+        leg1_peak.refill(PeakRef);
+        leg2_peak.refill(PeakRef);
+#else
         // /*set slope compensation*/
-        twist.setAllSlopeCompensation(PeakRef, PeakRef - 0.5);
+        twist.setAllSlopeCompensation(PeakRef, PeakRef - SLOPE_DROP);
+#endif
 
         /* Set POWER ON */
         if (!pwm_enable)
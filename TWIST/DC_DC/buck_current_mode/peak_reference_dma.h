@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2021-2024 LAAS-CNRS
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published by
+ *   the Free Software Foundation, either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGLPV2.1
+ */
+
+/**
+ * @brief  Peak current reference of each switching period streamed by DMA.
+ *
+ *         In current mode the DAC of a leg makes the sawtooth of the slope
+ *         compensation, it is the reference of the comparator. Its start
+ *         (peak) value and its step are in the STR register of the DAC, set
+ *         by `twist.setLegSlopeCompensation()`.
+ *
+ *         Here a DMA channel, requested by the reset of the HRTIM timer of
+ *         the leg, writes STR once per switching period from a circular
+ *         buffer of 2 x CYCLES words. The critical task, CYCLES switching
+ *         periods long, refills the half that the DMA is not reading with
+ *         the references of the next control period:
+ *
+ *             | half 0: read by the DMA   | half 1: refilled by `refill()` |
+ *
+ *         The CPU writes the buffer once per control period, the DAC gets a
+ *         new peak value at each switching period. `refill()` ramps it
+ *         linearly from the previous reference to the new one, instead of a
+ *         step every control period.
+ *
+ *         The value written at the reset of period k is used from the reset
+ *         of period k + 1. The step of the sawtooth is kept, only the peak is
+ *         changed: the step and the scale of the DAC are taken from the STR
+ *         register set by `twist.setLegSlopeCompensation(peak, low)` before
+ *         `init()`, so `peak - low` must be the drop wanted at each period.
+ *
+ *         The critical task must be synchronised on the PWM (source_hrtim),
+ *         otherwise the DMA drifts through the buffer: `getNbSlips()` counts
+ *         the refills done in the same half twice in a row. `pause()` tells
+ *         that the refills stop, e.g. in idle, the first refill after it is
+ *         not counted.
+ */
+
+#ifndef PEAK_REFERENCE_DMA_H_
+#define PEAK_REFERENCE_DMA_H_
+
+#include <soc.h> // DAC_TypeDef
+#include <stm32_ll_bus.h>
+#include <stm32_ll_dma.h>
+#include <stm32_ll_hrtim.h>
+
+#include "arm_math.h" // float32_t
+
+template <uint16_t CYCLES>
+class PeakReferenceStream
+{
+public:
+    /**
+     * @brief start the stream, once the slope compensation is set.
+     *
+     * @param dac          DAC of the slope compensation of the leg.
+     * @param dma_channel  LL_DMA_CHANNEL_x of DMA2.
+     * @param dma_request  LL_DMAMUX_REQ_HRTIM1_x of the timer of the leg.
+     * @param hrtim_timer  LL_HRTIM_TIMER_x of the leg.
+     * @param initial_peak [V] peak value given to `setLegSlopeCompensation()`.
+     */
+    void init(DAC_TypeDef *dac, uint32_t dma_channel, uint32_t dma_request,
+              uint32_t hrtim_timer, float32_t initial_peak)
+    {
+        this->dma_channel = dma_channel;
+
+        uint32_t str = dac->STR1;
+        str_step = str & ~DAC_STR1_STRSTDATA1_Msk; // step and direction
+        uint32_t start = str & DAC_STR1_STRSTDATA1_Msk;
+        lsb_per_volt = (float32_t) start / initial_peak;
+        previous_peak = initial_peak;
+        for (uint16_t k = 0; k < 2 * CYCLES; k++) {
+            buffer[k] = str;
+        }
+
+        LL_AHB1_GRP1_EnableClock(LL_AHB1_GRP1_PERIPH_DMA2 | LL_AHB1_GRP1_PERIPH_DMAMUX1);
+        LL_DMA_DisableChannel(DMA2, dma_channel);
+        LL_DMA_ConfigTransfer(DMA2, dma_channel,
+                              LL_DMA_DIRECTION_MEMORY_TO_PERIPH | LL_DMA_MODE_CIRCULAR |
+                              LL_DMA_PERIPH_NOINCREMENT | LL_DMA_MEMORY_INCREMENT |
+                              LL_DMA_PDATAALIGN_WORD | LL_DMA_MDATAALIGN_WORD |
+                              LL_DMA_PRIORITY_HIGH);
+        LL_DMA_SetPeriphRequest(DMA2, dma_channel, dma_request);
+        LL_DMA_SetPeriphAddress(DMA2, dma_channel, (uint32_t) &dac->STR1);
+        LL_DMA_SetMemoryAddress(DMA2, dma_channel, (uint32_t) buffer);
+        LL_DMA_SetDataLength(DMA2, dma_channel, 2 * CYCLES);
+        LL_DMA_EnableChannel(DMA2, dma_channel);
+
+        LL_HRTIM_EnableDMAReq_RST(HRTIM1, hrtim_timer);
+    }
+
+    /**
+     * @brief write the references of the next control period, to be called
+     * once per period of the critical task.
+     *
+     * @param peak [V] peak reference at the end of the next control period.
+     */
+    void refill(float32_t peak)
+    {
+        // remaining words > CYCLES: the DMA reads the half 0
+        uint8_t half = LL_DMA_GetDataLength(DMA2, dma_channel) > CYCLES ? 1 : 0;
+        if (half == previous_half) {
+            nb_slips++;
+        }
+        previous_half = half;
+
+        uint32_t *words = &buffer[half * CYCLES];
+        float32_t step = (peak - previous_peak) * (1.0F / CYCLES);
+        for (uint16_t k = 0; k < CYCLES; k++) {
+            float32_t v = (previous_peak + step * (k + 1)) * lsb_per_volt;
+            v = v < 0.0F ? 0.0F : (v > 4095.0F ? 4095.0F : v);
+            words[k] = str_step | (uint32_t) v;
+        }
+        previous_peak = peak;
+    }
+
+    /**
+     * @brief the refills stop, to be called when the critical task does not
+     * call `refill()` anymore, e.g. when the PWM is stopped.
+     */
+    void pause() { previous_half = 2; }
+
+    uint32_t getNbSlips() { return nb_slips; }
+
+private:
+    alignas(4) uint32_t buffer[2 * CYCLES];
+    uint32_t dma_channel;
+    uint32_t str_step;      // STR without the start value
+    float32_t lsb_per_volt; // scale of the DAC
+    float32_t previous_peak;
+    uint8_t previous_half = 2; // 2: no refill since init() or pause()
+    uint32_t nb_slips = 0;
+};
+
+#endif // PEAK_REFERENCE_DMA_H_
@@ -34,8 +34,18 @@
 #include "TwistAPI.h"
 #include "SpinAPI.h"
 #include "pid.h"
+#include "pr.h"
+#include "fixed_controllers.h"
+#include "twist_measures.h"
+#include "scope_stream.h"
+#include "telemetry.h"
 
 #include "zephyr/console/console.h"
+#include "zephyr/kernel.h"
+#include <soc.h> // DWT cycle counter, used by the benchmarks
+
+#define FIXED_PID // comment to use the Pid of the control library
+#define TELEMETRY // Comment to print the measures as text every 100 ms
 
 //--------------SETUP FUNCTIONS DECLARATION-------------------
 void setup_routine(); // Setups the hardware and software of the system
@@ -44,24 +54,26 @@ void setup_routine(); // Setups the hardware and software of the system
 void loop_communication_task(); // code to be executed in the slow communication task
 void loop_application_task();   // Code to be executed in the background task
 void loop_critical_task();     // Code to be executed in real time in the critical task
+void controller_benchmark();   // cycles of the library controllers against the fixed ones
 
 //--------------USER VARIABLES DECLARATIONS-------------------
 
-static uint32_t control_task_period = 100; //[us] period of the control task
+static constexpr uint32_t control_task_period = 100; //[us] period of the control task
 static bool pwm_enable = false;            //[bool] state of the PWM (ctrl task)
 
 uint8_t received_serial_char;
 
 /* Measure variables */
+static twist_measures meas; // latest measures, updated by the critical task
+static TwistMeasures measures; // acquisition of the measures
 
-static float32_t V1_low_value;
-static float32_t V2_low_value;
-static float32_t I1_low_value;
-static float32_t I2_low_value;
-static float32_t I_high;
-static float32_t V_high;
-
-static float meas_data; // temp storage meas value (ctrl task)
+/* acquisition benchmark: cycles of the former getLatest() sequence against
+ * measures.acquire(), averaged over BENCHMARK_NB_TICKS control periods */
+static const uint32_t BENCHMARK_NB_TICKS = 1000;
+static volatile uint32_t benchmark_tick = BENCHMARK_NB_TICKS;
+static uint32_t benchmark_cycles_legacy;
+static uint32_t benchmark_cycles_batched;
+static twist_measures benchmark_meas;
 
 float32_t duty_cycle = 0.3;
 
@@ -69,15 +81,34 @@ static float32_t voltage_reference = 15; //voltage reference
 
 /* PID coefficient for a 8.6ms step response*/
 
-static float32_t kp = 0.000215;
-static float32_t Ti = 7.5175e-5;
-static float32_t Td = 0.0;
-static float32_t N = 0.0;
-static float32_t upper_bound = 1.0F;
-static float32_t lower_bound = 0.0F;
-static float32_t Ts = control_task_period * 1e-6;
+static constexpr float32_t kp = 0.000215;
+static constexpr float32_t Ti = 7.5175e-5;
+static constexpr float32_t Td = 0.0;
+static constexpr float32_t N = 0.0;
+static constexpr float32_t upper_bound = 1.0F;
+static constexpr float32_t lower_bound = 0.0F;
+static constexpr float32_t Ts = control_task_period * 1e-6;
 static PidParams pid_params(Ts, kp, Ti, Td, N, lower_bound, upper_bound);
+// the same PID, its coefficients computed by the compiler
+static constexpr pid_coefficients pid_coeffs = pidCoefficients(Ts, kp, Ti, Td, N, lower_bound, upper_bound);
+#ifdef FIXED_PID
+static FixedPid<pid_coeffs> pid;
+#else
 static Pid pid;
+#endif
+
+/* controller benchmark: a PR at 50 Hz, as in the AC examples */
+static constexpr float32_t bench_w0 = 2.0F * PI * 50.0F;
+static PrParams bench_pr_params(Ts, 0.2F, 3000.0F, bench_w0, 0.0F, -50.0F, 50.0F);
+static constexpr pr_coefficients bench_pr_coeffs = prCoefficients(Ts, 0.2F, 3000.0F, bench_w0, -50.0F, 50.0F);
+static const uint32_t CONTROLLER_BENCH_NB = 10000;
+
+// binary telemetry of the measures at 500 Hz instead of the text printed every 100 ms
+// 6 int16 channels and the index: 7 bytes per ms, 60 % of a 115200 bit/s console
+static Telemetry<256, 6> telemetry;
+static const uint16_t telemetry_decimation = 2000 / control_task_period;
+static uint16_t telemetry_counter = 0;
+static ScopeStream scope_stream; // sends the telemetry frames
 
 //---------------------------------------------------------------
 
@@ -108,7 +139,17 @@ void setup_routine()
 
     data.enableTwistDefaultChannels();
 
+#ifndef FIXED_PID
     pid.init(pid_params);
+#endif
+
+    scope_stream.init();
+    telemetry.connectChannel(meas.I1_low, "I1_low_value", 1000.0F); // [mA]
+    telemetry.connectChannel(meas.V1_low, "V1_low_value", 100.0F);  // [10 mV]
+    telemetry.connectChannel(meas.I2_low, "I2_low_value", 1000.0F);
+    telemetry.connectChannel(meas.V2_low, "V2_low_value", 100.0F);
+    telemetry.connectChannel(meas.I_high, "I_high_value", 1000.0F);
+    telemetry.connectChannel(meas.V_high, "V_high_value", 100.0F);
 
     // Then declare tasks
     uint32_t app_task_number = task.createBackground(loop_application_task);
@@ -121,6 +162,70 @@ void setup_routine()
     task.startCritical(); // Uncomment if you use the critical task
 }
 
+//--------------BENCHMARK-------------------------------------
+
+/**
+ * Cycles of one update of the Pid and Pr of the control library against
+ * FixedPid and FixedPr, fed with the same measures, and the max difference
+ * of their outputs. Each update is timed with the interrupts masked, the
+ * cost of reading the counter is removed.
+ */
+void controller_benchmark()
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    Pid lib_pid;
+    lib_pid.init(pid_params);
+    FixedPid<pid_coeffs> fixed_pid;
+    Pr lib_pr;
+    lib_pr.init(bench_pr_params);
+    FixedPr<bench_pr_coeffs> fixed_pr;
+
+    uint32_t overhead = UINT32_MAX;
+    uint32_t cycles[4] = {0, 0, 0, 0};
+    float32_t diff_pid = 0.0F;
+    float32_t diff_pr = 0.0F;
+    float32_t angle = 0.0F;
+    for (uint32_t k = 0; k < CONTROLLER_BENCH_NB; k++)
+    {
+        angle = ot_modulo_2pi(angle + bench_w0 * Ts);
+        float32_t v_meas = voltage_reference - 0.5F + 0.2F * ot_sin(angle);
+        float32_t i_ref = ot_sin(angle);
+        float32_t i_meas = 0.9F * ot_sin(angle - 0.1F);
+        float32_t out[4];
+
+        unsigned int key = irq_lock();
+        uint32_t t0 = DWT->CYCCNT;
+        uint32_t t1 = DWT->CYCCNT;
+        out[0] = lib_pid.calculateWithReturn(voltage_reference, v_meas);
+        uint32_t t2 = DWT->CYCCNT;
+        out[1] = fixed_pid.calculateWithReturn(voltage_reference, v_meas);
+        uint32_t t3 = DWT->CYCCNT;
+        out[2] = lib_pr.calculateWithReturn(i_ref, i_meas);
+        uint32_t t4 = DWT->CYCCNT;
+        out[3] = fixed_pr.calculateWithReturn(i_ref, i_meas);
+        uint32_t t5 = DWT->CYCCNT;
+        irq_unlock(key);
+
+        overhead = (t1 - t0) < overhead ? (t1 - t0) : overhead;
+        cycles[0] += t2 - t1;
+        cycles[1] += t3 - t2;
+        cycles[2] += t4 - t3;
+        cycles[3] += t5 - t4;
+        diff_pid = fmaxf(diff_pid, fabsf(out[0] - out[1]));
+        diff_pr = fmaxf(diff_pr, fabsf(out[2] - out[3]));
+    }
+
+    printk("controllers [cycles/update], %u updates:\n", CONTROLLER_BENCH_NB);
+    printk("  Pid %u, FixedPid %u, max difference %f\n",
+           cycles[0] / CONTROLLER_BENCH_NB - overhead,
+           cycles[1] / CONTROLLER_BENCH_NB - overhead, diff_pid);
+    printk("  Pr  %u, FixedPr  %u, max difference %f\n",
+           cycles[2] / CONTROLLER_BENCH_NB - overhead,
+           cycles[3] / CONTROLLER_BENCH_NB - overhead, diff_pr);
+}
+
 //--------------LOOP FUNCTIONS--------------------------------
 
 void loop_communication_task()
@@ -138,6 +243,8 @@ void loop_communication_task()
             printk("|     press p : power mode               |\n");
             printk("|     press u : voltage reference UP     |\n");
             printk("|     press d : voltage reference DOWN   |\n");
+            printk("|     press b : acquisition benchmark    |\n");
+            printk("|     press c : controller benchmark     |\n");
             printk("|________________________________________|\n\n");
             //------------------------------------------------------
             break;
@@ -155,6 +262,18 @@ void loop_communication_task()
         case 'd':
             voltage_reference -= 0.5;
             break;
+        case 'b':
+            if (benchmark_tick == BENCHMARK_NB_TICKS) {
+                benchmark_cycles_legacy = 0;
+                benchmark_cycles_batched = 0;
+                benchmark_tick = 0;
+            }
+            break;
+        case 'c':
+            if (mode == IDLEMODE) {
+                controller_benchmark();
+            }
+            break;
         default:
             break;
         }
@@ -176,49 +295,105 @@ void loop_application_task()
     {
         spin.led.turnOn();
 
-        printk("%f:", I1_low_value);
-        printk("%f:", V1_low_value);
-        printk("%f:", I2_low_value);
-        printk("%f:", V2_low_value);
-        printk("%f:", I_high);
-        printk("%f\n", V_high);
+#ifndef TELEMETRY
+        printk("%f:", meas.I1_low);
+        printk("%f:", meas.V1_low);
+        printk("%f:", meas.I2_low);
+        printk("%f:", meas.V2_low);
+        printk("%f:", meas.I_high);
+        printk("%f\n", meas.V_high);
+#endif
     }
+    if (benchmark_tick == BENCHMARK_NB_TICKS && benchmark_cycles_batched != 0)
+    {
+        printk("acquisition [cycles/tick]: getLatest sequence %u, measures.acquire %u, tick %u\n",
+               benchmark_cycles_legacy / BENCHMARK_NB_TICKS,
+               benchmark_cycles_batched / BENCHMARK_NB_TICKS,
+               SystemCoreClock / 1000000 * control_task_period);
+        benchmark_cycles_batched = 0;
+    }
+#ifdef TELEMETRY
+    // one frame at each run, of the records the UART can send in 10 ms
+    telemetry.poll(scope_stream, telemetry_decimation, control_task_period);
+    task.suspendBackgroundMs(10);
+#else
     task.suspendBackgroundMs(100);
+#endif
 }
 
 /**
- * This is the code loop of the critical task
- * It is executed every 500 micro-seconds defined in the setup_software function.
- * You can use it to execute an ultra-fast code with the highest priority which cannot be interruped.
- * It is from it that you will control your power flow.
+ * The acquisition as it was written before `twist_measures.h`, kept to be
+ * compared with `measures.acquire()`.
  */
-void loop_critical_task()
+static void legacy_acquisition(twist_measures &m)
 {
+    float32_t meas_data;
+
     meas_data = data.getLatest(I1_LOW);
     if (meas_data < 10000 && meas_data > -10000)
-        I1_low_value = meas_data;
+        m.I1_low = meas_data;
 
     meas_data = data.getLatest(V1_LOW);
     if (meas_data != -10000)
-        V1_low_value = meas_data;
+        m.V1_low = meas_data;
 
     meas_data = data.getLatest(V2_LOW);
     if (meas_data != -10000)
-        V2_low_value = meas_data;
+        m.V2_low = meas_data;
 
     meas_data = data.getLatest(I2_LOW);
     if (meas_data < 10000 && meas_data > -10000)
-        I2_low_value = meas_data;
+        m.I2_low = meas_data;
 
     meas_data = data.getLatest(I_HIGH);
     if (meas_data < 10000 && meas_data > -10000)
-        I_high = meas_data;
+        m.I_high = meas_data;
 
     meas_data = data.getLatest(V_HIGH);
     if (meas_data != -10000)
-        V_high = meas_data;
+        m.V_high = meas_data;
+}
 
+/**
+ * Time both acquisitions with the DWT cycle counter. The order is swapped at
+ * each tick so that none of them always reads the channels first.
+ */
+static void benchmark_acquisition()
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    uint32_t start = DWT->CYCCNT;
+    if (benchmark_tick & 1) {
+        legacy_acquisition(benchmark_meas);
+        uint32_t middle = DWT->CYCCNT;
+        measures.acquire(meas);
+        uint32_t end = DWT->CYCCNT;
+        benchmark_cycles_legacy += middle - start;
+        benchmark_cycles_batched += end - middle;
+    } else {
+        measures.acquire(meas);
+        uint32_t middle = DWT->CYCCNT;
+        legacy_acquisition(benchmark_meas);
+        uint32_t end = DWT->CYCCNT;
+        benchmark_cycles_batched += middle - start;
+        benchmark_cycles_legacy += end - middle;
+    }
+    benchmark_tick++;
+}
 
+/**
+ * This is the code loop of the critical task
+ * It is executed every 500 micro-seconds defined in the setup_software function.
+ * You can use it to execute an ultra-fast code with the highest priority which cannot be interruped.
+ * It is from it that you will control your power flow.
+ */
+void loop_critical_task()
+{
+    if (benchmark_tick < BENCHMARK_NB_TICKS)
+        benchmark_acquisition();
+    else
+        measures.acquire(meas);
 
     if (mode == IDLEMODE)
     {
@@ -230,7 +405,7 @@ void loop_critical_task()
     }
     else if (mode == POWERMODE)
     {
-        duty_cycle = pid.calculateWithReturn(voltage_reference, V1_low_value);
+        duty_cycle = pid.calculateWithReturn(voltage_reference, meas.V1_low);
         twist.setAllDutyCycle(duty_cycle);
 
         /* Set POWER ON */
@@ -239,6 +414,14 @@ void loop_critical_task()
             pwm_enable = true;
             twist.startAll();
         }
+
+#ifdef TELEMETRY
+        if (++telemetry_counter >= telemetry_decimation)
+        {
+            telemetry_counter = 0;
+            telemetry.sample();
+        }
+#endif
     }
 
 }
@@ -0,0 +1,632 @@
+/*
+ * Copyright (c) 2021-2024 LAAS-CNRS
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published by
+ *   the Free Software Foundation, either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGLPV2.1
+ */
+
+/**
+ * @brief  Binary streaming of the ScopeMimicry records on the console UART.
+ *
+ *         Instead of printing one hexadecimal line per float, the raw bytes of
+ *         `scope.get_buffer()` are sent in frames. Every frame has the header:
+ *
+ *         | sync (2) | type (1) | seq (1) | length (2) | crc (2) | payload |
+ *
+ *         - sync is 0xA5 0x5A,
+ *         - seq is incremented at each frame to detect a lost frame,
+ *         - length is the number of bytes of the payload,
+ *         - crc is the CRC16-CCITT (zephyr `crc16_ccitt()`, seed 0) of
+ *           type, seq, length and payload.
+ *
+ *         All the fields are little endian. A record is made of one
+ *         SCOPE_FRAME_INFO frame (channel names and formats, sample count,
+ *         decimation), a
+ *         series of SCOPE_FRAME_DATA frames containing the scope buffer and a
+ *         SCOPE_FRAME_END frame.
+ *
+ *         A `ContinuousScope` is sent the same way, except that each block of
+ *         `nb_samples` samples is announced by a SCOPE_FRAME_BLOCK frame, and
+ *         blocks follow each other until the scope is stopped. A
+ *         `OneShotScope` is a single block: it is sent like a continuous
+ *         scope and the record ends after this block.
+ *
+ *         The frames are written in the transmit ring of the console
+ *         (`console_write()`, CONFIG_CONSOLE_PUTCHAR_BUFSIZE bytes), sent by
+ *         the interrupt of the UART: the background task does not wait for
+ *         the bytes to go out, it only sleeps when the ring is full. `init()`
+ *         also sends the text of `printk()` through this ring, so that it is
+ *         not interlaced, byte by byte, with a frame being sent. A message
+ *         printed by another thread while a frame is written in the ring can
+ *         still fall inside it: the host drops this frame on its CRC.
+ *
+ *         The frames are not sent by DMA: the console UART is shared with the
+ *         shell and `printk()`, which write it by polling or interrupt, and
+ *         would collide with a DMA transfer (CONFIG_UART_ASYNC_API and the
+ *         interrupt API are exclusive on a UART).
+ *         Other frames, e.g. the telemetry of `telemetry.h`, can be sent
+ *         between two records with `send()`.
+ *         On the host side `filter_recorded_datas.py` decodes the frames.
+ */
+
+#ifndef SCOPE_STREAM_H_
+#define SCOPE_STREAM_H_
+
+#include "zephyr/kernel.h"
+#include "zephyr/device.h"
+#include "zephyr/drivers/uart.h"
+#include "zephyr/sys/crc.h"
+#include "zephyr/console/console.h"
+#include <string.h>
+
+// the examples without ScopeMimicry only send frames, e.g. the telemetry
+#if __has_include("ScopeMimicry.h")
+#include "ScopeMimicry.h"
+#define SCOPE_STREAM_MIMICRY
+#endif
+
+#define SCOPE_STREAM_VERSION 2
+#define SCOPE_STREAM_CHUNK_SIZE 512 // [bytes] payload of one data frame
+#define SCOPE_STREAM_NAMES_SIZE 256 // [bytes] room for the channel names and formats
+#define SCOPE_STREAM_MAX_CHANNEL 32 // the separators and formats of 32 channels take 193 bytes
+#define SCOPE_FORMAT_SIZE 5U       // [bytes] format and scale of a channel in the info frame
+
+static_assert(SCOPE_STREAM_NAMES_SIZE > 1 + SCOPE_STREAM_MAX_CHANNEL * (1 + SCOPE_FORMAT_SIZE),
+              "no room for the separators and the formats of the channels");
+
+#ifdef CONFIG_CONSOLE_GETCHAR
+extern "C" void __printk_hook_install(int (*fn)(int)); // as the zephyr console drivers
+#endif
+
+enum scope_frame_type
+{
+    SCOPE_FRAME_INFO = 1,
+    SCOPE_FRAME_DATA = 2,
+    SCOPE_FRAME_END = 3,
+    SCOPE_FRAME_BLOCK = 4,
+    SCOPE_FRAME_TELEMETRY_INFO = 5,
+    SCOPE_FRAME_TELEMETRY = 6
+};
+
+struct __attribute__((packed)) scope_frame_header
+{
+    uint8_t sync[2];
+    uint8_t type;
+    uint8_t seq;
+    uint16_t length;
+    uint16_t crc;
+};
+
+/* payload of the SCOPE_FRAME_INFO frame, followed by the channel names
+ * separated by ',' and ended by '\0', then by the format of each channel */
+struct __attribute__((packed)) scope_stream_info
+{
+    uint8_t version;
+    uint8_t nb_channel;
+    uint16_t nb_samples;  // number of samples per channel (of one block)
+    uint16_t decimation;  // number of control periods between two samples
+    uint32_t period_us;   // [us] period of the control task
+    uint32_t nb_bytes;    // size of the buffer (of one block) sent in data frames
+};
+
+/* payload of the SCOPE_FRAME_BLOCK frame */
+struct __attribute__((packed)) scope_stream_block
+{
+    uint32_t index;   // number of blocks filled since the start
+    uint32_t nb_lost; // number of blocks dropped since the start
+};
+
+/* format of the samples of a channel, given for each channel after the
+ * names in the SCOPE_FRAME_INFO frame: | format (1) | scale (4, float32) | */
+enum scope_sample_format
+{
+    SCOPE_FORMAT_FLOAT32 = 0, // raw float32, scale is 1
+    SCOPE_FORMAT_INT16 = 1    // int16 = value * scale, e.g. scale = 256 for Q8
+};
+
+struct scope_channel
+{
+    float32_t *value;
+    const char *name;
+    float32_t scale;
+    uint8_t format;
+    uint8_t offset; // [bytes] position in a sample
+};
+
+/**
+ * @brief Scope with two blocks of memory used in ping-pong.
+ *
+ * The critical task fills one block with `acquire()` while the background
+ * task sends the other one. When the background task is late, the block just
+ * filled is dropped and counted in `nb_lost`, so the samples of a block are
+ * always consecutive.
+ *
+ * A channel is stored as float32, or as int16 when it is connected with a
+ * scale: an int16 channel takes half the memory, so a block holds more
+ * samples. Storage is provided by the derived `ContinuousScope` template,
+ * or by `OneShotScope` which fills a single block and stops.
+ */
+class ContinuousScopeBase
+{
+public:
+    /**
+     * @brief add a channel, to be called before `start()`.
+     *
+     * @param channel variable to record.
+     * @param name    name given in the record header.
+     * @param scale   0 to record the float32 value, otherwise the value is
+     *                recorded as an int16 equal to value * scale, saturated.
+     *                A Q-format Qn is given by scale = 2^n.
+     */
+    void connectChannel(float32_t &channel, const char *name, float32_t scale = 0.0F)
+    {
+        if (nb_channel < max_channel) {
+            scope_channel &ch = channels[nb_channel];
+            ch.value = &channel;
+            ch.name = name;
+            ch.offset = sample_size;
+            if (scale != 0.0F) {
+                ch.format = SCOPE_FORMAT_INT16;
+                ch.scale = scale;
+                sample_size += sizeof(int16_t);
+            } else {
+                ch.format = SCOPE_FORMAT_FLOAT32;
+                ch.scale = 1.0F;
+                sample_size += sizeof(float32_t);
+            }
+            nb_channel++;
+            length = block_size / sample_size;
+        }
+    }
+
+    void start()
+    {
+        running = false;
+        sample_idx = 0;
+        active = 0;
+        block_count = 0;
+        nb_lost = 0;
+        ready = false;
+        running = true;
+    }
+
+    /**
+     * @brief stop the acquisition, the block being filled is lost.
+     */
+    void stop()
+    {
+        running = false;
+    }
+
+    /**
+     * @brief record one sample of every channel. To be called in the
+     * critical task.
+     */
+    void acquire()
+    {
+        if (!running) {
+            return;
+        }
+        uint8_t *sample = blocks[active] + sample_idx * sample_size;
+        for (uint8_t k = 0; k < nb_channel; k++) {
+            const scope_channel &ch = channels[k];
+            if (ch.format == SCOPE_FORMAT_INT16) {
+                int16_t packed = pack(*ch.value * ch.scale);
+                memcpy(sample + ch.offset, &packed, sizeof(packed));
+            } else {
+                memcpy(sample + ch.offset, ch.value, sizeof(float32_t));
+            }
+        }
+        if (++sample_idx < length) {
+            return;
+        }
+        sample_idx = 0;
+        if (ready) {
+            // the other block is still being sent, this one is dropped.
+            nb_lost++;
+        } else {
+            ready_block = active;
+            ready_index = block_count;
+            __atomic_signal_fence(__ATOMIC_SEQ_CST); // block written before it is ready
+            ready = true;
+            active ^= 1;
+        }
+        block_count++;
+        if (one_shot) {
+            // stopped after ready is set: the stream does not end before the block
+            running = false;
+        }
+    }
+
+    /**
+     * @brief get the block to send, to be called in a background task.
+     *
+     * @return the full block or nullptr if no block is ready.
+     */
+    uint8_t *readyBlock(scope_stream_block &block)
+    {
+        if (!ready) {
+            return nullptr;
+        }
+        __atomic_signal_fence(__ATOMIC_SEQ_CST);
+        block.index = ready_index;
+        block.nb_lost = nb_lost;
+        return blocks[ready_block];
+    }
+
+    /**
+     * @brief give the block back to the critical task once sent.
+     */
+    void releaseBlock()
+    {
+        ready = false;
+    }
+
+    bool isRunning() { return running; }
+    bool isReady() { return ready; }
+    uint8_t get_nb_channel() { return nb_channel; }
+    const scope_channel &get_channel(uint8_t k) { return channels[k]; }
+    uint16_t get_length() { return length; }
+    uint32_t get_block_size() { return length * sample_size; }
+    uint32_t get_nb_lost() { return nb_lost; }
+
+protected:
+    ContinuousScopeBase(uint8_t *block0, uint8_t *block1, uint32_t block_size,
+                        uint8_t max_channel, scope_channel *channels, bool one_shot = false)
+        : block_size(block_size), max_channel(max_channel), channels(channels),
+          one_shot(one_shot)
+    {
+        blocks[0] = block0;
+        blocks[1] = block1;
+    }
+
+private:
+    static int16_t pack(float32_t value)
+    {
+        if (value >= 32767.0F) {
+            return 32767;
+        }
+        if (value <= -32768.0F) {
+            return -32768;
+        }
+        return (int16_t) (value + (value >= 0.0F ? 0.5F : -0.5F));
+    }
+
+    uint8_t *blocks[2];
+    const uint32_t block_size;
+    const uint8_t max_channel;
+    scope_channel *channels;
+    const bool one_shot; // stop when the first block is full
+    uint8_t nb_channel = 0;
+    uint16_t sample_size = 0; // [bytes] size of a sample of all the channels
+    uint16_t length = 0;      // number of samples per block
+    uint16_t sample_idx = 0;
+    uint8_t active = 0;
+    uint8_t ready_block = 0;
+    uint32_t ready_index = 0;
+    uint32_t block_count = 0;
+    volatile uint32_t nb_lost = 0;
+    volatile bool ready = false;
+    volatile bool running = false;
+};
+
+/**
+ * @brief continuous scope with 2 blocks of `BLOCK_SIZE` bytes and up to
+ * `MAX_CHANNEL` channels. The number of samples by block depends on the
+ * formats of the channels: BLOCK_SIZE / (4 * nb_float32 + 2 * nb_int16).
+ */
+template <uint32_t BLOCK_SIZE, uint8_t MAX_CHANNEL>
+class ContinuousScope : public ContinuousScopeBase
+{
+public:
+    ContinuousScope()
+        : ContinuousScopeBase(storage[0], storage[1], BLOCK_SIZE, MAX_CHANNEL,
+                              channel_storage) {}
+
+private:
+    uint8_t storage[2][BLOCK_SIZE] __attribute__((aligned(4)));
+    scope_channel channel_storage[MAX_CHANNEL];
+};
+
+/**
+ * @brief one-shot scope of `SIZE` bytes and up to `MAX_CHANNEL` channels, a
+ * packed replacement of ScopeMimicry: `acquire()` stops once the block is
+ * full, the record is kept until the next `start()` and is sent once by
+ * `ScopeStream::begin()`. With int16 channels it holds twice the samples of
+ * a ScopeMimicry of the same memory.
+ */
+template <uint32_t SIZE, uint8_t MAX_CHANNEL>
+class OneShotScope : public ContinuousScopeBase
+{
+public:
+    OneShotScope()
+        : ContinuousScopeBase(storage, storage, SIZE, MAX_CHANNEL, channel_storage, true) {}
+
+private:
+    uint8_t storage[SIZE] __attribute__((aligned(4)));
+    scope_channel channel_storage[MAX_CHANNEL];
+};
+
+class ScopeStream
+{
+public:
+    /**
+     * @brief get the console UART and send `printk()` through the transmit
+     * ring of the console. Must be called once in `setup_routine()`.
+     */
+    void init()
+    {
+        uart = DEVICE_DT_GET(DT_CHOSEN(zephyr_console));
+#ifdef CONFIG_CONSOLE_GETCHAR
+        __printk_hook_install(printkOut);
+#endif
+    }
+
+#ifdef SCOPE_STREAM_MIMICRY
+    /**
+     * @brief prepare the streaming of a scope record. The transfer itself is
+     * done by successive calls to `poll()`.
+     *
+     * @param scope      the scope to send, its buffer must not be refilled
+     *                   during the transfer.
+     * @param decimation number of control periods between two acquisitions.
+     * @param period_us  [us] period of the control task.
+     * @return false if the scope has no channel or more than
+     *         SCOPE_STREAM_MAX_CHANNEL channels, nothing is sent.
+     */
+    bool begin(ScopeMimicry &scope, uint16_t decimation, uint32_t period_us)
+    {
+        uint16_t nb_channel = scope.get_nb_channel();
+
+        if (nb_channel == 0) {
+            printk("scope stream: no channel connected\n");
+            return false;
+        }
+        continuous = nullptr;
+        buffer = scope.get_buffer();
+        nb_bytes = scope.get_buffer_size();
+        offset = 0;
+        if (!setInfo(nb_channel, nb_bytes / (sizeof(float32_t) * nb_channel), decimation, period_us)) {
+            return false;
+        }
+        for (uint16_t k = 0; k < nb_channel; k++) {
+            addName(scope.get_channel_name(k));
+        }
+        endNames();
+        for (uint16_t k = 0; k < nb_channel; k++) {
+            addFormat(SCOPE_FORMAT_FLOAT32, 1.0F);
+        }
+
+        state = SCOPE_STREAM_INFO;
+        return true;
+    }
+#endif
+
+    /**
+     * @brief prepare the streaming of a continuous scope. Blocks are sent by
+     * `poll()` as soon as they are full, until the scope is stopped.
+     *
+     * @param scope      continuous scope, already started, or one-shot
+     *                   scope: its block is sent once full (check
+     *                   `isReady()` not to wait for it).
+     * @param decimation number of control periods between two acquisitions.
+     * @param period_us  [us] period of the control task.
+     * @return false if the scope has no channel or more than
+     *         SCOPE_STREAM_MAX_CHANNEL channels, nothing is sent.
+     */
+    bool begin(ContinuousScopeBase &scope, uint16_t decimation, uint32_t period_us)
+    {
+        if (scope.get_nb_channel() == 0) {
+            printk("scope stream: no channel connected\n");
+            return false;
+        }
+        continuous = &scope;
+        nb_bytes = scope.get_block_size();
+        if (!setInfo(scope.get_nb_channel(), scope.get_length(), decimation, period_us)) {
+            return false;
+        }
+        for (uint8_t k = 0; k < scope.get_nb_channel(); k++) {
+            addName(scope.get_channel(k).name);
+        }
+        endNames();
+        for (uint8_t k = 0; k < scope.get_nb_channel(); k++) {
+            addFormat(scope.get_channel(k).format, scope.get_channel(k).scale);
+        }
+
+        state = SCOPE_STREAM_INFO;
+        return true;
+    }
+
+    /**
+     * @brief send the next frame of the record, to be called from a
+     * background task.
+     *
+     * @return true while the record is not completely sent.
+     */
+    bool poll()
+    {
+        uint16_t length;
+
+        switch (state) {
+            case SCOPE_STREAM_INFO:
+                sendFrame(SCOPE_FRAME_INFO, info_payload, info_length);
+                state = (continuous != nullptr) ? SCOPE_STREAM_WAIT_BLOCK : SCOPE_STREAM_DATA;
+                break;
+            case SCOPE_STREAM_WAIT_BLOCK:
+                buffer = continuous->readyBlock(block_payload);
+                if (buffer != nullptr) {
+                    sendFrame(SCOPE_FRAME_BLOCK, (uint8_t *) &block_payload, sizeof(block_payload));
+                    offset = 0;
+                    state = SCOPE_STREAM_DATA;
+                } else if (!continuous->isRunning()) {
+                    state = SCOPE_STREAM_END;
+                }
+                break;
+            case SCOPE_STREAM_DATA:
+                if (offset >= nb_bytes) {
+                    // the last frame of the block is sent
+                    if (continuous != nullptr) {
+                        continuous->releaseBlock();
+                        state = SCOPE_STREAM_WAIT_BLOCK;
+                    } else {
+                        state = SCOPE_STREAM_END;
+                    }
+                    break;
+                }
+                length = SCOPE_STREAM_CHUNK_SIZE;
+                if (nb_bytes - offset < SCOPE_STREAM_CHUNK_SIZE) {
+                    length = nb_bytes - offset;
+                }
+                sendFrame(SCOPE_FRAME_DATA, buffer + offset, length);
+                offset += length;
+                break;
+            case SCOPE_STREAM_END:
+                sendFrame(SCOPE_FRAME_END, (uint8_t *) &nb_bytes, sizeof(nb_bytes));
+                state = SCOPE_STREAM_IDLE;
+                break;
+            case SCOPE_STREAM_IDLE:
+                break;
+        }
+        return state != SCOPE_STREAM_IDLE;
+    }
+
+    /**
+     * @brief send one frame out of a record, to be called from a background
+     * task. The payload is copied, it can be modified on return.
+     *
+     * @return false if a record is being sent, nothing is sent.
+     */
+    bool send(uint8_t type, const uint8_t *payload, uint16_t length)
+    {
+        if (state != SCOPE_STREAM_IDLE) {
+            return false;
+        }
+        sendFrame(type, payload, length);
+        return true;
+    }
+
+    /**
+     * @return true while a record is being sent.
+     */
+    bool isBusy() { return state != SCOPE_STREAM_IDLE; }
+
+private:
+    enum scope_stream_state
+    {
+        SCOPE_STREAM_IDLE = 0,
+        SCOPE_STREAM_INFO,
+        SCOPE_STREAM_WAIT_BLOCK,
+        SCOPE_STREAM_DATA,
+        SCOPE_STREAM_END
+    };
+
+    bool setInfo(uint8_t nb_channel, uint16_t nb_samples, uint16_t decimation, uint32_t period_us)
+    {
+        scope_stream_info *info = (scope_stream_info *) info_payload;
+
+        if (nb_channel > SCOPE_STREAM_MAX_CHANNEL) {
+            printk("scope stream: %u channels, %u at most\n", nb_channel, SCOPE_STREAM_MAX_CHANNEL);
+            return false;
+        }
+
+        info->version = SCOPE_STREAM_VERSION;
+        info->nb_channel = nb_channel;
+        info->nb_samples = nb_samples;
+        info->decimation = decimation;
+        info->period_us = period_us;
+        info->nb_bytes = nb_bytes;
+        info_length = sizeof(scope_stream_info);
+        // the names are cut so that the ',' of each of them, the '\0' and the
+        // formats always fit
+        names_room = SCOPE_STREAM_NAMES_SIZE - 1 - nb_channel * (1 + SCOPE_FORMAT_SIZE);
+        return true;
+    }
+
+    void addName(const char *name)
+    {
+        while (*name != '\0' && names_room > 0) {
+            info_payload[info_length++] = *name++;
+            names_room--;
+        }
+        info_payload[info_length++] = ',';
+    }
+
+    void endNames()
+    {
+        info_payload[info_length++] = '\0';
+    }
+
+    void addFormat(uint8_t format, float32_t scale)
+    {
+        if (info_length + SCOPE_FORMAT_SIZE <= sizeof(info_payload)) {
+            info_payload[info_length++] = format;
+            memcpy(info_payload + info_length, &scale, sizeof(scale));
+            info_length += sizeof(scale);
+        }
+    }
+
+    void sendFrame(uint8_t type, const uint8_t *payload, uint16_t length)
+    {
+        header.sync[0] = 0xA5;
+        header.sync[1] = 0x5A;
+        header.type = type;
+        header.seq = seq++;
+        header.length = length;
+        header.crc = crc16_ccitt(0, &header.type, 4); // type, seq and length
+        header.crc = crc16_ccitt(header.crc, payload, length);
+
+        write((uint8_t *) &header, sizeof(header));
+        write(payload, length);
+    }
+
+    void write(const uint8_t *bytes, uint16_t length)
+    {
+#ifdef CONFIG_CONSOLE_GETCHAR
+        console_write(nullptr, bytes, length); // sleeps only if the ring is full
+#else
+        for (uint16_t k = 0; k < length; k++) {
+            uart_poll_out(uart, bytes[k]);
+        }
+#endif
+    }
+
+#ifdef CONFIG_CONSOLE_GETCHAR
+    /* printk() in the same ring as the frames, '\n' sent as "\r\n" as by
+     * the console driver */
+    static int printkOut(int c)
+    {
+        if (c == '\n') {
+            console_putchar('\r');
+        }
+        console_putchar((char) c);
+        return c;
+    }
+#endif
+
+    const struct device *uart;
+    scope_stream_state state = SCOPE_STREAM_IDLE;
+    scope_frame_header header;
+    uint8_t seq = 0;
+    ContinuousScopeBase *continuous = nullptr;
+    scope_stream_block block_payload;
+    uint8_t *buffer;
+    uint32_t nb_bytes;
+    uint32_t offset;
+    uint8_t info_payload[sizeof(scope_stream_info) + SCOPE_STREAM_NAMES_SIZE];
+    uint16_t info_length;
+    uint16_t names_room; // [bytes] left for the characters of the names
+};
+
+#endif // SCOPE_STREAM_H_
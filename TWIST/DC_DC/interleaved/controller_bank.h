@@ -0,0 +1,278 @@
+/*
+ * Copyright (c) 2021-2024 LAAS-CNRS
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published by
+ *   the Free Software Foundation, either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGLPV2.1
+ */
+
+/**
+ * @brief  Banks of N PI, PR or biquad controllers updated in one call.
+ *
+ *         One controller per leg means N calls of `calculateWithReturn()` per
+ *         tick, each one loading its object, its parameters and its state.
+ *         A bank keeps the coefficients and the states of its N controllers
+ *         in arrays, one array per term (structure of arrays):
+ *
+ *             kp[0] kp[1] ... kp[N-1]
+ *             ki[0] ki[1] ... ki[N-1]
+ *             integral[0] ... integral[N-1]
+ *
+ *         and `calculate()` updates the N controllers in one loop of fixed
+ *         length, unrolled by the compiler for the small N of the legs: the
+ *         loads are consecutive, the multiply-accumulates of the different
+ *         controllers are independent and fill the pipeline of the FPU.
+ *
+ *         The controllers are float32: the SIMD instructions of the
+ *         Cortex-M4 (SMLAD...) are for 16-bit integers and the single
+ *         precision FPU has no vector mode, so the gain is in the loop, not
+ *         in wider instructions.
+ *
+ *         PI: u = kp.e + integral, integral += kp.Ts/Ti.e, by forward Euler
+ *         as the Pid of the control library, the integral and the output
+ *         are clamped to [lower_bound, upper_bound].
+ *
+ *         PR: u = kp.e + r, r = Kr.s/(s^2 + w0^2).e by Tustin prewarped at
+ *         w0, the output is clamped to [lower_bound, upper_bound].
+ *
+ *         Biquad: N cascades of SECTIONS biquads in direct form II
+ *         transposed, the sections of `biquad.h`. As the multi-instance
+ *         kernels of CMSIS-DSP, the loop on the instances is inside the
+ *         loop on the sections: the N sections k of a tick are independent.
+ */
+
+#ifndef CONTROLLER_BANK_H_
+#define CONTROLLER_BANK_H_
+
+#include <math.h>
+
+#include "arm_math.h" // float32_t
+#include "biquad.h"    // biquad_coefficients
+
+template <uint8_t N>
+class PiBank
+{
+    static_assert(N >= 1, "at least one controller");
+
+public:
+    /**
+     * @brief parameters of the controller k.
+     *
+     * @param Ts [s] sampling period.
+     * @param Ti [s] integral time constant, 0 for no integral.
+     */
+    void init(uint8_t k, float32_t Ts, float32_t kp, float32_t Ti,
+              float32_t lower_bound, float32_t upper_bound)
+    {
+        this->kp[k] = kp;
+        ki[k] = Ti > 0.0F ? kp * Ts / Ti : 0.0F;
+        lower[k] = lower_bound;
+        upper[k] = upper_bound;
+        integral[k] = 0.0F;
+    }
+
+    /**
+     * @param value initial value of the outputs.
+     */
+    void reset(float32_t value = 0.0F)
+    {
+        for (uint8_t k = 0; k < N; k++) {
+            integral[k] = value;
+        }
+    }
+
+    /**
+     * @brief update the N controllers.
+     *
+     * @param output output of each controller, may be `measurement`.
+     */
+    void calculate(const float32_t reference[N], const float32_t measurement[N],
+                   float32_t output[N])
+    {
+        for (uint8_t k = 0; k < N; k++) {
+            float32_t error = reference[k] - measurement[k];
+            float32_t u = kp[k] * error + integral[k];
+            float32_t i = integral[k] + ki[k] * error;
+            integral[k] = clamp(i, lower[k], upper[k]);
+            output[k] = clamp(u, lower[k], upper[k]);
+        }
+    }
+
+    /**
+     * @brief update the N controllers, with the same reference.
+     */
+    void calculate(float32_t reference, const float32_t measurement[N], float32_t output[N])
+    {
+        for (uint8_t k = 0; k < N; k++) {
+            float32_t error = reference - measurement[k];
+            float32_t u = kp[k] * error + integral[k];
+            float32_t i = integral[k] + ki[k] * error;
+            integral[k] = clamp(i, lower[k], upper[k]);
+            output[k] = clamp(u, lower[k], upper[k]);
+        }
+    }
+
+private:
+    static float32_t clamp(float32_t x, float32_t lo, float32_t hi)
+    {
+        x = x > hi ? hi : x;
+        return x < lo ? lo : x;
+    }
+
+    float32_t kp[N];
+    float32_t ki[N];  // kp.Ts/Ti
+    float32_t lower[N];
+    float32_t upper[N];
+    float32_t integral[N];
+};
+
+template <uint8_t N>
+class PrBank
+{
+    static_assert(N >= 1, "at least one controller");
+
+public:
+    /**
+     * @brief parameters of the controller k.
+     *
+     * @param Ts [s] sampling period.
+     * @param w0 [rad/s] resonant frequency.
+     */
+    void init(uint8_t k, float32_t Ts, float32_t kp, float32_t Kr, float32_t w0,
+              float32_t lower_bound, float32_t upper_bound)
+    {
+        // s = K.(1 - z^-1)/(1 + z^-1), K = w0 / tan(w0.Ts/2), in double:
+        // a1 is close to -2 and its distance to -2 sets the resonance
+        double w = (double) w0;
+        double K = w / tan(w * (double) Ts / 2.0);
+        double den = K * K + w * w;
+        this->kp[k] = kp;
+        b0[k] = (float32_t) ((double) Kr * K / den);
+        a1[k] = (float32_t) (2.0 * (w * w - K * K) / den);
+        lower[k] = lower_bound;
+        upper[k] = upper_bound;
+        e1[k] = e2[k] = r1[k] = r2[k] = 0.0F;
+    }
+
+    void reset()
+    {
+        for (uint8_t k = 0; k < N; k++) {
+            e1[k] = 0.0F;
+            e2[k] = 0.0F;
+            r1[k] = 0.0F;
+            r2[k] = 0.0F;
+        }
+    }
+
+    /**
+     * @brief update the N controllers.
+     *
+     * @param output output of each controller, may be `measurement`.
+     */
+    void calculate(const float32_t reference[N], const float32_t measurement[N],
+                   float32_t output[N])
+    {
+        for (uint8_t k = 0; k < N; k++) {
+            float32_t error = reference[k] - measurement[k];
+            // r(k) = b0.(e(k) - e(k-2)) - a1.r(k-1) - r(k-2)
+            float32_t r = b0[k] * (error - e2[k]) - a1[k] * r1[k] - r2[k];
+            e2[k] = e1[k];
+            e1[k] = error;
+            r2[k] = r1[k];
+            r1[k] = r;
+            float32_t u = kp[k] * error + r;
+            u = u > upper[k] ? upper[k] : u;
+            output[k] = u < lower[k] ? lower[k] : u;
+        }
+    }
+
+private:
+    float32_t kp[N];
+    float32_t b0[N];
+    float32_t a1[N];
+    float32_t lower[N];
+    float32_t upper[N];
+    float32_t e1[N];  // e(k-1)
+    float32_t e2[N];  // e(k-2)
+    float32_t r1[N];  // r(k-1)
+    float32_t r2[N];  // r(k-2)
+};
+
+template <uint8_t N, uint8_t SECTIONS>
+class BiquadBank
+{
+    static_assert(N >= 1, "at least one cascade");
+    static_assert(SECTIONS >= 1, "at least one section");
+
+public:
+    /**
+     * @brief coefficients of the section s of the cascade k, the sections
+     * are in series from 0 to SECTIONS - 1.
+     */
+    void setSection(uint8_t k, uint8_t s, const biquad_coefficients &c)
+    {
+        b0[s][k] = (float32_t) c.b0;
+        b1[s][k] = (float32_t) c.b1;
+        b2[s][k] = (float32_t) c.b2;
+        a1[s][k] = (float32_t) c.a1;
+        a2[s][k] = (float32_t) c.a2;
+        s1[s][k] = 0.0F;
+        s2[s][k] = 0.0F;
+    }
+
+    void reset()
+    {
+        for (uint8_t s = 0; s < SECTIONS; s++) {
+            for (uint8_t k = 0; k < N; k++) {
+                s1[s][k] = 0.0F;
+                s2[s][k] = 0.0F;
+            }
+        }
+    }
+
+    /**
+     * @brief filter one sample of each of the N inputs.
+     *
+     * @param output output of each cascade, may be `input`.
+     */
+    void calculate(const float32_t input[N], float32_t output[N])
+    {
+        float32_t x[N];
+        for (uint8_t k = 0; k < N; k++) {
+            x[k] = input[k];
+        }
+        for (uint8_t s = 0; s < SECTIONS; s++) {
+            for (uint8_t k = 0; k < N; k++) {
+                float32_t y = b0[s][k] * x[k] + s1[s][k];
+                s1[s][k] = b1[s][k] * x[k] - a1[s][k] * y + s2[s][k];
+                s2[s][k] = b2[s][k] * x[k] - a2[s][k] * y;
+                x[k] = y;
+            }
+        }
+        for (uint8_t k = 0; k < N; k++) {
+            output[k] = x[k];
+        }
+    }
+
+private:
+    float32_t b0[SECTIONS][N];
+    float32_t b1[SECTIONS][N];
+    float32_t b2[SECTIONS][N];
+    float32_t a1[SECTIONS][N];
+    float32_t a2[SECTIONS][N];
+    float32_t s1[SECTIONS][N];
+    float32_t s2[SECTIONS][N];
+};
+
+#endif // CONTROLLER_BANK_H_
@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2021-2024 LAAS-CNRS
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published by
+ *   the Free Software Foundation, either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGLPV2.1
+ */
+
+/**
+ * @brief  Phase distribution and current sharing of an N-phase interleaved
+ *         buck.
+ *
+ *         The N legs are shifted by 360/N degrees: phase k is shifted by
+ *         `phaseShift(k)` = k.360/N, as the 72 degrees spacing of the five
+ *         PWM of SPIN/PWM/multiple_pwm.
+ *
+ *         The voltage loop gives the duty cycle common to all the phases.
+ *         Each phase has a PI on the error between the mean current of the
+ *         phases and its own current, its output is a trim added to the
+ *         common duty cycle:
+ *
+ *             duty(k) = duty + trim(k),   trim(k) = PI(I_mean - I(k))
+ *
+ *         A small difference of duty cycle gives a large difference of
+ *         current (Vhigh / resistance of the leg), so the trims stay small
+ *         and are bounded by `max_trim`. The mean of the trims is removed:
+ *         the mean duty cycle is the one of the voltage loop, the sharing
+ *         loops do not fight with it.
+ *
+ *         The N PI are a `PiBank`, updated in one call.
+ */
+
+#ifndef CURRENT_SHARING_H_
+#define CURRENT_SHARING_H_
+
+#include "controller_bank.h"
+
+template <uint8_t N>
+class CurrentSharing
+{
+    static_assert(N >= 1, "at least one phase");
+
+public:
+    /**
+     * @param Ts       [s] sampling period.
+     * @param kp       [1/A] proportional gain, duty cycle per ampere.
+     * @param Ti       [s] integral time constant.
+     * @param max_trim bound of the trim of each phase, in duty cycle.
+     */
+    void init(float32_t Ts, float32_t kp, float32_t Ti, float32_t max_trim)
+    {
+        for (uint8_t k = 0; k < N; k++) {
+            pi.init(k, Ts, kp, Ti, -max_trim, max_trim);
+        }
+        reset();
+    }
+
+    /**
+     * @return [deg] phase shift of the phase k, the phase 0 is the reference.
+     */
+    static constexpr uint16_t phaseShift(uint8_t k) { return (uint16_t) (k * 360 / N); }
+
+    /**
+     * @brief clear the integrals, to be called when the power is stopped.
+     */
+    void reset()
+    {
+        pi.reset();
+        for (uint8_t k = 0; k < N; k++) {
+            trim[k] = 0.0F;
+        }
+    }
+
+    /**
+     * @brief duty cycles of the phases.
+     *
+     * @param duty     common duty cycle, output of the voltage loop.
+     * @param current  [A] current of each phase.
+     * @param duty_out duty cycle of each phase, in [0, 1].
+     */
+    void calculate(float32_t duty, const float32_t current[N], float32_t duty_out[N])
+    {
+        float32_t mean = 0.0F;
+        for (uint8_t k = 0; k < N; k++) {
+            mean += current[k];
+        }
+        mean *= 1.0F / N;
+
+        pi.calculate(mean, current, trim);
+        float32_t trim_mean = 0.0F;
+        for (uint8_t k = 0; k < N; k++) {
+            trim_mean += trim[k];
+        }
+        trim_mean *= 1.0F / N;
+
+        for (uint8_t k = 0; k < N; k++) {
+            trim[k] -= trim_mean;
+            float32_t d = duty + trim[k];
+            duty_out[k] = d > 1.0F ? 1.0F : (d < 0.0F ? 0.0F : d);
+        }
+    }
+
+    /**
+     * @return trim of the phase k, in duty cycle.
+     */
+    float32_t getTrim(uint8_t k) { return trim[k]; }
+
+private:
+    PiBank<N> pi;
+    float32_t trim[N];
+};
+
+#endif // CURRENT_SHARING_H_
@@ -34,8 +34,15 @@
 #include "TwistAPI.h"
 #include "SpinAPI.h"
 #include "pid.h"
+#include "pr.h"
+#include "trigo.h"
+#include "twist_measures.h"
+#include "current_sharing.h"
+#include "controller_bank.h"
 
 #include "zephyr/console/console.h"
+#include "zephyr/kernel.h"
+#include <soc.h> // DWT cycle counter, used by the benchmark
 
 //--------------SETUP FUNCTIONS DECLARATION-------------------
 void setup_routine(); // Setups the hardware and software of the system
@@ -44,6 +51,7 @@ void setup_routine(); // Setups the hardware and software of the system
 void loop_communication_task(); // code to be executed in the slow communication task
 void loop_application_task();   // Code to be executed in the background task
 void loop_critical_task();     // Code to be executed in real time in the critical task
+void controller_benchmark();   // cycles of N controllers against a bank of N
 
 //--------------USER VARIABLES DECLARATIONS-------------------
 
@@ -53,15 +61,8 @@ static bool pwm_enable = false;            //[bool] state of the PWM (ctrl task)
 uint8_t received_serial_char;
 
 /* Measure variables */
-
-static float32_t V1_low_value;
-static float32_t V2_low_value;
-static float32_t I1_low_value;
-static float32_t I2_low_value;
-static float32_t I_high;
-static float32_t V_high;
-
-static float meas_data; // temp storage meas value (ctrl task)
+static twist_measures meas; // latest measures, updated by the critical task
+static TwistMeasures measures; // acquisition of the measures
 
 float32_t duty_cycle = 0.3;
 
@@ -79,6 +80,31 @@ static float32_t Ts = control_task_period * 1e-6;
 static PidParams pid_params(Ts, kp, Ti, Td, N, lower_bound, upper_bound);
 static Pid pid;
 
+/* Interleaving: the phases are shifted by 360/NB_PHASES degrees */
+#define CURRENT_SHARING // Comment to drive all the legs with the duty cycle of the voltage loop
+
+#define NB_PHASES 2
+static_assert(NB_PHASES <= 2, "the TWIST has two legs");
+
+static const leg_t phase_legs[NB_PHASES] = {LEG1, LEG2};
+static float32_t twist_measures::*const phase_currents[NB_PHASES] = {
+    &twist_measures::I1_low, &twist_measures::I2_low,
+};
+
+/* Current sharing PI of each phase, in duty cycle per ampere */
+static float32_t sharing_kp = 0.001F;
+static float32_t sharing_Ti = 2e-3F;
+static float32_t sharing_max_trim = 0.05F; // bound of the correction of each phase
+static CurrentSharing<NB_PHASES> sharing;
+static float32_t phase_duty[NB_PHASES];
+
+/* controller benchmark: the PI of the sharing, a PR at 50 Hz, as in the
+ * AC examples, and a 4th order low-pass of two biquads, for banks of 1 to 8
+ * controllers */
+static const float32_t bench_w0 = 2.0F * PI * 50.0F;
+static const float32_t bench_f_biquad = 1000.0F; // [Hz] cut-off of the biquads
+static const uint32_t CONTROLLER_BENCH_NB = 2000;
+
 //---------------------------------------------------------------
 
 enum serial_interface_menu_mode // LIST OF POSSIBLE MODES FOR THE OWNTECH CONVERTER
@@ -105,11 +131,14 @@ void setup_routine()
 
     /* buck voltage mode */
     twist.initAllBuck();
-    twist.setLegPhaseShift(LEG2, 180);
+    for (uint8_t k = 1; k < NB_PHASES; k++) {
+        twist.setLegPhaseShift(phase_legs[k], sharing.phaseShift(k));
+    }
 
     data.enableTwistDefaultChannels();
 
     pid.init(pid_params);
+    sharing.init(Ts, sharing_kp, sharing_Ti, sharing_max_trim);
 
     // Then declare tasks
     uint32_t app_task_number = task.createBackground(loop_application_task);
@@ -122,6 +151,129 @@ void setup_routine()
     task.startCritical(); // Uncomment if you use the critical task
 }
 
+//--------------BENCHMARK-------------------------------------
+
+/**
+ * Cycles per tick of N Pid and N Pr of the control library and of N
+ * BiquadCascade<2>, each one updated by its `calculateWithReturn()`, against
+ * a PiBank<N>, a PrBank<N> and a BiquadBank<N, 2> fed with the same measures.
+ * Each tick is timed with the interrupts masked, the cost of reading the
+ * counter is removed.
+ */
+template <uint8_t NB>
+static void bench_bank(uint32_t overhead)
+{
+    Pid lib_pi[NB];
+    Pr lib_pr[NB];
+    BiquadCascade<2> lib_biquad[NB];
+    PiBank<NB> pi_bank;
+    PrBank<NB> pr_bank;
+    BiquadBank<NB, 2> biquad_bank;
+    biquad_coefficients low_pass = biquadLowPass(Ts, bench_f_biquad);
+    PidParams pi_params(Ts, sharing_kp, sharing_Ti, 0.0F, 0.0F, -sharing_max_trim, sharing_max_trim);
+    PrParams pr_params(Ts, 0.2F, 3000.0F, bench_w0, 0.0F, -50.0F, 50.0F);
+    for (uint8_t k = 0; k < NB; k++) {
+        lib_pi[k].init(pi_params);
+        lib_pr[k].init(pr_params);
+        pi_bank.init(k, Ts, sharing_kp, sharing_Ti, -sharing_max_trim, sharing_max_trim);
+        pr_bank.init(k, Ts, 0.2F, 3000.0F, bench_w0, -50.0F, 50.0F);
+        for (uint8_t s = 0; s < 2; s++) {
+            lib_biquad[k].setSection(s, low_pass);
+            biquad_bank.setSection(k, s, low_pass);
+        }
+    }
+
+    uint32_t cycles[6] = {0, 0, 0, 0, 0, 0};
+    float32_t diff_pi = 0.0F;
+    float32_t diff_pr = 0.0F;
+    float32_t diff_biquad = 0.0F;
+    float32_t angle = 0.0F;
+    for (uint32_t n = 0; n < CONTROLLER_BENCH_NB; n++)
+    {
+        angle = ot_modulo_2pi(angle + bench_w0 * Ts);
+        float32_t ref[NB], meas_i[NB];
+        float32_t out_lib[NB], out_bank[NB];
+        for (uint8_t k = 0; k < NB; k++) {
+            ref[k] = ot_sin(angle);
+            meas_i[k] = (0.9F - 0.05F * k) * ot_sin(angle - 0.1F);
+        }
+
+        unsigned int key = irq_lock();
+        uint32_t t0 = DWT->CYCCNT;
+        for (uint8_t k = 0; k < NB; k++) {
+            out_lib[k] = lib_pi[k].calculateWithReturn(ref[k], meas_i[k]);
+        }
+        uint32_t t1 = DWT->CYCCNT;
+        pi_bank.calculate(ref, meas_i, out_bank);
+        uint32_t t2 = DWT->CYCCNT;
+        irq_unlock(key);
+        for (uint8_t k = 0; k < NB; k++) {
+            diff_pi = fmaxf(diff_pi, fabsf(out_lib[k] - out_bank[k]));
+        }
+
+        key = irq_lock();
+        uint32_t t3 = DWT->CYCCNT;
+        for (uint8_t k = 0; k < NB; k++) {
+            out_lib[k] = lib_pr[k].calculateWithReturn(ref[k], meas_i[k]);
+        }
+        uint32_t t4 = DWT->CYCCNT;
+        pr_bank.calculate(ref, meas_i, out_bank);
+        uint32_t t5 = DWT->CYCCNT;
+        irq_unlock(key);
+        for (uint8_t k = 0; k < NB; k++) {
+            diff_pr = fmaxf(diff_pr, fabsf(out_lib[k] - out_bank[k]));
+        }
+
+        key = irq_lock();
+        uint32_t t6 = DWT->CYCCNT;
+        for (uint8_t k = 0; k < NB; k++) {
+            out_lib[k] = lib_biquad[k].calculateWithReturn(meas_i[k]);
+        }
+        uint32_t t7 = DWT->CYCCNT;
+        biquad_bank.calculate(meas_i, out_bank);
+        uint32_t t8 = DWT->CYCCNT;
+        irq_unlock(key);
+        for (uint8_t k = 0; k < NB; k++) {
+            diff_biquad = fmaxf(diff_biquad, fabsf(out_lib[k] - out_bank[k]));
+        }
+
+        cycles[0] += t1 - t0;
+        cycles[1] += t2 - t1;
+        cycles[2] += t4 - t3;
+        cycles[3] += t5 - t4;
+        cycles[4] += t7 - t6;
+        cycles[5] += t8 - t7;
+    }
+
+    printk("  N=%u | PI %4u | PiBank %4u | PR %4u | PrBank %4u | max diff %f %f\n", NB,
+           cycles[0] / CONTROLLER_BENCH_NB - overhead,
+           cycles[1] / CONTROLLER_BENCH_NB - overhead,
+           cycles[2] / CONTROLLER_BENCH_NB - overhead,
+           cycles[3] / CONTROLLER_BENCH_NB - overhead, diff_pi, diff_pr);
+    printk("      | Biquad x2 %4u | BiquadBank %4u | max diff %f\n",
+           cycles[4] / CONTROLLER_BENCH_NB - overhead,
+           cycles[5] / CONTROLLER_BENCH_NB - overhead, diff_biquad);
+}
+
+void controller_benchmark()
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    uint32_t overhead = UINT32_MAX;
+    for (uint8_t k = 0; k < 16; k++) {
+        uint32_t t0 = DWT->CYCCNT;
+        uint32_t t1 = DWT->CYCCNT;
+        overhead = (t1 - t0) < overhead ? (t1 - t0) : overhead;
+    }
+
+    printk("controllers [cycles/tick], %u ticks:\n", CONTROLLER_BENCH_NB);
+    bench_bank<1>(overhead);
+    bench_bank<2>(overhead);
+    bench_bank<4>(overhead);
+    bench_bank<8>(overhead);
+}
+
 //--------------LOOP FUNCTIONS--------------------------------
 
 void loop_communication_task()
@@ -139,6 +291,8 @@ void loop_communication_task()
             printk("|     press p : power mode               |\n");
             printk("|     press u : voltage reference UP     |\n");
             printk("|     press d : voltage reference DOWN   |\n");
+            printk("|     press s : current sharing state    |\n");
+            printk("|     press c : controller benchmark     |\n");
             printk("|________________________________________|\n\n");
             //------------------------------------------------------
             break;
@@ -156,6 +310,19 @@ void loop_communication_task()
         case 'd':
             voltage_reference -= 0.5;
             break;
+        case 's':
+            for (uint8_t k = 0; k < NB_PHASES; k++) {
+                printk("phase %u: %u deg, %f A, trim %f\n", k, sharing.phaseShift(k),
+                       meas.*phase_currents[k], sharing.getTrim(k));
+            }
+            break;
+        case 'c':
+            if (mode == IDLEMODE) {
+                controller_benchmark();
+            } else {
+                printk("benchmark in idle mode only\n");
+            }
+            break;
         default:
             break;
         }
@@ -177,12 +344,12 @@ void loop_application_task()
     {
         spin.led.turnOn();
 
-        printk("%f:", I1_low_value);
-        printk("%f:", V1_low_value);
-        printk("%f:", I2_low_value);
-        printk("%f:", V2_low_value);
-        printk("%f:", I_high);
-        printk("%f\n", V_high);
+        printk("%f:", meas.I1_low);
+        printk("%f:", meas.V1_low);
+        printk("%f:", meas.I2_low);
+        printk("%f:", meas.V2_low);
+        printk("%f:", meas.I_high);
+        printk("%f\n", meas.V_high);
     }
     task.suspendBackgroundMs(100);
 }
@@ -195,31 +362,7 @@ void loop_application_task()
  */
 void loop_critical_task()
 {
-    meas_data = data.getLatest(I1_LOW);
-    if (meas_data < 10000 && meas_data > -10000)
-        I1_low_value = meas_data;
-
-    meas_data = data.getLatest(V1_LOW);
-    if (meas_data != -10000)
-        V1_low_value = meas_data;
-
-    meas_data = data.getLatest(V2_LOW);
-    if (meas_data != -10000)
-        V2_low_value = meas_data;
-
-    meas_data = data.getLatest(I2_LOW);
-    if (meas_data < 10000 && meas_data > -10000)
-        I2_low_value = meas_data;
-
-    meas_data = data.getLatest(I_HIGH);
-    if (meas_data < 10000 && meas_data > -10000)
-        I_high = meas_data;
-
-    meas_data = data.getLatest(V_HIGH);
-    if (meas_data != -10000)
-        V_high = meas_data;
-
-
+    measures.acquire(meas);
 
     if (mode == IDLEMODE)
     {
@@ -228,11 +371,23 @@ void loop_critical_task()
             twist.stopAll();
         }
         pwm_enable = false;
+        sharing.reset();
     }
     else if (mode == POWERMODE)
     {
-        duty_cycle = pid.calculateWithReturn(voltage_reference, V1_low_value);
+        duty_cycle = pid.calculateWithReturn(voltage_reference, meas.V1_low);
+#ifdef CURRENT_SHARING
+        float32_t current[NB_PHASES];
+        for (uint8_t k = 0; k < NB_PHASES; k++) {
+            current[k] = meas.*phase_currents[k];
+        }
+        sharing.calculate(duty_cycle, current, phase_duty);
+        for (uint8_t k = 0; k < NB_PHASES; k++) {
+            twist.setLegDutyCycle(phase_legs[k], phase_duty[k]);
+        }
+#else
         twist.setAllDutyCycle(duty_cycle);
+#endif
 
         /* Set POWER ON */
         if (!pwm_enable)
@@ -40,14 +40,61 @@
 #include "trigo.h"
 #include "pr.h"
 #include "ScopeMimicry.h"
+#include "scope_stream.h"
+#include "task_profiler.h"
+#include "quadrature_oscillator.h"
+#include "rs485_frame.h"
+#include "tdma_scheduler.h"
+#include "node_config.h"
+
+enum board_role
+{
+    ROLE_SERVER = 0, // voltage source, sends the references
+    ROLE_CLIENT,     // current source, follows the SERVER
+};
 
-#define SERVER      // Role : SERVER or CLIENT 
+/* Configuration of the board, kept in flash: the same firmware is flashed
+ * on all the boards, the role and the address are set from the serial
+ * menu (c) */
+struct ac_client_server_config
+{
+    uint8_t role;           // board_role
+    uint8_t client_address; // address of this CLIENT, from 1 to nb_clients
+    uint8_t nb_clients;     // clients on the bus, one TDMA slot each (SERVER)
+    float32_t Vgrid_amplitude; // [V] (SERVER)
+    float32_t Kp_v;         // voltage PR (SERVER)
+    float32_t Kr_v;
+    float32_t Kp_i;         // current PR (CLIENT)
+    float32_t Kr_i;
+};
 
-#ifdef SERVER
-#define STR_ROLE "SERVER"
-#else
-#define STR_ROLE "CLIENT"
-#endif
+#define AC_CLIENT_SERVER_CONFIG_VERSION 1
+static const ac_client_server_config config_defaults = {
+    ROLE_SERVER, // role
+    1,           // client_address
+    1,           // nb_clients
+    12.0F,       // Vgrid_amplitude
+    0.02F,       // Kp_v
+    4000.0F,     // Kr_v
+    0.2F,        // Kp_i
+    3000.0F,     // Kr_i
+};
+static const config_field config_fields[] = {
+    CONFIG_U8(ac_client_server_config, role, ROLE_SERVER, ROLE_CLIENT, true),
+    CONFIG_U8(ac_client_server_config, client_address, TDMA_FIRST_CLIENT, TDMA_MAX_CLIENTS, true),
+    CONFIG_U8(ac_client_server_config, nb_clients, 1, TDMA_MAX_CLIENTS, true),
+    CONFIG_FLOAT(ac_client_server_config, Vgrid_amplitude, 0.0F, 30.0F, false),
+    CONFIG_FLOAT(ac_client_server_config, Kp_v, 0.0F, 10.0F, false),
+    CONFIG_FLOAT(ac_client_server_config, Kr_v, 0.0F, 100000.0F, false),
+    CONFIG_FLOAT(ac_client_server_config, Kp_i, 0.0F, 10.0F, false),
+    CONFIG_FLOAT(ac_client_server_config, Kr_i, 0.0F, 100000.0F, false),
+};
+static NodeConfig<ac_client_server_config> config("ac_cs", AC_CLIENT_SERVER_CONFIG_VERSION,
+                                                  config_defaults, config_fields,
+                                                  ARRAY_SIZE(config_fields));
+static uint8_t role = ROLE_SERVER;  // read from the configuration at start only
+static uint8_t node_address;        // on the RS485
+static uint8_t nb_clients = 1;
 //--------------SETUP FUNCTIONS DECLARATION-------------------
 void setup_routine(); // Setups the hardware and software of the system
 
@@ -84,42 +131,58 @@ static const float f0 = 50;
 //------------- PR RESONANT -------------------------------------
 static float32_t w0 = 2 * PI *f0;
 static float32_t Ts = control_task_period * 1.0e-6f;
-#ifdef SERVER
-static float angle = 0;
-static float32_t Vgrid_amplitude = 12.0; 
+// SERVER
+static QuadratureOscillator oscillator(Ts, w0); // sin(w0.t)
 static float32_t k_gain = 1.0;
+static Pr pr_voltage; // gains in the configuration
 
-static Pr pr_voltage;
-static float32_t Kp_v = 0.02F;
-static float32_t Kr_v = 4000.0F;
-static PrParams pr_voltage_params(Ts, Kp_v, Kr_v, w0, 0.0, -Udc, Udc);
-#else 
-static float32_t Kp_i = 0.2;
-static float32_t Kr_i = 3000.0;
-static Pr pr_current;
-static PrParams pr_current_params(Ts, Kp_i, Kr_i, w0, 0.0, -Udc, Udc);
+// CLIENT
+static Pr pr_current; // gains in the configuration
 static float32_t pr_value;
-#endif
 
-struct consigne_struct
+/* RS485 messages, see rs485_frame.h */
+#define SERVER_ADDRESS 0
+
+enum microgrid_message // types of the messages sharing the link
+{
+    MSG_REFERENCES = 1, // references from the SERVER
+    MSG_TELEMETRY,      // measures of a CLIENT, in its slot
+};
+
+enum microgrid_status // status in the references
+{
+    STATUS_IDLE = 0,
+    STATUS_POWER,
+    STATUS_START, // first frames of the power mode
+};
+
+struct references_msg
 {
     float32_t Vref_fromSERVER;
     float32_t Iref_fromSERVER;
     float32_t w0_fromSERVER;
-    uint8_t id_and_status; // Contains status
+    uint8_t status;
+    uint8_t slot; // address of the CLIENT replying in this tick
 };
 
-static struct consigne_struct tx_consigne;
-static struct consigne_struct rx_consigne;
-static uint8_t* buffer_tx = (uint8_t*)&tx_consigne;
-static uint8_t* buffer_rx =(uint8_t*)&rx_consigne;
-#ifndef SERVER
-static uint8_t status;
-#endif
+struct telemetry_msg
+{
+    float32_t I1_low;
+    float32_t V1_low;
+    float32_t duty_cycle;
+    uint8_t mode;
+};
+
+static Rs485Link link; // frames written and read in the DMA buffers
+static TdmaScheduler tdma; // slot of the CLIENT replying at each tick (SERVER)
+static telemetry_msg clients_telemetry[TDMA_MAX_CLIENTS];
+static uint8_t status; // from the SERVER (CLIENT)
 static uint32_t critical_task_counter;
 
 static ScopeMimicry scope(1024, 6); // 6 channels with 1024 datas.
+static ScopeStream scope_stream; // send the records in binary frames
 static bool is_downloading;
+static TaskProfiler profiler; // execution time and jitter of the critical task
 static uint32_t counter;
 
 // used with ScopeMimicry
@@ -127,21 +190,6 @@ bool a_trigger() {
     return true;
 }
 
-void dump_scope_datas(ScopeMimicry &scope)  {
-    uint8_t *buffer = scope.get_buffer();
-    uint16_t buffer_size = scope.get_buffer_size() >> 2; // we divide by 4 (4 bytes per float data) 
-    printk("begin record\n");
-    printk("#");
-    for (uint16_t k=0;k < scope.get_nb_channel(); k++) {
-        printk("%s,", scope.get_channel_name(k));
-    }
-    printk("\n");
-    for (uint16_t k=0;k < buffer_size; k++) {
-        printk("%08x\n", *((uint32_t *)buffer + k));
-        task.suspendBackgroundUs(100);
-    }
-    printk("end record\n");
-}
 
 //---------------------------------------------------------------
 
@@ -157,19 +205,48 @@ uint8_t mode = IDLEMODE;
 
 void reception_function(void)
 {
-#ifdef CLIENT
-    if (rx_consigne.id_and_status >> 6 == 1)
+    if (role == ROLE_SERVER)
+    {
+        if (link.receive() == MSG_TELEMETRY && tdma.endSlot(link.getSource()))
+        {
+            clients_telemetry[link.getSource() - TDMA_FIRST_CLIENT] = link.rxPayload<telemetry_msg>();
+        }
+    }
+    else if (link.receive() == MSG_REFERENCES)
     {
-        status = rx_consigne.id_and_status;
+        const references_msg &rx_references = link.rxPayload<references_msg>();
+        status = rx_references.status;
 
-        if ((rx_consigne.id_and_status & 2) == 1)
+        if (status == STATUS_START)
             counter = 0;
 
-        Iref = rx_consigne.Iref_fromSERVER;
-        Vgrid = rx_consigne.Vref_fromSERVER;
-        w0 = rx_consigne.w0_fromSERVER;
+        Iref = rx_references.Iref_fromSERVER;
+        Vgrid = rx_references.Vref_fromSERVER;
+        w0 = rx_references.w0_fromSERVER;
+
+        if (rx_references.slot == node_address)
+        { // our slot: reply at once, before the next broadcast
+            telemetry_msg &tx_telemetry = link.txPayload<telemetry_msg>(MSG_TELEMETRY, SERVER_ADDRESS);
+            tx_telemetry.I1_low = I1_low_value;
+            tx_telemetry.V1_low = V1_low_value;
+            tx_telemetry.duty_cycle = duty_cycle;
+            tx_telemetry.mode = mode;
+            link.send();
+        }
+    }
+}
+
+/* gains of the configuration, at start and after an edit in idle */
+void apply_config()
+{
+    const ac_client_server_config &c = config.values;
+    if (role == ROLE_SERVER) {
+        PrParams pr_voltage_params(Ts, c.Kp_v, c.Kr_v, w0, 0.0, -Udc, Udc);
+        pr_voltage.init(pr_voltage_params);
+    } else {
+        PrParams pr_current_params(Ts, c.Kp_i, c.Kr_i, w0, 0.0, -Udc, Udc);
+        pr_current.init(pr_current_params);
     }
-#endif
 }
 
 /**
@@ -184,23 +261,28 @@ void setup_routine()
     spin.version.setBoardVersion(SPIN_v_1_0);
     twist.setVersion(shield_TWIST_V1_3);
 
+    // role and gains of this board, from the flash
+    int config_status = config.load();
+    printk("configuration %s\n", config_status == NODE_CONFIG_LOADED ? "loaded" : "by default");
+    role = config.values.role;
+    node_address = role == ROLE_SERVER ? SERVER_ADDRESS : config.values.client_address;
+    nb_clients = config.values.nb_clients;
+
     data.enableTwistDefaultChannels();
 
     /* buck voltage mode */
     twist.initLegBuck(LEG1);
     twist.initLegBoost(LEG2);
 
-    communication.rs485.configure(buffer_tx, buffer_rx, sizeof(consigne_struct), reception_function, SPEED_20M); // custom configuration for RS485
+    link.init(node_address, reception_function, SPEED_20M); // custom configuration for RS485
 
-#ifdef SERVER
-    communication.sync.initMaster(); // start the synchronisation
-    pr_voltage.init(pr_voltage_params);
-#endif
-
-#ifndef SERVER
-    pr_current.init(pr_current_params);
-    communication.sync.initSlave(TWIST_v_1_1_4);
-#endif
+    apply_config();
+    if (role == ROLE_SERVER) {
+        communication.sync.initMaster(); // start the synchronisation
+        tdma.init(nb_clients, control_task_period, 20000000);
+    } else {
+        communication.sync.initSlave(TWIST_v_1_1_4);
+    }
 
     scope.connectChannel(I1_low_value, "I_low");
     scope.connectChannel(V1_low_value, "V_low");
@@ -211,6 +293,7 @@ void setup_routine()
     scope.set_trigger(a_trigger);
     scope.set_delay(0.0F);
     scope.start();
+    scope_stream.init();
     // Then declare tasks
     uint32_t app_task_number = task.createBackground(loop_application_task);
     uint32_t com_task_number = task.createBackground(loop_communication_task);
@@ -219,6 +302,7 @@ void setup_routine()
     // Finally, start tasks
     task.startBackground(app_task_number);
     task.startBackground(com_task_number);
+    profiler.init(control_task_period);
     task.startCritical(); // Uncomment if you use the critical task
 }
 
@@ -234,9 +318,14 @@ void loop_communication_task()
         case 'h':
             //----------SERIAL INTERFACE MENU-----------------------
             printk(" ________________________________________\n");
-            printk("|     ----AC client/server: %s ---       |\n", STR_ROLE);
+            printk("|     ----AC client/server: %s ---       |\n",
+                   role == ROLE_SERVER ? "SERVER" : "CLIENT");
             printk("|     press i : idle mode                |\n");
             printk("|     press p : power mode               |\n");
+            printk("|     press t : critical task timing     |\n");
+            if (role == ROLE_SERVER)
+                printk("|     press s : TDMA slots and bus load  |\n");
+            printk("|     press c : configuration (idle)     |\n");
             printk("|________________________________________|\n\n");
             //------------------------------------------------------
             break;
@@ -254,16 +343,34 @@ void loop_communication_task()
                 mode = POWERMODE;
             }
             break;
-#ifdef SERVER
         case 'l':
-            k_gain += 0.1;
+            if (role == ROLE_SERVER)
+                k_gain += 0.1;
             break;
         case 'm':
-            k_gain -= 0.1;
+            if (role == ROLE_SERVER)
+                k_gain -= 0.1;
+            break;
+        case 's':
+            if (role == ROLE_SERVER)
+                tdma.requestReport();
+            break;
+        case 'c':
+            if (mode == IDLEMODE && !is_downloading) {
+                if (config.edit())
+                    apply_config();
+            } else {
+                printk("configuration in idle mode only\n");
+            }
+            break;
+        case 't':
+            profiler.requestReport();
             break;
-#endif
         case 'r':
-            is_downloading = true;
+            if (!is_downloading) {
+                scope_stream.begin(scope, 1, control_task_period);
+                is_downloading = true;
+            }
             break;
         default:
             break;
@@ -279,19 +386,31 @@ void loop_communication_task()
  */
 void loop_application_task()
 {
-    if (mode == IDLEMODE) {
-        if (is_downloading)
+    if (is_downloading)
+    {
+        is_downloading = scope_stream.poll();
+        task.suspendBackgroundMs(1);
+        return;
+    }
+
+    profiler.printReport();
+    if (role == ROLE_SERVER && tdma.printReport())
+    {
+        for (uint8_t k = 0; k < nb_clients; k++)
         {
-            dump_scope_datas(scope);
-            is_downloading = false;
+            printk("  client %u: mode %u I1_low %f V1_low %f duty_cycle %f\n",
+                   TDMA_FIRST_CLIENT + k, clients_telemetry[k].mode, clients_telemetry[k].I1_low,
+                   clients_telemetry[k].V1_low, clients_telemetry[k].duty_cycle);
         }
     }
-    else if (mode == POWERMODE)
+
+    if (mode == POWERMODE)
     {
-#ifndef SERVER
-        printk("%i:", status);
-        printk("%f:", Iref);
-#endif
+        if (role == ROLE_CLIENT)
+        {
+            printk("%i:", status);
+            printk("%f:", Iref);
+        }
         printk("%f:", duty_cycle);
         printk("%f:", Vgrid);
         printk("%f:", I2_low_value);
@@ -309,6 +428,7 @@ void loop_application_task()
  */
 void loop_critical_task()
 {
+    profiler.start();
 
     meas_data = data.getLatest(I1_LOW);
     if (meas_data < 10000 && meas_data > -10000)
@@ -330,92 +450,91 @@ void loop_critical_task()
     if (meas_data != -10000)
         V_high = meas_data;
 
-#ifdef SERVER
-
-    if (mode == IDLEMODE)
+    if (role == ROLE_SERVER)
     {
-        if (pwm_enable == true)
+        if (mode == IDLEMODE)
         {
-            twist.stopAll();
-            spin.led.turnOff();
-            k_gain = 1.0;
-            tx_consigne.id_and_status = (1 << 6) + 0;
-            communication.rs485.startTransmission();
-        }
+            if (pwm_enable == true)
+            {
+                twist.stopAll();
+                spin.led.turnOff();
+                k_gain = 1.0;
+                references_msg &tx_references = link.txPayload<references_msg>(MSG_REFERENCES, RS485_BROADCAST);
+                tx_references.status = STATUS_IDLE;
+                tx_references.slot = tdma.beginSlot();
+                link.send();
+            }
 
-        pwm_enable = false;
-    }
-    else if (mode == POWERMODE)
-    {
-        /* Set POWER ON */
+            pwm_enable = false;
+        }
+        else if (mode == POWERMODE)
+        {
+            /* Set POWER ON */
 
-        angle += w0 * Ts;
-        angle = ot_modulo_2pi(angle);
+            oscillator.calculate();
 
-        Vgrid = Vgrid_amplitude * ot_sin(angle);
-        duty_cycle = 0.5 + pr_voltage.calculateWithReturn(Vgrid, V1_low_value - V2_low_value) / (2.0 * Udc);
+            Vgrid = config.values.Vgrid_amplitude * oscillator.getSin();
+            duty_cycle = 0.5 + pr_voltage.calculateWithReturn(Vgrid, V1_low_value - V2_low_value) / (2.0 * Udc);
 
-        twist.setAllDutyCycle(duty_cycle);
+            twist.setAllDutyCycle(duty_cycle);
 
-        if (counter == 0)
-            tx_consigne.id_and_status = (1 << 6) + 2;
-        else
-            tx_consigne.id_and_status = (1 << 6) + 1;
+            references_msg &tx_references = link.txPayload<references_msg>(MSG_REFERENCES, RS485_BROADCAST);
+            if (counter == 0)
+                tx_references.status = STATUS_START;
+            else
+                tx_references.status = STATUS_POWER;
 
-        Iref = k_gain * I1_low_value;
-        tx_consigne.Vref_fromSERVER = Vgrid;
-        tx_consigne.Iref_fromSERVER = Iref;
-        tx_consigne.w0_fromSERVER = w0;
+            Iref = k_gain * I1_low_value;
+            tx_references.Vref_fromSERVER = Vgrid;
+            tx_references.Iref_fromSERVER = Iref;
+            tx_references.w0_fromSERVER = w0;
+            tx_references.slot = tdma.beginSlot();
 
-        communication.rs485.startTransmission();
+            link.send();
 
-        scope.acquire();
+            scope.acquire();
 
-        if (!pwm_enable)
-        {
-            pwm_enable = true;
-            spin.led.turnOn();
-            twist.startAll();
+            if (!pwm_enable)
+            {
+                pwm_enable = true;
+                spin.led.turnOn();
+                twist.startAll();
+            }
         }
     }
-
-#endif
-
-    ////
-#ifndef SERVER ////// CLIENT
-
-    if ((((status & 0x3) == 1 || (status & 0x3) == 2)))
+    else // CLIENT
     {
-        mode = POWERMODE;
-        pr_value = pr_current.calculateWithReturn(Iref, I1_low_value);
-        duty_cycle = (Vgrid + pr_value )/(2*Udc) + 0.5;
+        if (status == STATUS_POWER || status == STATUS_START)
+        {
+            mode = POWERMODE;
+            pr_value = pr_current.calculateWithReturn(Iref, I1_low_value);
+            duty_cycle = (Vgrid + pr_value )/(2*Udc) + 0.5;
 
-        twist.setAllDutyCycle(duty_cycle);
+            twist.setAllDutyCycle(duty_cycle);
 
-        if (!pwm_enable)
-        {
-            pwm_enable = true;
-            spin.led.turnOn();
-            twist.startAll();
-        }
+            if (!pwm_enable)
+            {
+                pwm_enable = true;
+                spin.led.turnOn();
+                twist.startAll();
+            }
 
-        scope.acquire();
-    }
-    else
-    {
-        mode = IDLEMODE;
-        if (pwm_enable == true)
+            scope.acquire();
+        }
+        else
         {
-            twist.stopAll();
-            spin.led.turnOff();
-            pwm_enable = false;
+            mode = IDLEMODE;
+            if (pwm_enable == true)
+            {
+                twist.stopAll();
+                spin.led.turnOff();
+                pwm_enable = false;
+            }
         }
     }
+    critical_task_counter++;
 
-
-#endif
-critical_task_counter++;
-
+    profiler.stop();
 }
 
 /**
@@ -0,0 +1,228 @@
+/*
+ * Copyright (c) 2021-2024 LAAS-CNRS
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published by
+ *   the Free Software Foundation, either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGLPV2.1
+ */
+
+/**
+ * @brief  Time slotted (TDMA) scheduling of the RS485 link of a microgrid.
+ *
+ *         The critical tasks of all the nodes start together, they are
+ *         synchronised by `communication.sync.initMaster()` on the server
+ *         and `communication.sync.initSlave()` on the clients. A slot is
+ *         one period of the critical task:
+ *
+ *             tick k    | broadcast (slot 1) | reply of client 1 |   ...   |
+ *             tick k+1  | broadcast (slot 2) | reply of client 2 |   ...   |
+ *
+ *         At the start of each tick the server broadcasts the references to
+ *         all the clients, with the address of the client owning the slot.
+ *         This client replies with its telemetry as soon as the broadcast is
+ *         received, the other ones only apply the references, so the replies
+ *         never collide. With N clients the references reach every client at
+ *         each tick and the telemetry of a client is refreshed every N ticks.
+ *
+ *         The server measures for each client, with the DWT cycle counter,
+ *         the time between the start of its broadcast and the reception of
+ *         the reply, the bus time used by a slot. It also counts the slots
+ *         without reply and the longest time between two replies of a
+ *         client, the age of its telemetry. Only the configured clients are
+ *         measured, nothing is extrapolated to other numbers of clients.
+ */
+
+#ifndef TDMA_SCHEDULER_H_
+#define TDMA_SCHEDULER_H_
+
+#include <soc.h> // DWT cycle counter and SystemCoreClock
+
+#include "zephyr/kernel.h"
+#include "rs485_frame.h"
+
+#define TDMA_MAX_CLIENTS 8
+#define TDMA_FIRST_CLIENT 1 // address of the first client
+#define TDMA_BITS_PER_BYTE 10 // start and stop bits
+
+struct tdma_stats // of the slots of one client
+{
+    uint32_t nb_slots;
+    uint32_t nb_replies;
+    uint32_t rtt_min;  // [cycles] broadcast start to reply received
+    uint32_t rtt_max;  // [cycles]
+    uint64_t rtt_sum;  // [cycles]
+    uint32_t last_reply; // [ticks] tick of the last reply
+    uint32_t age_max;    // [ticks] longest time between two replies
+};
+
+class TdmaScheduler
+{
+public:
+    /**
+     * @param nb_clients number of clients, addresses from TDMA_FIRST_CLIENT.
+     * @param period_us  [us] period of the critical task, length of a slot.
+     * @param bit_rate   [bit/s] speed of the RS485.
+     */
+    void init(uint8_t nb_clients, uint32_t period_us, uint32_t bit_rate)
+    {
+        CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+        DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+        this->nb_clients = nb_clients > TDMA_MAX_CLIENTS ? TDMA_MAX_CLIENTS : nb_clients;
+        this->period_us = period_us;
+        this->bit_rate = bit_rate;
+        cycles_per_us = SystemCoreClock / 1000000;
+        slot = 0;
+        tick = 0;
+        report_start = 0;
+        replied = true;
+        clearAll();
+    }
+
+    /**
+     * @brief server: open the slot of the next client, to be called in the
+     * critical task just before the broadcast.
+     *
+     * @return the address of the client owning the slot.
+     */
+    uint8_t beginSlot()
+    {
+        tick++;
+        if (report_asked) {
+            for (uint8_t k = 0; k < nb_clients; k++) {
+                report[k] = stats[k];
+                updateAge(report[k]); // the time since the last reply counts
+            }
+            clearAll();
+            report_ticks = tick - report_start;
+            report_start = tick;
+            report_asked = false;
+            report_ready = true;
+        }
+        slot = slot + 1 >= nb_clients ? 0 : slot + 1;
+        stats[slot].nb_slots++;
+        replied = false;
+        slot_start = DWT->CYCCNT;
+        return TDMA_FIRST_CLIENT + slot;
+    }
+
+    /**
+     * @brief server: a reply is received, to be called in the reception
+     * callback.
+     *
+     * @return false if it does not come from the owner of the slot.
+     */
+    bool endSlot(uint8_t src)
+    {
+        if (replied || src != TDMA_FIRST_CLIENT + slot) {
+            return false;
+        }
+        uint32_t rtt = DWT->CYCCNT - slot_start;
+        tdma_stats &s = stats[slot];
+        replied = true;
+        s.nb_replies++;
+        s.rtt_sum += rtt;
+        if (rtt < s.rtt_min) {
+            s.rtt_min = rtt;
+        }
+        if (rtt > s.rtt_max) {
+            s.rtt_max = rtt;
+        }
+        updateAge(s);
+        s.last_reply = tick;
+        return true;
+    }
+
+    /**
+     * @brief ask the critical task for the statistics, see `printReport()`.
+     */
+    void requestReport()
+    {
+        report_ready = false;
+        report_asked = true;
+    }
+
+    /**
+     * @brief print the statistics of the slots of each client since the
+     * previous report, once copied by the critical task.
+     *
+     * The bus load is the mean time of the slots of a client over the period
+     * of the critical task, the age of the telemetry the longest time
+     * between two of its replies.
+     *
+     * @return true if the report was printed.
+     */
+    bool printReport()
+    {
+        if (!report_ready) {
+            return false;
+        }
+        report_ready = false;
+
+        const float32_t us = 1.0F / (float32_t) cycles_per_us;
+        const float32_t frame_us = (float32_t) (sizeof(rs485_frame) * TDMA_BITS_PER_BYTE)
+                                 * 1e6F / (float32_t) bit_rate;
+        printk("TDMA: %u clients, %u ticks of %u us, frame %u bytes: %.2f us\n",
+               nb_clients, report_ticks, period_us, (uint32_t) sizeof(rs485_frame), frame_us);
+        printk("  client | slots | replies | missed | slot min/mean/max [us] | bus load | "
+               "telemetry age max\n");
+        for (uint8_t k = 0; k < nb_clients; k++) {
+            const tdma_stats &r = report[k];
+            float32_t mean = r.nb_replies ? (float32_t) (r.rtt_sum / r.nb_replies) * us : 0.0F;
+            printk("  %6u | %5u | %7u | %6u | %6.2f %6.2f %6.2f | %6.1f %% | %10u us\n",
+                   TDMA_FIRST_CLIENT + k, r.nb_slots, r.nb_replies, r.nb_slots - r.nb_replies,
+                   r.nb_replies ? r.rtt_min * us : 0.0F, mean, r.rtt_max * us,
+                   100.0F * mean / (float32_t) period_us, r.age_max * period_us);
+        }
+        return true;
+    }
+
+private:
+    void clearAll()
+    {
+        for (uint8_t k = 0; k < TDMA_MAX_CLIENTS; k++) {
+            tdma_stats &s = stats[k];
+            s.nb_slots = 0;
+            s.nb_replies = 0;
+            s.rtt_min = UINT32_MAX;
+            s.rtt_max = 0;
+            s.rtt_sum = 0;
+            s.last_reply = tick;
+            s.age_max = 0;
+        }
+    }
+
+    void updateAge(tdma_stats &s)
+    {
+        uint32_t age = tick - s.last_reply;
+        s.age_max = age > s.age_max ? age : s.age_max;
+    }
+
+    uint8_t nb_clients;
+    uint32_t period_us;
+    uint32_t bit_rate;
+    uint32_t cycles_per_us;
+    uint8_t slot;         // index of the client owning the slot
+    bool replied;         // the owner of the slot replied
+    uint32_t slot_start;  // [cycles]
+    uint32_t tick;        // number of slots since init()
+    uint32_t report_start = 0; // [ticks] tick of the previous report
+    uint32_t report_ticks = 0; // [ticks] covered by the report
+    tdma_stats stats[TDMA_MAX_CLIENTS];
+    tdma_stats report[TDMA_MAX_CLIENTS];
+    volatile bool report_asked = false;
+    volatile bool report_ready = false;
+};
+
+#endif // TDMA_SCHEDULER_H_
@@ -41,15 +41,59 @@
 #include "pid.h"
 #include "pr.h"
 #include "ScopeMimicry.h"
+#include "scope_stream.h"
+#include "task_profiler.h"
+#include "quadrature_oscillator.h"
+#include "rs485_frame.h"
+#include "sync_references.h"
+#include "node_config.h"
 #include "zephyr/console/console.h"
 
-#define SERVER      // Role : SERVER or CLIENT 
+#define REF_APPLY_DELAY 2 // [ticks] the references of tick k are applied on tick k + 2
+// #define CLIENT_ANGLE_FROM_SERVER // the CLIENT current follows the angle of the SERVER, not the measured voltage
 
-#ifdef SERVER
-#define ROLE_TXT "SERVER"
-#else
-#define ROLE_TXT "CLIENT"
-#endif
+enum board_role
+{
+    ROLE_SERVER = 0, // voltage source, sends the references
+    ROLE_CLIENT,     // draws P_ref from the grid of the SERVER
+};
+
+/* Configuration of the board, kept in flash: the same firmware is flashed
+ * on both boards, the role is set from the serial menu (c) */
+struct peer_to_peer_config
+{
+    uint8_t role;      // board_role
+    float32_t P_ref;   // [W] power sent to the CLIENT (SERVER)
+    float32_t Vac_ref; // [V] amplitude of the grid (SERVER)
+    float32_t Kp;      // PI of the DC voltage (CLIENT)
+    float32_t Ti;      // (Kp/Ki = Ti)
+    float32_t Kp_pr;   // PR of the current (CLIENT)
+    float32_t Kr;
+};
+
+#define PEER_TO_PEER_CONFIG_VERSION 1
+static const peer_to_peer_config config_defaults = {
+    ROLE_SERVER, // role
+    10.0F,       // P_ref
+    15.0F,       // Vac_ref
+    0.01F,       // Kp
+    0.1F,        // Ti
+    0.2F,        // Kp_pr
+    3000.0F,     // Kr
+};
+static const config_field config_fields[] = {
+    CONFIG_U8(peer_to_peer_config, role, ROLE_SERVER, ROLE_CLIENT, true),
+    CONFIG_FLOAT(peer_to_peer_config, P_ref, 4.0F, 40.0F, false), // V_dc above 20V
+    CONFIG_FLOAT(peer_to_peer_config, Vac_ref, 0.0F, 30.0F, false),
+    CONFIG_FLOAT(peer_to_peer_config, Kp, 0.0F, 10.0F, false),
+    CONFIG_FLOAT(peer_to_peer_config, Ti, 0.0F, 10.0F, false),
+    CONFIG_FLOAT(peer_to_peer_config, Kp_pr, 0.0F, 10.0F, false),
+    CONFIG_FLOAT(peer_to_peer_config, Kr, 0.0F, 100000.0F, false),
+};
+static NodeConfig<peer_to_peer_config> config("p2p", PEER_TO_PEER_CONFIG_VERSION,
+                                              config_defaults, config_fields,
+                                              ARRAY_SIZE(config_fields));
+static uint8_t role = ROLE_SERVER; // read from the configuration at start only
 
 //--------------SETUP FUNCTIONS DECLARATION-------------------
 void setup_routine(); // Setups the hardware and software of the system
@@ -81,54 +125,66 @@ static float32_t duty_cycle;
 /* Sinewave settings */
 static const float f0 = 50.F;
 static const float w0 = 2 * PI * f0;
-#ifdef SERVER
-static float angle = 0;
-static float Vac_ref;
-#endif
 static const float Udc = 50.0;
 static const float32_t Ts = control_task_period * 1e-6F;
+static QuadratureOscillator oscillator(Ts, w0); // sin(w0.t) (SERVER)
+static float Vac_ref;
+static float32_t ref_angle; // [rad] angle of the SERVER voltage (CLIENT_ANGLE_FROM_SERVER)
 /* PEER 2 PEER variables */
 static float32_t I_ac_ref;
-#ifdef CLIENT 
 static float32_t Vac_meas;
 static float32_t gain_current = -0.20;
 
-static const float32_t Kp = 0.01;
-static const float32_t Ti = 0.1;  // (Kp/Ki = Ti)
-static const float32_t Td = 0.0;
+static const float32_t Td = 0.0; // Kp and Ti in the configuration
 static const float32_t N = 0.0;
 static const float32_t upper_bound = 2.0; 
 static const float32_t lower_bound = -2.0;
 static Pid pid_current_control;
-static const PidParams pid_params(Ts, Kp, Ti, Td, N, lower_bound, upper_bound); 
-#endif
-static float32_t P_ref = 10; // 20W power reference from server to client
+static float32_t P_ref; // power reference from server to client
 static const float Rdc = 115;
-static float32_t v_dc_ref = sqrt(P_ref*Rdc); // must be superior to at least 20V
+static float32_t v_dc_ref; // sqrt(P_ref*Rdc), must be superior to at least 20V
 
 
 static ScopeMimicry scope(1024, 9);
+static uint16_t scope_decimation = 1; // SERVER: every control period, CLIENT: every 4
+static ScopeStream scope_stream; // send the records in binary frames
 static bool is_downloading = false;
+static TaskProfiler profiler; // execution time and jitter of the critical task
 //------------- PR RESONANT -------------------------------------
-static const float32_t Kp_pr = 0.2;
-static const float32_t Kr = 3000.0;
 static float32_t pr_upper_bound = 50.0; // assume Udc ~ 50V
 static float32_t pr_lower_bound = -50.0;
-static Pr pr;
-static const PrParams pr_params(Ts, Kp_pr, Kr, w0, 0.0, pr_lower_bound, pr_upper_bound);
+static Pr pr; // gains in the configuration
+
+
 
+/* RS485 messages, see rs485_frame.h */
+#define SERVER_ADDRESS 0
+#define CLIENT_ADDRESS 1
 
+enum microgrid_message // types of the messages sharing the link
+{
+    MSG_REFERENCES = 1, // references from the SERVER
+};
+
+enum microgrid_status // status in the references
+{
+    STATUS_IDLE = 0,
+    STATUS_POWER,
+    STATUS_START, // first frames of the power mode
+};
 
-struct consigne_struct
+struct references_msg
 {
     float32_t P_ref_fromSERVER;
-    uint8_t id_and_status; // Contains status
+    float32_t Vac_ref_fromSERVER;
+    float32_t angle_fromSERVER; // angle of the voltage of the tick
+    uint16_t tick;              // tick of the shared clock
+    uint8_t status;
 };
 
-struct consigne_struct tx_consigne;
-struct consigne_struct rx_consigne;
-uint8_t* buffer_tx = (uint8_t*)&tx_consigne;
-uint8_t* buffer_rx =(uint8_t*)&rx_consigne;
+Rs485Link link; // frames written and read in the DMA buffers
+SyncClock sync_clock; // ticks of the critical task, shared by the nodes
+TimedQueue<references_msg> references_queue; // references waiting for their tick (CLIENT)
 
 extern float frequency;
 
@@ -151,21 +207,6 @@ bool a_trigger() {
     return true;
 }
 
-void dump_scope_datas(ScopeMimicry &scope)  {
-    uint8_t *buffer = scope.get_buffer();
-    uint16_t buffer_size = scope.get_buffer_size() >> 2; // we divide by 4 (4 bytes per float data) 
-    printk("begin record\n");
-    printk("#");
-    for (uint16_t k=0;k < scope.get_nb_channel(); k++) {
-        printk("%s,", scope.get_channel_name(k));
-    }
-    printk("\n");
-    for (uint16_t k=0;k < buffer_size; k++) {
-        printk("%08x\n", *((uint32_t *)buffer + k));
-        task.suspendBackgroundUs(100);
-    }
-    printk("end record\n");
-}
 
 
 
@@ -174,19 +215,29 @@ void dump_scope_datas(ScopeMimicry &scope)  {
 
 void reception_function(void)
 {
-
-#ifdef CLIENT
-    if (rx_consigne.id_and_status >> 6 == 1)
+    if (role == ROLE_CLIENT && link.receive() == MSG_REFERENCES)
     {
-        status = rx_consigne.id_and_status;
-
-        if ((rx_consigne.id_and_status & 2) == 1)
-            scope.start(); 
-
-        P_ref = rx_consigne.P_ref_fromSERVER;
+        const references_msg &rx_references = link.rxPayload<references_msg>();
+        sync_clock.align(rx_references.tick);
+        references_queue.push(rx_references.tick + REF_APPLY_DELAY, sync_clock.now(), rx_references);
+        if (rx_references.status == STATUS_IDLE)
+            sync_clock.resync(); // the offset is taken again at the next start
     }
-#endif
+}
 
+/* gains of the configuration, at start and after an edit in idle */
+void apply_config()
+{
+    const peer_to_peer_config &c = config.values;
+    if (role == ROLE_SERVER) {
+        P_ref = c.P_ref;
+    } else {
+        PidParams pid_params(Ts, c.Kp, c.Ti, Td, N, lower_bound, upper_bound);
+        pid_current_control.init(pid_params);
+        pid_current_control.reset(-gain_current); // output initialisation of the pid.
+    }
+    PrParams pr_params(Ts, c.Kp_pr, c.Kr, w0, 0.0, pr_lower_bound, pr_upper_bound);
+    pr.init(pr_params);
 }
 
 
@@ -205,21 +256,27 @@ void setup_routine()
     spin.version.setBoardVersion(SPIN_v_1_0);
     twist.setVersion(shield_TWIST_V1_3);
 
+    // role and gains of this board, from the flash
+    int config_status = config.load();
+    printk("configuration %s\n", config_status == NODE_CONFIG_LOADED ? "loaded" : "by default");
+    role = config.values.role;
+    scope_decimation = role == ROLE_SERVER ? 1 : 4;
+
     data.enableTwistDefaultChannels();
 
     /* buck voltage mode */
     twist.initLegBuck(LEG1);
     twist.initLegBoost(LEG2);
 
-    communication.rs485.configure(buffer_tx, buffer_rx, sizeof(consigne_struct), reception_function, SPEED_20M); // custom configuration for RS485
+    link.init(role == ROLE_SERVER ? SERVER_ADDRESS : CLIENT_ADDRESS, reception_function,
+              SPEED_20M); // custom configuration for RS485
 
-#ifdef SERVER
-    communication.sync.initMaster(); // start the synchronisation
-#endif
-
-#ifndef SERVER
-    communication.sync.initSlave(TWIST_v_1_1_4);
-#endif
+    if (role == ROLE_SERVER) {
+        communication.sync.initMaster(); // start the synchronisation
+    } else {
+        communication.sync.initSlave(TWIST_v_1_1_4);
+    }
+    apply_config();
 
     // Then declare tasks
     uint32_t app_task_number = task.createBackground(loop_application_task);
@@ -229,13 +286,9 @@ void setup_routine()
     // Finally, start tasks
     task.startBackground(app_task_number);
     task.startBackground(com_task_number);
+    profiler.init(control_task_period);
     task.startCritical(); // Uncomment if you use the critical task
 
-#ifndef SERVER
-    pid_current_control.init(pid_params);
-    pid_current_control.reset(-gain_current); // output initialisation of the pid.
-#endif
-    pr.init(pr_params);
     scope.connectChannel(I1_low_value, "I1_low");
     scope.connectChannel(I2_low_value, "I2_low");
     scope.connectChannel(V1_low_value, "V1_low");
@@ -248,6 +301,7 @@ void setup_routine()
     scope.set_trigger(a_trigger);
     scope.set_delay(0.0F);
     scope.start();
+    scope_stream.init();
     I_ac_ref = 0.0;
     v_dc_ref = 0.0;
 
@@ -265,9 +319,12 @@ void loop_communication_task()
         case 'h':
             //----------SERIAL INTERFACE MENU-----------------------
             printk(" ________________________________________\n");
-            printk("      ------ MENU :%s             \n", ROLE_TXT);
+            printk("      ------ MENU :%s             \n",
+                   role == ROLE_SERVER ? "SERVER" : "CLIENT");
             printk("|     press i : idle mode                |\n");
             printk("|     press p : power mode               |\n");
+            printk("|     press t : critical task timing     |\n");
+            printk("|     press c : configuration (idle)     |\n");
             printk("|________________________________________|\n\n");
             //------------------------------------------------------
             break;
@@ -283,8 +340,22 @@ void loop_communication_task()
             printk("power mode\n");
             mode = POWERMODE;
             break;
+        case 't':
+            profiler.requestReport();
+            break;
+        case 'c':
+            if (mode == IDLEMODE && !is_downloading) {
+                if (config.edit())
+                    apply_config();
+            } else {
+                printk("configuration in idle mode only\n");
+            }
+            break;
         case 'r':
-            is_downloading = true;
+            if (!is_downloading) {
+                scope_stream.begin(scope, scope_decimation, control_task_period);
+                is_downloading = true;
+            }
             break;
         default:
             break;
@@ -299,28 +370,35 @@ void loop_communication_task()
  */
 void loop_application_task()
 {
-    if (mode == IDLEMODE)
+    if (is_downloading)
     {
-        spin.led.turnOff();
-        if (is_downloading) {
-            dump_scope_datas(scope);
-        }
-        is_downloading = false;
+        is_downloading = scope_stream.poll();
+        task.suspendBackgroundMs(1);
+        return;
+    }
 
+    profiler.printReport();
 
+    if (mode == IDLEMODE)
+    {
+        spin.led.turnOff();
     }
     else if (mode == POWERMODE)
     {
         spin.led.turnOn();
 
-#ifndef SERVER
-        printk("%i:", status);
-        printk("%f:", v_dc_ref);
-        printk("%f:", duty_cycle);
-        printk("%f:", I2_low_value);
-        printk("%f:", I1_low_value);
-        printk("%f:\n", V1_low_value);
-#endif
+        if (role == ROLE_CLIENT)
+        {
+            printk("%i:", status);
+            printk("%f:", v_dc_ref);
+            printk("%f:", duty_cycle);
+            printk("%f:", I2_low_value);
+            printk("%f:", I1_low_value);
+            printk("%f:", V1_low_value);
+            printk("%u:", references_queue.getNbLate());
+            printk("%u:", sync_clock.getNbResync());
+            printk("%u:\n", sync_clock.getMaxLatency());
+        }
     }
     task.suspendBackgroundMs(100);
 }
@@ -333,6 +411,9 @@ void loop_application_task()
  */
 void loop_critical_task()
 {
+    profiler.start();
+    sync_clock.tick();
+
     meas_data = data.getLatest(I1_LOW);
     if (meas_data < 10000 && meas_data > -10000)
         I1_low_value = meas_data;
@@ -358,93 +439,123 @@ void loop_critical_task()
     if (meas_data < 10000 && meas_data > -10000)
         I_high = meas_data;
 
-#ifdef SERVER
-
-    if (mode == IDLEMODE)
+    if (role == ROLE_SERVER)
     {
-        if (pwm_enable == true)
+        if (mode == IDLEMODE)
         {
-            twist.stopAll();
-            tx_consigne.id_and_status = (1 << 6) + 0;
-            communication.rs485.startTransmission();
+            if (pwm_enable == true)
+            {
+                twist.stopAll();
+                references_msg &tx_references = link.txPayload<references_msg>(MSG_REFERENCES, RS485_BROADCAST);
+                tx_references.status = STATUS_IDLE;
+                tx_references.tick = sync_clock.now();
+                link.send();
+            }
+            pwm_enable = false;
         }
-        pwm_enable = false;
-    }
-    else if (mode == POWERMODE)
-    {
-        /* Set POWER ON */
+        else if (mode == POWERMODE)
+        {
+            /* Set POWER ON */
+
+            oscillator.calculate();
+            Vac_ref = config.values.Vac_ref;
+            duty_cycle = 0.5 + Vac_ref * oscillator.getSin() / (2.0 * Udc);
+            twist.setAllDutyCycle(duty_cycle);
+
+            references_msg &tx_references = link.txPayload<references_msg>(MSG_REFERENCES, RS485_BROADCAST);
+            if (record_counter == 0)
+                tx_references.status = STATUS_START;
+            else
+                tx_references.status = STATUS_POWER;
+
+            tx_references.P_ref_fromSERVER = P_ref;
+            tx_references.Vac_ref_fromSERVER = Vac_ref;
+#ifdef CLIENT_ANGLE_FROM_SERVER
+            tx_references.angle_fromSERVER = atan2f(oscillator.getSin(), oscillator.getCos());
+#endif
+            tx_references.tick = sync_clock.now();
 
-        angle += w0 * Ts;
-        angle = ot_modulo_2pi(angle);
-        Vac_ref = 15.0F;
-        duty_cycle = 0.5 + Vac_ref * ot_sin(angle) / (2.0 * Udc);
-        twist.setAllDutyCycle(duty_cycle);
+            link.send();
 
-        if (record_counter == 0)
-            tx_consigne.id_and_status = (1 << 6) + 2;
-        else
-            tx_consigne.id_and_status = (1 << 6) + 1;
+            if (critical_task_counter % scope_decimation == 0)
+            {
+                scope.acquire();
+                record_counter++;
+            }
 
-        tx_consigne.P_ref_fromSERVER = P_ref;
+            if (!pwm_enable)
+            {
+                pwm_enable = true;
+                twist.startAll();
+            }
 
-        communication.rs485.startTransmission();
 
-        if (critical_task_counter % 1 == 0)
-        {
-            scope.acquire();
-            record_counter++;
+            critical_task_counter++;
         }
-
-        if (!pwm_enable)
-        {
-            pwm_enable = true;
-            twist.startAll();
-        }
-
-
-        critical_task_counter++;
     }
-
-#endif
-
-    ////
-#ifndef SERVER ////// CLIENT
-
-    if ((((status & 0x3) == 1 || (status & 0x3) == 2)))
+    else // CLIENT
     {
-        mode = POWERMODE;
-        v_dc_ref = sqrt(P_ref*Rdc); // V_dc²/R = P, where R = 115Ω the output ressitor
-        Vac_meas = V1_low_value - V2_low_value;
-        gain_current = pid_current_control.calculateWithReturn(v_dc_ref, V_high);
-        I_ac_ref = -gain_current * Vac_meas;
-        duty_cycle = (Vac_meas + pr.calculateWithReturn(I_ac_ref, I1_low_value)) / (2.0F * Udc) + 0.5F;
-        twist.setAllDutyCycle(duty_cycle);
-
-        if (!pwm_enable)
+        // the references of the SERVER are applied on the tick it asked
+        references_msg references;
+        bool received = references_queue.pop(sync_clock.now(), references);
+        if (received)
         {
-            pwm_enable = true;
-            spin.led.turnOn();
-            twist.startAll();
+            status = references.status;
+            if (status == STATUS_START)
+                scope.start();
+            P_ref = references.P_ref_fromSERVER;
+            Vac_ref = references.Vac_ref_fromSERVER;
         }
+#ifdef CLIENT_ANGLE_FROM_SERVER
+        // the angle is brought to this tick, REF_APPLY_DELAY after its own,
+        // and goes on at w0 when no reference is received for this tick.
+        if (received)
+            ref_angle = references.angle_fromSERVER + w0 * Ts * REF_APPLY_DELAY;
+        else
+            ref_angle += w0 * Ts;
+        ref_angle = ot_modulo_2pi(ref_angle);
+#endif
 
-        if (critical_task_counter % 4 == 0)
+        if (status == STATUS_POWER || status == STATUS_START)
         {
-            scope.acquire();
+            mode = POWERMODE;
+            v_dc_ref = sqrt(P_ref*Rdc); // V_dc²/R = P, where R = 115Ω the output ressitor
+            Vac_meas = V1_low_value - V2_low_value;
+            gain_current = pid_current_control.calculateWithReturn(v_dc_ref, V_high);
+#ifdef CLIENT_ANGLE_FROM_SERVER
+            I_ac_ref = -gain_current * Vac_ref * ot_sin(ref_angle);
+#else
+            I_ac_ref = -gain_current * Vac_meas;
+#endif
+            duty_cycle = (Vac_meas + pr.calculateWithReturn(I_ac_ref, I1_low_value)) / (2.0F * Udc) + 0.5F;
+            twist.setAllDutyCycle(duty_cycle);
+
+            if (!pwm_enable)
+            {
+                pwm_enable = true;
+                spin.led.turnOn();
+                twist.startAll();
+            }
+
+            if (critical_task_counter % scope_decimation == 0)
+            {
+                scope.acquire();
+            }
+            critical_task_counter++;
         }
-        critical_task_counter++;
-    }
-    else
-    {
-        mode = IDLEMODE;
-        if (pwm_enable == true)
+        else
         {
-            twist.stopAll();
-            spin.led.turnOff();
-            pwm_enable = false;
+            mode = IDLEMODE;
+            if (pwm_enable == true)
+            {
+                twist.stopAll();
+                spin.led.turnOff();
+                pwm_enable = false;
+            }
         }
     }
 
-#endif
+    profiler.stop();
 }
 
 /**
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2021-2024 LAAS-CNRS
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published by
+ *   the Free Software Foundation, either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGLPV2.1
+ */
+
+/**
+ * @brief  Sine and cosine generator with a constant phase step.
+ *
+ *         At a fixed frequency the angle grows by w.Ts at each control period,
+ *         so instead of `ot_sin(ot_modulo_2pi(angle + w * Ts))` the vector
+ *         (cos, sin) is rotated by w.Ts:
+ *
+ *             cos(k+1) = cos(k).cos(w.Ts) - sin(k).sin(w.Ts)
+ *             sin(k+1) = sin(k).cos(w.Ts) + cos(k).sin(w.Ts)
+ *
+ *         The rounding errors of the product make the amplitude drift, it is
+ *         brought back to 1 at each step by g = (3 - cos^2 - sin^2) / 2, the
+ *         first order of 1/sqrt(cos^2 + sin^2). One step costs 9
+ *         multiplications, no branch and no table, and gives sin and cos.
+ *
+ *         `setFrequency()` changes the step without phase jump (e.g. for a
+ *         droop control). It calls sinf/cosf, so it should be called only
+ *         when the frequency changes.
+ */
+
+#ifndef QUADRATURE_OSCILLATOR_H_
+#define QUADRATURE_OSCILLATOR_H_
+
+#include <math.h>
+#include "trigo.h" // float32_t, as the other trigonometric functions
+
+class QuadratureOscillator
+{
+public:
+    /**
+     * @param Ts [s] sampling period.
+     * @param w  [rad/s] pulsation.
+     */
+    QuadratureOscillator(float32_t Ts, float32_t w) : Ts(Ts)
+    {
+        setFrequency(w);
+        reset();
+    }
+
+    /**
+     * @brief change the pulsation, the phase is kept.
+     */
+    void setFrequency(float32_t w)
+    {
+        this->w = w;
+        step_cos = cosf(w * Ts);
+        step_sin = sinf(w * Ts);
+    }
+
+    /**
+     * @brief change the sampling period, the pulsation and the phase are kept.
+     */
+    void setSamplingPeriod(float32_t Ts)
+    {
+        this->Ts = Ts;
+        setFrequency(w);
+    }
+
+    /**
+     * @brief set the phase, 0 by default.
+     */
+    void reset(float32_t angle = 0.0F)
+    {
+        cos_value = cosf(angle);
+        sin_value = sinf(angle);
+    }
+
+    /**
+     * @brief advance of one sampling period.
+     */
+    void calculate()
+    {
+        float32_t c = cos_value * step_cos - sin_value * step_sin;
+        float32_t s = sin_value * step_cos + cos_value * step_sin;
+        float32_t g = 1.5F - 0.5F * (c * c + s * s);
+        cos_value = g * c;
+        sin_value = g * s;
+    }
+
+    float32_t getSin() { return sin_value; }
+    float32_t getCos() { return cos_value; }
+    float32_t getFrequency() { return w; }
+
+private:
+    float32_t Ts;
+    float32_t w;
+    float32_t step_cos;
+    float32_t step_sin;
+    float32_t cos_value;
+    float32_t sin_value;
+};
+
+#endif // QUADRATURE_OSCILLATOR_H_
@@ -0,0 +1,376 @@
+"""
+Copyright (c) 2021-2024 LAAS-CNRS
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation, either version 2.1 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+SPDX-License-Identifier: LGLPV2.1
+"""
+
+"""
+@brief  Decoder of the binary frames of `scope_stream.h`, used by the
+        monitor filter `filter_recorded_datas.py` and from the command line:
+
+            python scope_decoder.py capture.bin --format parquet
+
+        capture.bin holds the raw bytes of the serial port. The samples are
+        decoded with numpy: an INFO frame gives a structured dtype, the
+        payloads of a record are read by one `np.frombuffer()`. The CRC is
+        computed by `binascii`. The columns are appended to a file as soon
+        as a block (continuous scope) or a telemetry frame is received:
+
+        - txt: the text files of the former filter, read by `plot_data.py`,
+        - parquet (pyarrow): one row group per append, readable once closed,
+        - hdf5 (h5py): one resizable dataset per channel, flushed at each
+          append, so it can be read during a continuous capture.
+"""
+
+import argparse
+import binascii
+import struct
+import time
+from datetime import datetime
+
+import numpy as np
+
+SYNC = b'\xa5\x5a'
+HEADER = struct.Struct('<2sBBHH')  # sync, type, seq, length, crc
+INFO = struct.Struct('<BBHHII')    # version, nb_channel, nb_samples, decimation, period_us, nb_bytes
+BLOCK = struct.Struct('<II')      # index, nb_lost
+FORMAT = struct.Struct('<Bf')     # format, scale of a channel (version >= 2)
+DTYPES = {0: '<f4', 1: '<i2'}     # float32, int16
+FRAME_INFO = 1
+FRAME_DATA = 2
+FRAME_END = 3
+FRAME_BLOCK = 4
+FRAME_TELEMETRY_INFO = 5
+FRAME_TELEMETRY = 6
+LOST = struct.Struct('<I')        # nb_lost of a telemetry frame
+MAX_LENGTH = 2048
+
+_REVERSED_BITS = bytes(int(f'{b:08b}'[::-1], 2) for b in range(256))
+
+
+def _reverse16(x):
+    return int(f'{x:016b}'[::-1], 2)
+
+
+def crc16_ccitt(seed, datas):
+    """
+    same result as zephyr crc16_ccitt(), the reflected CCITT: it is the
+    CCITT of binascii.crc_hqx() on the bytes and the seed with their bits
+    reversed
+    """
+    datas = bytes(datas).translate(_REVERSED_BITS)
+    return _reverse16(binascii.crc_hqx(datas, _reverse16(seed)))
+
+
+class StreamInfo:
+    """ channels of a record or of the telemetry, from an INFO frame """
+
+    def __init__(self, payload, telemetry=False):
+        (self.version, self.nb_channel, self.nb_samples, self.decimation,
+         self.period_us, self.nb_bytes) = INFO.unpack_from(payload)
+        names, _, formats = payload[INFO.size:].partition(b'\0')
+        self.names = [name for name in names.decode('ascii').split(',') if name]
+        if self.version >= 2 or telemetry:
+            formats = list(FORMAT.iter_unpack(formats[:FORMAT.size * self.nb_channel]))
+        else:
+            formats = [(0, 1.0)] * self.nb_channel
+        fields = [('index', '<u2')] if telemetry else []
+        fields += [(name, DTYPES[f]) for name, (f, _) in zip(self.names, formats)]
+        self.dtype = np.dtype(fields)
+        self.scales = [scale for _, scale in formats]
+        self.period = self.decimation * self.period_us * 1e-6  # [s] between two samples
+
+    def decode(self, datas):
+        """ columns of the complete samples of datas, divided by their scale """
+        count = len(datas) // self.dtype.itemsize
+        if count:
+            samples = np.frombuffer(datas, dtype=self.dtype, count=count)
+        else:
+            samples = np.zeros(0, dtype=self.dtype)
+        columns = {}
+        if 'index' in self.dtype.names:
+            columns['index'] = np.ascontiguousarray(samples['index'])
+        for name, scale in zip(self.names, self.scales):
+            columns[name] = samples[name].astype(np.float32) / np.float32(scale)
+        return columns
+
+    def attributes(self):
+        return {'decimation': self.decimation, 'period_us': self.period_us, 'period': self.period}
+
+
+class TextWriter:
+    """ text files of the former filter: one value per line, or csv rows """
+
+    def __init__(self, filename, names, info, rows=False):
+        self.f = open(filename, 'w+')
+        self.rows = rows
+        if rows:
+            self.f.write("{}\n".format(",".join(names)))
+        else:
+            self.f.write("{},\n".format(",".join(names)))
+
+    def append(self, columns):
+        values = np.column_stack(list(columns.values()))
+        if self.rows:
+            np.savetxt(self.f, values, fmt='%g', delimiter=',')
+        else:
+            np.savetxt(self.f, values.reshape(-1, 1), fmt='%.9g')
+        self.f.flush()
+
+    def close(self):
+        self.f.close()
+
+
+class ParquetWriter:
+    """ one row group per append, the file is complete once closed """
+
+    def __init__(self, filename, names, info):
+        import pyarrow
+        import pyarrow.parquet
+        self.pa = pyarrow
+        self.pq = pyarrow.parquet
+        self.filename = filename
+        self.metadata = {k: str(v) for k, v in info.attributes().items()}
+        self.writer = None
+
+    def append(self, columns):
+        table = self.pa.table(columns)
+        if self.writer is None:
+            self.writer = self.pq.ParquetWriter(self.filename,
+                                                table.schema.with_metadata(self.metadata))
+        self.writer.write_table(table)
+
+    def close(self):
+        if self.writer is not None:
+            self.writer.close()
+
+
+class Hdf5Writer:
+    """ one resizable dataset per channel, flushed at each append """
+
+    def __init__(self, filename, names, info):
+        import h5py
+        self.f = h5py.File(filename, 'w')
+        for key, value in info.attributes().items():
+            self.f.attrs[key] = value
+
+    def append(self, columns):
+        for name, values in columns.items():
+            if name not in self.f:
+                self.f.create_dataset(name, shape=(0,), maxshape=(None,), dtype=values.dtype,
+                                      chunks=True)
+            dataset = self.f[name]
+            n = dataset.shape[0]
+            dataset.resize((n + len(values),))
+            dataset[n:] = values
+        self.f.flush()
+
+    def close(self):
+        self.f.close()
+
+
+WRITERS = {'txt': ('txt', TextWriter), 'parquet': ('parquet', ParquetWriter),
+           'hdf5': ('h5', Hdf5Writer)}
+
+
+def read(filename):
+    """ names and columns of a file written by the decoder """
+    if filename.endswith('.parquet'):
+        import pyarrow.parquet
+        table = pyarrow.parquet.read_table(filename)
+        return table.column_names, np.column_stack([c.to_numpy() for c in table.columns])
+    if filename.endswith('.h5'):
+        import h5py
+        with h5py.File(filename, 'r') as f:
+            names = list(f.keys())
+            return names, np.column_stack([f[name][:] for name in names])
+    with open(filename, 'r') as f:
+        names = [name for name in f.readline().strip().split(',') if name]
+        if filename.endswith('-telemetry.txt'):
+            return names, np.loadtxt(f, delimiter=',', ndmin=2)
+        return names, np.fromiter(f, dtype=float).reshape(-1, len(names))
+
+
+class ScopeDecoder:
+    """
+    The scope records are sent in binary frames by `scope_stream.h`:
+    1. an INFO frame gives the channel names, the number of samples and the decimation.
+    2. DATA frames contain the raw scope buffer (little endian), float32, or
+       int16 divided by the scale given in the INFO frame.
+       With a continuous scope each block of samples is announced by a BLOCK
+       frame and the blocks are appended to the file as soon as received.
+    3. an END frame closes the record file.
+
+    The telemetry of `telemetry.h` is sent between the records: a TELEMETRY_INFO
+    frame, repeated from time to time, gives the names and formats of the
+    channels, the TELEMETRY frames contain records of an index and the values.
+    They are appended to a separate telemetry file.
+
+    `feed()` takes the bytes of the serial port and returns the bytes which
+    are not in a frame, the text printed by the board.
+    """
+
+    def __init__(self, output_format='txt', log=print):
+        self.extension, self.writer = WRITERS[output_format]
+        self.log = log
+        self.buffer = bytearray()
+        self.seq = None
+        self.info = None
+        self.record = None
+        self.datas = bytearray()
+        self.telemetry_payload = None
+        self.telemetry_info = None
+        self.telemetry = None
+        self.telemetry_index = None
+
+    def feed(self, datas):
+        self.buffer += datas
+        text_out = bytearray()
+        while True:
+            idx = self.buffer.find(SYNC)
+            if idx < 0:
+                # keep a possible first sync byte for the next call
+                keep = 1 if self.buffer.endswith(SYNC[:1]) else 0
+                text_out += self.buffer[:len(self.buffer) - keep]
+                del self.buffer[:len(self.buffer) - keep]
+                break
+            text_out += self.buffer[:idx]
+            del self.buffer[:idx]
+            if len(self.buffer) < HEADER.size:
+                break
+            _, frame_type, seq, length, crc = HEADER.unpack_from(self.buffer)
+            if length <= MAX_LENGTH and len(self.buffer) < HEADER.size + length:
+                break
+            payload = bytes(self.buffer[HEADER.size:HEADER.size + length])
+            if length > MAX_LENGTH or crc16_ccitt(crc16_ccitt(0, self.buffer[2:6]), payload) != crc:
+                # not a frame, or a corrupted one: skip the sync and go on
+                text_out += self.buffer[:1]
+                del self.buffer[:1]
+                continue
+            del self.buffer[:HEADER.size + length]
+            self.frame(frame_type, seq, payload)
+        return bytes(text_out)
+
+    def close(self):
+        if self.record is not None:
+            self.close_record()
+        if self.telemetry is not None:
+            self.telemetry.close()
+            self.telemetry = None
+
+    def frame(self, frame_type, seq, payload):
+        if self.seq is not None and seq != (self.seq + 1) & 0xff and self.info is not None:
+            self.log(f"record: frame {(self.seq + 1) & 0xff} lost")
+        self.seq = seq
+        if frame_type == FRAME_TELEMETRY_INFO:
+            self.open_telemetry(payload)
+        elif frame_type == FRAME_TELEMETRY:
+            self.save_telemetry(payload)
+        elif frame_type == FRAME_INFO:
+            self.open_record(payload)
+        elif self.info is None:
+            return
+        elif frame_type == FRAME_BLOCK:
+            index, nb_lost = BLOCK.unpack_from(payload)
+            if self.datas:
+                self.log(f"record: incomplete block {self.block_index} dropped")
+            if self.block_index is not None and index != self.block_index + 1:
+                self.log(f"record: {index - self.block_index - 1} blocks lost on the board")
+            self.datas = bytearray()
+            self.block_index = index
+        elif frame_type == FRAME_DATA:
+            self.datas += payload
+            if len(self.datas) >= self.info.nb_bytes:
+                self.save_datas()
+        elif frame_type == FRAME_END:
+            self.close_record()
+
+    def filename(self, kind):
+        return f"{datetime.now().strftime('%Y-%m-%d_%H-%M-%S')}-{kind}.{self.extension}"
+
+    def open_record(self, payload):
+        if self.record is not None:
+            self.close_record()
+        self.info = StreamInfo(payload)
+        self.datas = bytearray()
+        self.block_index = None
+        self.nb_blocks = 0
+        self.record_filename = self.filename('record')
+        self.record = self.writer(self.record_filename, self.info.names, self.info)
+
+    def save_datas(self):
+        self.record.append(self.info.decode(self.datas))
+        self.datas = bytearray()
+        self.nb_blocks += 1
+
+    def close_record(self):
+        if self.datas:
+            self.log(f"record: {len(self.datas)} bytes received for {self.info.nb_bytes}")
+            self.save_datas()
+        self.record.close()
+        self.record = None
+        self.log(f"record: {self.nb_blocks} x {self.info.nb_samples} samples of "
+                 f"{len(self.info.names)} channels saved in {self.record_filename}")
+        self.info = None
+
+    def open_telemetry(self, payload):
+        if payload == self.telemetry_payload:
+            return  # repeated info frame
+        if self.telemetry is not None:
+            self.telemetry.close()
+        self.telemetry_payload = payload
+        self.telemetry_info = StreamInfo(payload, telemetry=True)
+        self.telemetry_index = None
+        filename = self.filename('telemetry')
+        names = ['index'] + self.telemetry_info.names
+        if self.writer is TextWriter:
+            self.telemetry = TextWriter(filename, names, self.telemetry_info, rows=True)
+        else:
+            self.telemetry = self.writer(filename, names, self.telemetry_info)
+        self.log(f"telemetry: {len(self.telemetry_info.names)} channels every "
+                 f"{self.telemetry_info.period * 1e3:g} ms in {filename}")
+
+    def save_telemetry(self, payload):
+        if self.telemetry is None:
+            return  # wait for the info frame
+        columns = self.telemetry_info.decode(payload[LOST.size:])
+        index = columns['index']
+        if len(index) == 0:
+            return
+        # gaps of the 16-bit index, with the last record of the previous frame
+        if self.telemetry_index is not None:
+            index = np.concatenate(([self.telemetry_index], index)).astype(np.uint16)
+        lost = int(np.sum((np.diff(index) - np.uint16(1)).astype(np.uint16)))
+        if lost:
+            self.log(f"telemetry: {lost} records lost")
+        self.telemetry_index = int(index[-1])
+        self.telemetry.append(columns)
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser("scope_decoder",
+                                     "scope_decoder <capture> [--format txt|parquet|hdf5]")
+    parser.add_argument("capture", help="raw bytes of the serial port")
+    parser.add_argument("--format", choices=WRITERS.keys(), default='parquet')
+    args = parser.parse_args()
+    with open(args.capture, 'rb') as f:
+        capture = f.read()
+    tic = time.perf_counter()
+    decoder = ScopeDecoder(args.format)
+    decoder.feed(capture)
+    decoder.close()
+    toc = time.perf_counter()
+    print(f"{len(capture)} bytes decoded in {(toc - tic) * 1e3:.1f} ms")
@@ -0,0 +1,168 @@
+/*
+ * Copyright (c) 2021-2024 LAAS-CNRS
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published by
+ *   the Free Software Foundation, either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGLPV2.1
+ */
+
+/**
+ * @brief  References applied on a tick of the shared clock of the microgrid.
+ *
+ *         The critical tasks of the nodes are synchronised by
+ *         `communication.sync`, they all count the same ticks. `SyncClock`
+ *         counts them; on the server this count is the shared clock, it is
+ *         sent in each frame. A client aligns its own count on it once: the
+ *         offset between the two counts is taken from the first frame, then
+ *         kept. The latency of the next frames, how many ticks after their
+ *         tick they are received, is measured against this fixed offset. If a
+ *         frame comes earlier than the first one, the offset had been taken
+ *         on a late frame and is moved to this one; if a frame comes more than
+ *         SYNC_MAX_LATENCY ticks late, the server has restarted its count.
+ *         Both are resynchronisations.
+ *
+ *         The server asks the references of tick k to be applied on tick
+ *         k + delay. `TimedQueue` keeps them until this tick: the reception
+ *         callback pushes them and the critical task pops them, all the
+ *         clients apply them on the same tick whatever the jitter of the
+ *         reception. The delay must be at least one tick more than the
+ *         transmission of a frame.
+ *
+ *         The ticks are 16 bits, they wrap after 6.5 s at 100 us and are
+ *         compared modulo 2^16.
+ */
+
+#ifndef SYNC_REFERENCES_H_
+#define SYNC_REFERENCES_H_
+
+#include <stdint.h>
+
+#define SYNC_MAX_LATENCY 16 // [ticks] later than this, the clock of the server has changed
+
+class SyncClock
+{
+public:
+    /**
+     * @brief to be called once per tick, at the start of the critical task,
+     * before `now()` is read.
+     */
+    void tick() { local++; }
+
+    /**
+     * @return the tick of the shared clock.
+     */
+    uint16_t now() { return local + offset; }
+
+    /**
+     * @brief client: measure the latency of a frame of the server received
+     * during this tick, the first frame after `resync()` sets the offset.
+     *
+     * @return the latency of the frame [ticks].
+     */
+    uint16_t align(uint16_t server_tick)
+    {
+        int16_t latency = (int16_t) (uint16_t) (now() - server_tick);
+        if (!aligned || latency < 0 || latency > SYNC_MAX_LATENCY) {
+            if (aligned) {
+                nb_resync++;
+            }
+            offset = server_tick - local;
+            aligned = true;
+            latency = 0;
+        }
+        if ((uint16_t) latency > max_latency) {
+            max_latency = latency;
+        }
+        return latency;
+    }
+
+    /**
+     * @brief client: take the offset again from the next frame.
+     */
+    void resync() { aligned = false; }
+
+    bool isAligned() { return aligned; }
+    uint32_t getNbResync() { return nb_resync; }
+    uint16_t getMaxLatency() { return max_latency; }
+
+private:
+    uint16_t local = 0;
+    uint16_t offset = 0;
+    bool aligned = false;
+    uint32_t nb_resync = 0;
+    uint16_t max_latency = 0; // [ticks] since the start
+};
+
+/**
+ * @brief values waiting for their tick, SIZE must be a power of 2 greater
+ * than the delay.
+ */
+template <typename T, uint8_t SIZE = 4>
+class TimedQueue
+{
+    static_assert((SIZE & (SIZE - 1)) == 0, "SIZE must be a power of 2");
+
+public:
+    /**
+     * @brief store `value` to be applied on `apply_tick`, in the reception
+     * callback.
+     *
+     * @param now tick of the reception.
+     * @return false if `apply_tick` is already past, the value is dropped.
+     */
+    bool push(uint16_t apply_tick, uint16_t now, const T &value)
+    {
+        if ((int16_t) (apply_tick - now) <= 0) {
+            nb_late++;
+            return false;
+        }
+        slot &s = slots[apply_tick & (SIZE - 1)];
+        s.valid = false; // not read by pop() while written
+        s.value = value;
+        s.apply_tick = apply_tick;
+        s.valid = true;
+        return true;
+    }
+
+    /**
+     * @brief get the value to apply on tick `now`, in the critical task.
+     *
+     * @return false if no value was received for this tick.
+     */
+    bool pop(uint16_t now, T &value)
+    {
+        slot &s = slots[now & (SIZE - 1)];
+        if (!s.valid || s.apply_tick != now) {
+            return false;
+        }
+        value = s.value;
+        s.valid = false;
+        return true;
+    }
+
+    uint32_t getNbLate() { return nb_late; }
+
+private:
+    struct slot
+    {
+        T value;
+        uint16_t apply_tick;
+        volatile bool valid;
+    };
+
+    slot slots[SIZE] = {};
+    uint32_t nb_late = 0;
+};
+
+#endif // SYNC_REFERENCES_H_
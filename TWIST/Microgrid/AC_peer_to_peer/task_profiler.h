@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) 2021-2024 LAAS-CNRS
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published by
+ *   the Free Software Foundation, either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGLPV2.1
+ */
+
+/**
+ * @brief  Profiling of the critical task with the DWT cycle counter.
+ *
+ *         `start()` and `stop()` surround the code of the critical task:
+ *
+ *             void loop_critical_task()
+ *             {
+ *                 profiler.start();
+ *                 ...
+ *                 profiler.stop();
+ *             }
+ *
+ *         They record:
+ *         - the min, max and mean execution time,
+ *         - a histogram of the start jitter, i.e. the time between two starts
+ *           minus the period,
+ *         - the overruns: executions longer than the period, and starts
+ *           later than 1.5 period (a tick was missed).
+ *
+ *         The background task asks a report with `requestReport()` and
+ *         prints it with `printReport()`. The statistics are copied by the
+ *         critical task itself at the end of a tick, so they are never read
+ *         while being updated, and are then cleared.
+ */
+
+#ifndef TASK_PROFILER_H_
+#define TASK_PROFILER_H_
+
+#include <soc.h> // DWT cycle counter and SystemCoreClock
+
+#include "zephyr/kernel.h"
+
+#define PROFILER_NB_BINS 16 // bins of the jitter histogram
+
+struct task_profile
+{
+    uint32_t nb_ticks;
+    uint32_t exec_min;  // [cycles]
+    uint32_t exec_max;  // [cycles]
+    uint64_t exec_sum;  // [cycles]
+    int32_t jitter_min; // [cycles]
+    int32_t jitter_max; // [cycles]
+    uint32_t nb_overruns; // execution longer than the period
+    uint32_t nb_missed;   // start later than 1.5 period
+    uint32_t histogram[PROFILER_NB_BINS];
+};
+
+class TaskProfiler
+{
+public:
+    /**
+     * @brief enable the cycle counter, to be called in the setup routine.
+     *
+     * @param period_us [us] period of the critical task.
+     * @param bin_ns    [ns] width of a bin of the jitter histogram. The
+     *                  histogram is centred on 0, the first and last bins
+     *                  also count the jitters out of range.
+     */
+    void init(uint32_t period_us, uint32_t bin_ns = 250)
+    {
+        CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+        DWT->CYCCNT = 0;
+        DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+        cycles_per_us = SystemCoreClock / 1000000;
+        period = period_us * cycles_per_us;
+        bin_width = (bin_ns * cycles_per_us + 999) / 1000;
+        if (bin_width == 0) {
+            bin_width = 1;
+        }
+        first = true;
+        clear(profile);
+    }
+
+    /**
+     * @brief to be called first in the critical task.
+     */
+    void start()
+    {
+        uint32_t now = DWT->CYCCNT;
+        if (!first) {
+            int32_t jitter = (int32_t) (now - last_start - period);
+            if (jitter < profile.jitter_min) {
+                profile.jitter_min = jitter;
+            }
+            if (jitter > profile.jitter_max) {
+                profile.jitter_max = jitter;
+            }
+            if (jitter > (int32_t) (period / 2)) {
+                profile.nb_missed++;
+            }
+            int32_t bin = (jitter + (int32_t) (bin_width * PROFILER_NB_BINS / 2))
+                          / (int32_t) bin_width;
+            if (jitter < -(int32_t) (bin_width * PROFILER_NB_BINS / 2)) {
+                bin = 0;
+            }
+            if (bin >= PROFILER_NB_BINS) {
+                bin = PROFILER_NB_BINS - 1;
+            }
+            profile.histogram[bin]++;
+        }
+        first = false;
+        last_start = now;
+    }
+
+    /**
+     * @brief to be called last in the critical task.
+     */
+    void stop()
+    {
+        uint32_t exec = DWT->CYCCNT - last_start;
+        if (exec < profile.exec_min) {
+            profile.exec_min = exec;
+        }
+        if (exec > profile.exec_max) {
+            profile.exec_max = exec;
+        }
+        if (exec > period) {
+            profile.nb_overruns++;
+        }
+        profile.exec_sum += exec;
+        profile.nb_ticks++;
+
+        if (report_asked) {
+            report = profile;
+            clear(profile);
+            report_asked = false;
+            report_ready = true;
+        }
+    }
+
+    /**
+     * @brief ask the critical task for its statistics, to be called in a
+     * background task.
+     */
+    void requestReport()
+    {
+        report_ready = false;
+        report_asked = true;
+    }
+
+    /**
+     * @brief print the statistics once copied by the critical task.
+     *
+     * @return true if the report was printed.
+     */
+    bool printReport()
+    {
+        if (!report_ready) {
+            return false;
+        }
+        report_ready = false;
+
+        const float32_t us = 1.0F / (float32_t) cycles_per_us;
+        uint32_t mean = report.nb_ticks ? (uint32_t) (report.exec_sum / report.nb_ticks) : 0;
+        printk("critical task: %u ticks, period %u cycles (%.2f us)\n",
+               report.nb_ticks, period, period * us);
+        printk("  execution [us]: min %.2f mean %.2f max %.2f (load %.1f %%)\n",
+               report.exec_min * us, mean * us, report.exec_max * us,
+               100.0F * mean / period);
+        printk("  jitter [us]: min %.2f max %.2f\n",
+               report.jitter_min * us, report.jitter_max * us);
+        printk("  overruns: %u, missed ticks: %u\n", report.nb_overruns, report.nb_missed);
+        for (int32_t k = 0; k < PROFILER_NB_BINS; k++) {
+            int32_t low = (k - PROFILER_NB_BINS / 2) * (int32_t) bin_width;
+            printk("  %s% 7.2f us: %u\n", k == 0 ? "<" : k == PROFILER_NB_BINS - 1 ? ">" : " ",
+                   (k == 0 ? low + (int32_t) bin_width : low) * us, report.histogram[k]);
+        }
+        return true;
+    }
+
+private:
+    static void clear(task_profile &p)
+    {
+        p.nb_ticks = 0;
+        p.exec_min = UINT32_MAX;
+        p.exec_max = 0;
+        p.exec_sum = 0;
+        p.jitter_min = INT32_MAX;
+        p.jitter_max = INT32_MIN;
+        p.nb_overruns = 0;
+        p.nb_missed = 0;
+        for (uint8_t k = 0; k < PROFILER_NB_BINS; k++) {
+            p.histogram[k] = 0;
+        }
+    }
+
+    uint32_t cycles_per_us;
+    uint32_t period;    // [cycles]
+    uint32_t bin_width; // [cycles]
+    uint32_t last_start;
+    bool first;
+    task_profile profile;
+    task_profile report;
+    volatile bool report_asked = false;
+    volatile bool report_ready = false;
+};
+
+#endif // TASK_PROFILER_H_
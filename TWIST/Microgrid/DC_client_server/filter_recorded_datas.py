@@ -0,0 +1,60 @@
+"""
+Copyright (c) 2021-2024 LAAS-CNRS
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation, either version 2.1 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+SPDX-License-Identifier: LGLPV2.1
+"""
+
+"""
+@brief  This is a class for filtering recorded data from the SPIN board
+
+@author Regis Ruelland <regis.ruelland@laas.fr>
+"""
+
+from platformio.public import DeviceMonitorFilterBase
+import os
+import sys
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from scope_decoder import ScopeDecoder  # noqa: E402
+
+OUTPUT_FORMAT = 'txt'  # 'txt', 'parquet' (pyarrow) or 'hdf5' (h5py), see scope_decoder.py
+
+
+class RecordedDatas(DeviceMonitorFilterBase):
+    """
+    Saves the scope records and the telemetry sent in binary frames by
+    `scope_stream.h` and `telemetry.h`, decoded by `ScopeDecoder`, and
+    passes the text printed by the board to the monitor.
+
+    The serial monitor must not decode the bytes as utf-8, so in platformio.ini:
+    monitor_encoding = latin-1
+    """
+    NAME = "recorded_datas"
+
+    def __init__(self, *args, **kwargs):
+        super().__init__(*args, **kwargs)
+        self.decoder = ScopeDecoder(OUTPUT_FORMAT)
+        print("recorded filter is loaded")
+
+    def rx(self, text):
+        datas = text.encode('latin-1', errors='replace')
+        return self.decoder.feed(datas).decode('latin-1')
+
+    def tx(self, text):
+        return text
+
+    def __del__(self):
+        self.decoder.close()
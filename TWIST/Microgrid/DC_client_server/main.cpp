@@ -36,18 +36,54 @@
 #include "SpinAPI.h"
 #include "CommunicationAPI.h"
 #include "pid.h"
+#include "node_config.h"
+#include "scope_stream.h"
+#include "telemetry.h"
 
 #include "zephyr/console/console.h"
 
-#define SLAVE // MASTER, SLAVE
 #define VREF 2.048
+#define TELEMETRY // Comment to print the measures as text every 100 ms
 
+enum board_role
+{
+    ROLE_MASTER = 0, // voltage control, sends the current reference
+    ROLE_SLAVE,      // current control, follows the master
+};
 
-#ifdef MASTER
-#define ROLE_TXT "MASTER"
-#else
-#define ROLE_TXT "SLAVE"
-#endif
+/* Configuration of the board, kept in flash: the same firmware is flashed
+ * on both boards, the role is set from the serial menu (c) */
+struct client_server_config
+{
+    uint8_t role;         // board_role
+    float32_t v_ref;      // [V] voltage of the master
+    float32_t i_ref_start; // [A] current reference sent at start
+    float32_t i_ref_step; // [A] current reference sent after 4s
+    float32_t kp;
+    float32_t Ti;
+};
+
+#define CLIENT_SERVER_CONFIG_VERSION 1
+static const client_server_config config_defaults = {
+    ROLE_SLAVE, // role
+    12.0F,      // v_ref
+    0.6F,       // i_ref_start
+    1.0F,       // i_ref_step
+    0.000215F,  // kp, PID coefficients for a 8.6ms step response
+    7.5175e-5F, // Ti
+};
+static const config_field config_fields[] = {
+    CONFIG_U8(client_server_config, role, ROLE_MASTER, ROLE_SLAVE, true),
+    CONFIG_FLOAT(client_server_config, v_ref, 0.0F, 40.0F, false),
+    CONFIG_FLOAT(client_server_config, i_ref_start, -5.0F, 5.0F, false),
+    CONFIG_FLOAT(client_server_config, i_ref_step, -5.0F, 5.0F, false),
+    CONFIG_FLOAT(client_server_config, kp, 0.0F, 1.0F, false),
+    CONFIG_FLOAT(client_server_config, Ti, 0.0F, 1.0F, false),
+};
+static NodeConfig<client_server_config> config("dc_cs", CLIENT_SERVER_CONFIG_VERSION,
+                                               config_defaults, config_fields,
+                                               ARRAY_SIZE(config_fields));
+static uint8_t role = ROLE_SLAVE; // read from the configuration at start only
 
 
 //--------------SETUP FUNCTIONS DECLARATION-------------------
@@ -67,16 +103,13 @@ static uint32_t control_task_period = 100; //[us] period of the control task
 bool pwr_enable = false;
 bool slave_listen = false;
 int8_t communication_count = 0;
-/* PID coefficient for a 8.6ms step response*/
+/* PID coefficients in the configuration */
 
-static float32_t kp = 0.000215;
-static float32_t Ti = 7.5175e-5;
 static float32_t Td = 0.0;
 static float32_t N = 0.0;
 static float32_t upper_bound = 1.0F;
 static float32_t lower_bound = 0.0F;
 static float32_t Ts = control_task_period * 1e-6;
-static PidParams pid_params(Ts, kp, Ti, Td, N, lower_bound, upper_bound);
 static Pid pid;
 
 /* Measure variables */
@@ -88,13 +121,18 @@ static float32_t I2_low_value;
 
 // reference voltage/current
 float32_t duty_cycle = 0.5;
-#ifdef MASTER
-static float32_t Vref = 12.0;
-#endif
+static float32_t Vref; // of the master, config.values.v_ref
 static float32_t Iref;
 static float32_t PeakRef_Raw;
 int count = 0;
 
+// binary telemetry at 500 Hz instead of the text printed every 100 ms
+// 5 int16 channels and the index: 6 bytes per ms, 52 % of a 115200 bit/s console
+static Telemetry<256, 5> telemetry;
+static uint16_t telemetry_decimation = 2000 / control_task_period;
+static uint16_t telemetry_counter = 0;
+static ScopeStream scope_stream; // sends the telemetry frames
+
 //---------------------------------------------------------------
 
 enum serial_interface_menu_mode // LIST OF POSSIBLE MODES FOR THE OWNTECH CONVERTER
@@ -107,6 +145,15 @@ uint8_t mode = IDLEMODE;
 
 //--------------SETUP FUNCTIONS-------------------------------
 
+/* gains of the configuration, at start and after an edit in idle */
+void apply_config()
+{
+    const client_server_config &c = config.values;
+    PidParams pid_params(Ts, c.kp, c.Ti, Td, N, lower_bound, upper_bound);
+    pid.init(pid_params);
+    Vref = c.v_ref;
+}
+
 /**
  * This is the setup routine.
  * It is used to call functions that will initialize your spin, twist, data and/or tasks.
@@ -118,23 +165,33 @@ void setup_routine()
     // Setup the hardware first
     spin.version.setBoardVersion(SPIN_v_1_0);
     twist.setVersion(shield_TWIST_V1_3);
-    
+
+    // role and gains of this board, from the flash
+    int config_status = config.load();
+    printk("configuration %s\n", config_status == NODE_CONFIG_LOADED ? "loaded" : "by default");
+    role = config.values.role;
+
     /* buck voltage mode */
     twist.initAllBuck();
 
     data.enableTwistDefaultChannels();
 
     communication.analog.init();
-#ifdef MASTER
-    communication.sync.initMaster(); // start the synchronisation
-    communication.analog.setAnalogCommValue(0);
-#endif
+    if (role == ROLE_MASTER) {
+        communication.sync.initMaster(); // start the synchronisation
+        communication.analog.setAnalogCommValue(0);
+    } else {
+        communication.sync.initSlave(TWIST_v_1_1_4); // wait for synchronisation
+    }
 
-#ifdef SLAVE
-    communication.sync.initSlave(TWIST_v_1_1_4); // wait for synchronisation
-#endif
+    apply_config();
 
-    pid.init(pid_params);
+    scope_stream.init();
+    telemetry.connectChannel(I1_low_value, "I1_low_value", 1000.0F); // [mA]
+    telemetry.connectChannel(V1_low_value, "V1_low_value", 100.0F);  // [10 mV]
+    telemetry.connectChannel(I2_low_value, "I2_low_value", 1000.0F);
+    telemetry.connectChannel(V2_low_value, "V2_low_value", 100.0F);
+    telemetry.connectChannel(PeakRef_Raw, "PeakRef_Raw", 1.0F);      // [ADC counts]
 
     // Then declare tasks
     uint32_t app_task_number = task.createBackground(loop_application_task);
@@ -159,12 +216,13 @@ void loop_communication_task()
         case 'h':
             //----------SERIAL INTERFACE MENU-----------------------
             printk(" ________________________________________\n");
-            printk("      %s\n", ROLE_TXT);
+            printk("      %s\n", role == ROLE_MASTER ? "MASTER" : "SLAVE");
             printk("|     ------- MENU ---------             |\n");
             printk("|     press i : idle mode                |\n");
             printk("|     press p : power mode               |\n");
             printk("|     press u : Iref UP                  |\n");
             printk("|     press d : Iref DOWN                |\n");
+            printk("|     press c : configuration (idle)     |\n");
             printk("|________________________________________|\n\n");
             //------------------------------------------------------
             break;
@@ -182,6 +240,14 @@ void loop_communication_task()
         case 'd':
             Iref -= 0.10;
             break;
+        case 'c':
+            if (mode == IDLEMODE) {
+                if (config.edit())
+                    apply_config();
+            } else {
+                printk("configuration in idle mode only\n");
+            }
+            break;
         default:
             break;
         }
@@ -203,14 +269,22 @@ void loop_application_task()
     {
         spin.led.turnOn();
 
+#ifndef TELEMETRY
         printk("%f:", I1_low_value);
         printk("%f:", V1_low_value);
         printk("%f:", I2_low_value);
         printk("%f:", V2_low_value);
+#endif
     }
+#ifdef TELEMETRY
+    // one frame at each run, of the records the UART can send in 10 ms
+    telemetry.poll(scope_stream, telemetry_decimation, control_task_period);
+    task.suspendBackgroundMs(10);
+#else
     printk("%f:", PeakRef_Raw);
     printk("\n");
     task.suspendBackgroundMs(100);
+#endif
 }
 
 /**
@@ -221,15 +295,15 @@ void loop_application_task()
  */
 void loop_critical_task()
 {
-#ifdef SLAVE
-    meas_data = communication.analog.getAnalogCommValue() + 20.0f;
-    if (meas_data != -10000)
-        PeakRef_Raw = meas_data;
-    if (PeakRef_Raw < 1800)
-        mode = IDLEMODE;
-    else
-        mode = POWERMODE;
-#endif
+    if (role == ROLE_SLAVE) {
+        meas_data = communication.analog.getAnalogCommValue() + 20.0f;
+        if (meas_data != -10000)
+            PeakRef_Raw = meas_data;
+        if (PeakRef_Raw < 1800)
+            mode = IDLEMODE;
+        else
+            mode = POWERMODE;
+    }
 
     meas_data = data.getLatest(I1_LOW);
     if (meas_data < 10000 && meas_data > -10000)
@@ -253,9 +327,8 @@ void loop_critical_task()
         {
             pwr_enable = false;
             twist.stopAll();
-#ifdef MASTER
-            communication.analog.setAnalogCommValue(0);
-#endif
+            if (role == ROLE_MASTER)
+                communication.analog.setAnalogCommValue(0);
         }
     }
     else if (mode == POWERMODE)
@@ -266,33 +339,42 @@ void loop_critical_task()
             pwr_enable = true;
             twist.startAll();
             count = 0;
-#ifdef MASTER
-            Iref = 0.6F; // initial current reference
-#endif
+            if (role == ROLE_MASTER)
+                Iref = config.values.i_ref_start; // initial current reference
         }
 
-#ifdef MASTER
-        count++;
-        if (count == 40000)
+        if (role == ROLE_MASTER)
         {
-            Iref = 1.0F; // update reference value after 4s
-        }
-        PeakRef_Raw = (0.100F * Iref + 1.024F) * (4096.0F / 2.048F);
+            count++;
+            if (count == 40000)
+            {
+                Iref = config.values.i_ref_step; // update reference value after 4s
+            }
+            PeakRef_Raw = (0.100F * Iref + 1.024F) * (4096.0F / 2.048F);
 
-        duty_cycle = pid.calculateWithReturn(Vref, (V1_low_value));
+            duty_cycle = pid.calculateWithReturn(Vref, (V1_low_value));
 
-        /* sending value to slave board*/
-        communication.analog.setAnalogCommValue(PeakRef_Raw);
-#endif
-
-#ifdef SLAVE
-        Iref = ((2.048F * PeakRef_Raw / 4096.0F) - 1.024) / 0.100;
+            /* sending value to slave board*/
+            communication.analog.setAnalogCommValue(PeakRef_Raw);
+        }
+        else
+        {
+            Iref = ((2.048F * PeakRef_Raw / 4096.0F) - 1.024) / 0.100;
 
-        duty_cycle = pid.calculateWithReturn(Iref, (I1_low_value + I2_low_value));
-#endif
+            duty_cycle = pid.calculateWithReturn(Iref, (I1_low_value + I2_low_value));
+        }
 
         twist.setAllDutyCycle(duty_cycle);
     }
+
+#ifdef TELEMETRY
+    // in both modes, as the text: PeakRef_Raw shows the reference of the master
+    if (++telemetry_counter >= telemetry_decimation)
+    {
+        telemetry_counter = 0;
+        telemetry.sample();
+    }
+#endif
 }
 
 /**
@@ -0,0 +1,278 @@
+/*
+ * Copyright (c) 2021-2024 LAAS-CNRS
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published by
+ *   the Free Software Foundation, either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGLPV2.1
+ */
+
+/**
+ * @brief  Configuration of a node (role, address, gains) kept in flash.
+ *
+ *         The same firmware is flashed on all the nodes of a microgrid; the
+ *         role and the parameters of each node are a struct of the example,
+ *         stored in flash by the settings subsystem of Zephyr (NVS backend,
+ *         see app.conf). The struct is read once by `load()` in
+ *         `setup_routine()`; the code, the critical task included, reads
+ *         the copy in RAM, `config.values.xxx`, which costs no more than a
+ *         global variable.
+ *
+ *         Each field editable from the serial menu is described by a
+ *         `config_field`: name, type, offset in the struct and range.
+ *         `edit()` prints the fields, asks a field and its new value on the
+ *         console, then asks whether to write them to flash. A field marked
+ *         `restart` (the role, the address...) is only taken into account
+ *         by `setup_routine()`, at the next reset.
+ *
+ *         The record in flash starts with a version and the size of the
+ *         struct: a record of another version, e.g. written by a former
+ *         firmware, is ignored and the defaults are used.
+ */
+
+#ifndef NODE_CONFIG_H_
+#define NODE_CONFIG_H_
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arm_math.h" // float32_t
+#include "zephyr/console/console.h"
+#include "zephyr/kernel.h"
+#include "zephyr/settings/settings.h"
+
+#define NODE_CONFIG_SUBTREE "owntech" // settings key: "owntech/<name>"
+#define NODE_CONFIG_LINE 16 // [chars] longest value typed on the console
+
+enum node_config_status
+{
+    NODE_CONFIG_LOADED = 0,   // read from flash
+    NODE_CONFIG_DEFAULTS = 1, // nothing valid in flash
+};
+
+enum config_field_type
+{
+    CONFIG_FIELD_U8 = 0,
+    CONFIG_FIELD_FLOAT,
+};
+
+struct config_field
+{
+    const char *name;
+    uint8_t type;
+    uint16_t offset;  // in the struct of the configuration
+    float32_t min;
+    float32_t max;
+    bool restart;     // used by setup_routine() only
+};
+
+#define CONFIG_U8(type, field, min, max, restart) \
+    { #field, CONFIG_FIELD_U8, offsetof(type, field), min, max, restart }
+#define CONFIG_FLOAT(type, field, min, max, restart) \
+    { #field, CONFIG_FIELD_FLOAT, offsetof(type, field), min, max, restart }
+
+template <typename T>
+class NodeConfig
+{
+public:
+    /**
+     * @param name     key of the record, "owntech/<name>".
+     * @param version  of the struct, to be incremented when it changes.
+     * @param defaults values without record in flash.
+     */
+    NodeConfig(const char *name, uint16_t version, const T &defaults,
+               const config_field *fields, uint8_t nb_fields)
+        : values(defaults), name(name), version(version), defaults(defaults),
+          fields(fields), nb_fields(nb_fields)
+    {
+    }
+
+    /**
+     * @brief read the record, to be called at the beginning of
+     * `setup_routine()`.
+     *
+     * @return NODE_CONFIG_LOADED, NODE_CONFIG_DEFAULTS, or a negative error
+     * of the settings subsystem (the defaults are used).
+     */
+    int load()
+    {
+        values = defaults;
+        int err = settings_subsys_init();
+        if (err) {
+            return err;
+        }
+        found = false;
+        err = settings_load_subtree_direct(NODE_CONFIG_SUBTREE, loadRecord, this);
+        if (err) {
+            return err;
+        }
+        return found ? NODE_CONFIG_LOADED : NODE_CONFIG_DEFAULTS;
+    }
+
+    /**
+     * @brief write the values to flash.
+     *
+     * @return 0 or a negative error.
+     */
+    int save()
+    {
+        char key[32];
+        snprintf(key, sizeof(key), "%s/%s", NODE_CONFIG_SUBTREE, name);
+        record r;
+        r.version = version;
+        r.size = sizeof(T);
+        r.values = values;
+        return settings_save_one(key, &r, sizeof(r));
+    }
+
+    void print()
+    {
+        for (uint8_t k = 0; k < nb_fields; k++) {
+            const config_field &f = fields[k];
+            if (f.type == CONFIG_FIELD_U8) {
+                printk("  %2u %-20s %u", k, f.name, *field<uint8_t>(f));
+            } else {
+                printk("  %2u %-20s %f", k, f.name, (double) *field<float32_t>(f));
+            }
+            printk("%s\n", f.restart ? " (at reset)" : "");
+        }
+        if (restart_pending) {
+            printk("  reset the board to apply the fields marked (at reset)\n");
+        }
+    }
+
+    /**
+     * @brief change the fields from the console, in the communication task.
+     *
+     * @return true if a value changed.
+     */
+    bool edit()
+    {
+        bool changed = false;
+        char line[NODE_CONFIG_LINE];
+        while (1) {
+            print();
+            printk("field (enter to end), d for the defaults: ");
+            readLine(line);
+            if (line[0] == '\0') {
+                break;
+            }
+            if (line[0] == 'd') {
+                values = defaults;
+                changed = true;
+                restart_pending = true;
+                continue;
+            }
+            char *end;
+            long k = strtol(line, &end, 10);
+            if (*end != '\0' || k < 0 || k >= nb_fields) {
+                printk("no field %s\n", line);
+                continue;
+            }
+            const config_field &f = fields[k];
+            printk("%s [%g, %g]: ", f.name, (double) f.min, (double) f.max);
+            readLine(line);
+            float32_t value = strtof(line, &end);
+            if (line[0] == '\0' || *end != '\0' || value < f.min || value > f.max) {
+                printk("out of range, not changed\n");
+                continue;
+            }
+            if (f.type == CONFIG_FIELD_U8) {
+                *field<uint8_t>(f) = (uint8_t) value;
+            } else {
+                *field<float32_t>(f) = value;
+            }
+            changed = true;
+            restart_pending |= f.restart;
+        }
+
+        if (changed) {
+            printk("w to write to flash, any other key to keep until the next reset\n");
+            if (console_getchar() == 'w') {
+                int err = save();
+                printk(err ? "write error %d\n" : "written\n", err);
+            }
+        }
+        return changed;
+    }
+
+    bool needsRestart() { return restart_pending; }
+
+    T values; // read by the code
+
+private:
+    struct record
+    {
+        uint16_t version;
+        uint16_t size;
+        T values;
+    };
+
+    template <typename F>
+    F *field(const config_field &f)
+    {
+        return reinterpret_cast<F *>(reinterpret_cast<uint8_t *>(&values) + f.offset);
+    }
+
+    static int loadRecord(const char *key, size_t len, settings_read_cb read_cb,
+                          void *cb_arg, void *param)
+    {
+        NodeConfig *self = static_cast<NodeConfig *>(param);
+        const char *next;
+        if (!settings_name_steq(key, self->name, &next) || next != nullptr) {
+            return 0;
+        }
+        record r;
+        if (len != sizeof(r) || read_cb(cb_arg, &r, sizeof(r)) != (ssize_t) sizeof(r)) {
+            return 0;
+        }
+        if (r.version == self->version && r.size == sizeof(T)) {
+            self->values = r.values;
+            self->found = true;
+        }
+        return 0;
+    }
+
+    /* one line of the console, with echo, backspace removes a char */
+    static void readLine(char *line)
+    {
+        uint8_t n = 0;
+        while (1) {
+            char c = console_getchar();
+            if (c == '\r' || c == '\n') {
+                break;
+            }
+            if ((c == '\b' || c == 0x7F) && n > 0) {
+                n--;
+                printk("\b \b");
+            } else if (c >= ' ' && n < NODE_CONFIG_LINE - 1) {
+                line[n++] = c;
+                printk("%c", c);
+            }
+        }
+        line[n] = '\0';
+        printk("\n");
+    }
+
+    const char *name;
+    const uint16_t version;
+    const T defaults;
+    const config_field *fields;
+    const uint8_t nb_fields;
+    bool found = false;
+    bool restart_pending = false;
+};
+
+#endif // NODE_CONFIG_H_
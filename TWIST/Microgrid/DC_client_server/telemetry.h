@@ -0,0 +1,279 @@
+/*
+ * Copyright (c) 2021-2024 LAAS-CNRS
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published by
+ *   the Free Software Foundation, either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGLPV2.1
+ */
+
+/**
+ * @brief  Binary telemetry of a few variables, sent while running.
+ *
+ *         The variables are registered with `connectChannel()`, as for the
+ *         continuous scope: float32, or int16 equal to value * scale.
+ *         `sample()`, called in the critical task, packs one record of all
+ *         the variables in a ring of records:
+ *
+ *         | index (2) | channel 0 | channel 1 | ... |
+ *
+ *         The ring has one writer, the critical task, and one reader, the
+ *         background task, so it needs no lock. When it is full the record
+ *         is dropped and counted, the index of the records shows the gap.
+ *
+ *         `poll()`, called in a background task, copies the records waiting
+ *         in the ring to a SCOPE_FRAME_TELEMETRY frame and sends it with the
+ *         ScopeStream:
+ *
+ *         | nb_lost (4) | records |
+ *
+ *         The frame is copied in the transmit ring of the console and sent by
+ *         the interrupt of the UART. `poll()` puts no more bytes in it than
+ *         the UART has sent since the previous call, from its baudrate, so
+ *         the copy never waits for room: the background task is not blocked
+ *         by the transmission. When the records come faster than the UART
+ *         sends them, they wait in the ring of records, then are dropped.
+ *
+ *         A SCOPE_FRAME_TELEMETRY_INFO frame, a `scope_stream_info` where
+ *         nb_samples is the number of records per frame and nb_bytes the
+ *         size of a record, followed by the names and formats, is sent at
+ *         the start then every TELEMETRY_INFO_PERIOD frames, so the host can
+ *         start decoding at any time.
+ */
+
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+#include "zephyr/kernel.h"
+#include "zephyr/drivers/uart.h"
+
+#include "scope_stream.h"
+
+#define TELEMETRY_FRAME_SIZE 512 // [bytes] payload of a frame
+#define TELEMETRY_INFO_PERIOD 32  // frames between two info frames
+#define TELEMETRY_BYTES_PER_MS 11 // [bytes] sent by a 115200 bit/s UART, if its rate is unknown
+// [bytes] at most in the ring of the console at a time, one frame
+#define TELEMETRY_CREDIT_MAX (TELEMETRY_FRAME_SIZE + sizeof(scope_frame_header))
+
+#ifdef CONFIG_CONSOLE_PUTCHAR_BUFSIZE
+static_assert(TELEMETRY_CREDIT_MAX <= CONFIG_CONSOLE_PUTCHAR_BUFSIZE,
+              "a telemetry frame must fit in the ring of the console");
+#endif
+
+template <uint16_t NB_RECORDS, uint8_t MAX_CHANNEL>
+class Telemetry
+{
+    static_assert((NB_RECORDS & (NB_RECORDS - 1)) == 0, "NB_RECORDS must be a power of 2");
+    static_assert(NB_RECORDS <= 32768, "the indexes of the ring are 16 bits");
+    static_assert(sizeof(scope_stream_info) + 1 + MAX_CHANNEL * (1 + SCOPE_FORMAT_SIZE)
+                  <= TELEMETRY_FRAME_SIZE,
+                  "no room for the separators and the formats of the channels");
+
+public:
+    /**
+     * @brief add a variable, to be called before the first `sample()`.
+     *
+     * @param scale 0 to send the float32 value, otherwise the value is sent
+     *              as an int16 equal to value * scale, saturated.
+     */
+    void connectChannel(float32_t &channel, const char *name, float32_t scale = 0.0F)
+    {
+        if (nb_channel >= MAX_CHANNEL) {
+            return;
+        }
+        scope_channel &ch = channels[nb_channel++];
+        ch.value = &channel;
+        ch.name = name;
+        ch.offset = record_size;
+        ch.format = scale != 0.0F ? SCOPE_FORMAT_INT16 : SCOPE_FORMAT_FLOAT32;
+        ch.scale = scale != 0.0F ? scale : 1.0F;
+        record_size += scale != 0.0F ? sizeof(int16_t) : sizeof(float32_t);
+    }
+
+    /**
+     * @brief record all the variables, in the critical task.
+     */
+    void sample()
+    {
+        uint16_t index = record_index++;
+        if ((uint16_t) (head - tail) >= NB_RECORDS) {
+            nb_lost++;
+            return;
+        }
+        uint8_t *record = ring[head & (NB_RECORDS - 1)];
+        memcpy(record, &index, sizeof(index));
+        for (uint8_t k = 0; k < nb_channel; k++) {
+            const scope_channel &ch = channels[k];
+            if (ch.format == SCOPE_FORMAT_INT16) {
+                int16_t packed = pack(*ch.value * ch.scale);
+                memcpy(record + ch.offset, &packed, sizeof(packed));
+            } else {
+                memcpy(record + ch.offset, ch.value, sizeof(float32_t));
+            }
+        }
+        __atomic_signal_fence(__ATOMIC_SEQ_CST); // record written before it is counted
+        head++;
+    }
+
+    /**
+     * @brief send the waiting records, in a background task.
+     *
+     * @param decimation number of control periods between two records.
+     * @param period_us  [us] period of the control task.
+     * @return false if the stream was busy, nothing was sent.
+     */
+    bool poll(ScopeStream &stream, uint16_t decimation, uint32_t period_us)
+    {
+        if (stream.isBusy()) {
+            return false;
+        }
+        // the bytes sent by the UART since the previous call
+        uint32_t now = k_uptime_get_32();
+        credit += (now - last_poll) * bytesPerMs();
+        credit = credit < TELEMETRY_CREDIT_MAX ? credit : TELEMETRY_CREDIT_MAX;
+        last_poll = now;
+
+        if (nb_frames % TELEMETRY_INFO_PERIOD == 0) {
+            uint16_t length = setInfo(decimation, period_us);
+            if (credit < sizeof(scope_frame_header) + length) {
+                return true; // sent at a next call
+            }
+            if (!stream.send(SCOPE_FRAME_TELEMETRY_INFO, frame, length)) {
+                return false;
+            }
+            credit -= sizeof(scope_frame_header) + length;
+            nb_frames++;
+            return true;
+        }
+
+        __atomic_signal_fence(__ATOMIC_SEQ_CST);
+        uint16_t nb_records = head - tail;
+        uint32_t room = credit > sizeof(scope_frame_header) + sizeof(uint32_t)
+                      ? (credit - sizeof(scope_frame_header) - sizeof(uint32_t)) / record_size
+                      : 0;
+        if (nb_records > recordsPerFrame()) {
+            nb_records = recordsPerFrame();
+        }
+        if (nb_records > room) {
+            nb_records = room;
+        }
+        if (nb_records == 0) {
+            return true;
+        }
+        uint32_t lost = nb_lost;
+        memcpy(frame, &lost, sizeof(lost));
+        uint8_t *records = frame + sizeof(lost);
+        for (uint16_t k = 0; k < nb_records; k++) {
+            memcpy(records + k * record_size, ring[(tail + k) & (NB_RECORDS - 1)], record_size);
+        }
+        uint16_t length = sizeof(lost) + nb_records * record_size;
+        if (!stream.send(SCOPE_FRAME_TELEMETRY, frame, length)) {
+            return false;
+        }
+        __atomic_signal_fence(__ATOMIC_SEQ_CST); // records copied before they are freed
+        tail += nb_records;
+        credit -= sizeof(scope_frame_header) + length;
+        nb_frames++;
+        return true;
+    }
+
+    /**
+     * @brief drop the waiting records, as if they were sent: lets a benchmark
+     * sample without a background task to poll.
+     */
+    void discard()
+    {
+        __atomic_signal_fence(__ATOMIC_SEQ_CST);
+        tail = head;
+    }
+
+    uint32_t getNbLost() { return nb_lost; }
+
+private:
+    static const uint16_t RECORD_MAX_SIZE = sizeof(uint16_t) + MAX_CHANNEL * sizeof(float32_t);
+
+    uint16_t recordsPerFrame() { return (TELEMETRY_FRAME_SIZE - sizeof(uint32_t)) / record_size; }
+
+    /* [bytes] sent per ms by the console UART, 10 bits per byte */
+    uint32_t bytesPerMs()
+    {
+        if (bytes_per_ms == 0) {
+            struct uart_config config;
+            const struct device *uart = DEVICE_DT_GET(DT_CHOSEN(zephyr_console));
+            bytes_per_ms = TELEMETRY_BYTES_PER_MS;
+            if (uart_config_get(uart, &config) == 0 && config.baudrate >= 10000) {
+                bytes_per_ms = config.baudrate / 10000;
+            }
+        }
+        return bytes_per_ms;
+    }
+
+    uint16_t setInfo(uint16_t decimation, uint32_t period_us)
+    {
+        scope_stream_info info;
+        info.version = SCOPE_STREAM_VERSION;
+        info.nb_channel = nb_channel;
+        info.nb_samples = recordsPerFrame();
+        info.decimation = decimation;
+        info.period_us = period_us;
+        info.nb_bytes = record_size;
+        memcpy(frame, &info, sizeof(info));
+        uint16_t length = sizeof(info);
+        // the names are cut so that the ',' of each of them, the '\0' and the
+        // formats always fit
+        uint16_t names_room = TELEMETRY_FRAME_SIZE - sizeof(info) - 1
+                            - nb_channel * (1 + SCOPE_FORMAT_SIZE);
+        for (uint8_t k = 0; k < nb_channel; k++) {
+            const char *name = channels[k].name;
+            while (*name != '\0' && names_room > 0) {
+                frame[length++] = *name++;
+                names_room--;
+            }
+            frame[length++] = ',';
+        }
+        frame[length++] = '\0';
+        for (uint8_t k = 0; k < nb_channel; k++) {
+            frame[length++] = channels[k].format;
+            memcpy(frame + length, &channels[k].scale, sizeof(float32_t));
+            length += sizeof(float32_t);
+        }
+        return length;
+    }
+
+    static int16_t pack(float32_t value)
+    {
+        if (value >= 32767.0F) {
+            return 32767;
+        }
+        if (value <= -32768.0F) {
+            return -32768;
+        }
+        return (int16_t) (value + (value >= 0.0F ? 0.5F : -0.5F));
+    }
+
+    scope_channel channels[MAX_CHANNEL];
+    uint8_t nb_channel = 0;
+    uint16_t record_size = sizeof(uint16_t); // [bytes] index and channels
+    uint8_t ring[NB_RECORDS][RECORD_MAX_SIZE] __attribute__((aligned(4)));
+    volatile uint16_t head = 0; // written by the critical task
+    volatile uint16_t tail = 0; // written by the background task
+    uint16_t record_index = 0;
+    volatile uint32_t nb_lost = 0;
+    uint32_t nb_frames = 0;
+    uint32_t credit = 0;    // [bytes] that can be put in the ring of the console
+    uint32_t last_poll = 0; // [ms]
+    uint32_t bytes_per_ms = 0;
+    uint8_t frame[TELEMETRY_FRAME_SIZE] __attribute__((aligned(4)));
+};
+
+#endif // TELEMETRY_H_
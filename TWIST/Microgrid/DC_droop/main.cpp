@@ -35,6 +35,9 @@
 #include "TwistAPI.h"
 #include "SpinAPI.h"
 #include "pid.h"
+#include "rs485_frame.h"
+#include "secondary_control.h"
+#include "node_config.h"
 
 #include "zephyr/console/console.h"
 
@@ -64,42 +67,70 @@ static float32_t V_high;
 int count = 0;
 static float meas_data; // temp storage meas value (ctrl task)
 
-//Define for selecting the card to be flashed 
-#define DROOP1
+/* Configuration of the card, kept in flash: the same firmware is flashed
+ * on all the cards, the address and the droop coefficient are set from the
+ * serial menu (c) */
+struct droop_config
+{
+    uint8_t address;       // 0 is the coordinator of the secondary control
+    uint8_t nb_nodes;      // cards on the RS485
+    float32_t coef_droop;  // [V/A]
+    float32_t reference;   // [V] at no load
+    float32_t kp;
+    float32_t Ti;
+    float32_t T_voltage;   // [s] restoration of the bus voltage
+    float32_t T_sharing;   // [s] balance of the currents
+    float32_t max_shift;   // [V]
+};
 
-// Droop coeficient configuration 
-#ifdef DROOP
-static float32_t coef_droop = 1.2;
-#define ROLE_TXT "DROOP"
-#endif
-#ifdef DROOP1
-static float32_t coef_droop1 = 1.1;
-#define ROLE_TXT "DROOP1"
-#endif
-#ifdef DROOP2
-static float32_t coef_droop2 = 1.6;
-#define ROLE_TXT "DROOP2"
-#endif
+#define DROOP_CONFIG_VERSION 1
+static const droop_config config_defaults = {
+    0,          // address
+    3,          // nb_nodes
+    1.1F,       // coef_droop
+    12.0F,      // reference
+    0.000215F,  // kp, PID coefficients for a 8.6ms step response
+    7.5175e-5F, // Ti
+    0.5F,       // T_voltage
+    0.5F,       // T_sharing
+    2.0F,       // max_shift
+};
+static const config_field config_fields[] = {
+    CONFIG_U8(droop_config, address, 0, SECONDARY_MAX_NODES - 1, true),
+    CONFIG_U8(droop_config, nb_nodes, 1, SECONDARY_MAX_NODES, true),
+    CONFIG_FLOAT(droop_config, coef_droop, 0.0F, 10.0F, false),
+    CONFIG_FLOAT(droop_config, reference, 0.0F, 40.0F, false),
+    CONFIG_FLOAT(droop_config, kp, 0.0F, 1.0F, false),
+    CONFIG_FLOAT(droop_config, Ti, 0.0F, 1.0F, false),
+    CONFIG_FLOAT(droop_config, T_voltage, 0.0F, 100.0F, false),
+    CONFIG_FLOAT(droop_config, T_sharing, 0.0F, 100.0F, false),
+    CONFIG_FLOAT(droop_config, max_shift, 0.0F, 10.0F, false),
+};
+static NodeConfig<droop_config> config("droop", DROOP_CONFIG_VERSION, config_defaults,
+                                       config_fields, ARRAY_SIZE(config_fields));
+static char role_txt[8]; // "DROOP<address>"
 
+/* Secondary control: the DROOP card shifts the references of all the cards
+ * over the RS485 to restore the bus voltage and balance the currents */
+#define SECONDARY_CONTROL // Comment to run the local droop only
+static const uint16_t secondary_divider = 10;    // one broadcast every ms
+static Rs485Link link; // frames written and read in the DMA buffers
+static SecondaryControl secondary;
 
 
 
-#if defined(DROOP) || defined(DROOP1) || defined(DROOP2)
-    float32_t duty_cycle = 0.1;
-    static float32_t reference = 12; //current reference 
-    static float32_t serial_step = 0.1; //current reference 
-#endif
 
-/* PID coefficient for a 8.6ms step response*/
+float32_t duty_cycle = 0.1;
+static float32_t reference; //voltage reference, config.values.reference at start
+static float32_t serial_step = 0.1; //voltage reference step
+
+/* PID coefficients in the configuration */
 
-static float32_t kp = 0.000215;
-static float32_t Ti = 7.5175e-5;
 static float32_t Td = 0.0;
 static float32_t N = 0.0;
 static float32_t upper_bound = 1.0F;
 static float32_t lower_bound = 0.0F;
 static float32_t Ts = control_task_period * 1e-6;
-static PidParams pid_params(Ts, kp, Ti, Td, N, lower_bound, upper_bound);
 static Pid pid;
 
 //---------------------------------------------------------------
@@ -113,6 +144,25 @@ enum serial_interface_menu_mode // LIST OF POSSIBLE MODES FOR THE OWNTECH CONVER
 uint8_t mode = IDLEMODE;
 
 //--------------SETUP FUNCTIONS-------------------------------
+
+void reception_function(void)
+{
+    secondary.receive(link.receive());
+}
+
+/* gains of the configuration, at start and after an edit in idle */
+void apply_config()
+{
+    const droop_config &c = config.values;
+    PidParams pid_params(Ts, c.kp, c.Ti, Td, N, lower_bound, upper_bound);
+    pid.init(pid_params);
+    reference = c.reference;
+#ifdef SECONDARY_CONTROL
+    secondary.setGains(c.T_voltage, c.T_sharing, c.max_shift);
+    secondary.setNominal(reference);
+#endif
+}
+
 /**
  * This is the setup routine.
  * It is used to call functions that will initialize your spin, twist, data and/or tasks.
@@ -125,12 +175,21 @@ void setup_routine()
     spin.version.setBoardVersion(SPIN_v_1_0);
     twist.setVersion(shield_TWIST_V1_3);
 
+    // role and gains of this card, from the flash
+    int config_status = config.load();
+    printk("configuration %s\n", config_status == NODE_CONFIG_LOADED ? "loaded" : "by default");
+    snprintf(role_txt, sizeof(role_txt), "DROOP%u", config.values.address);
+
     /* buck voltage mode */
     twist.initAllBuck();
 
     data.enableTwistDefaultChannels();
 
-    pid.init(pid_params);
+#ifdef SECONDARY_CONTROL
+    link.init(config.values.address, reception_function, SPEED_20M);
+    secondary.init(link, config.values.address, config.values.nb_nodes, secondary_divider, Ts);
+#endif
+    apply_config();
 
     // Then declare tasks
     uint32_t app_task_number = task.createBackground(loop_application_task);
@@ -155,11 +214,17 @@ void loop_communication_task()
         case 'h':
             //----------SERIAL INTERFACE MENU-----------------------
             printk(" ________________________________________\n");
-            printk("|     ------- MENU : %s ----             |\n", ROLE_TXT);
+            printk("|     ------- MENU : %s ----             |\n", role_txt);
             printk("|     press i : idle mode                |\n");
             printk("|     press p : power mode               |\n");
             printk("|     press u : vref UP                  |\n");
             printk("|     press d : Vref DOWN                |\n");
+            printk("|     press c : configuration (idle)     |\n");
+#ifdef SECONDARY_CONTROL
+            printk("|     press s : secondary control state  |\n");
+            if (config.values.address == SECONDARY_COORDINATOR)
+                printk("|     press e : secondary control on/off |\n");
+#endif
             printk("|________________________________________|\n\n");
             //------------------------------------------------------
             break;
@@ -174,10 +239,40 @@ void loop_communication_task()
         case 'u':
             
             reference += serial_step;
+            secondary.setNominal(reference);
             break;
         case 'd':
             reference -= serial_step;
+            secondary.setNominal(reference);
+            break;
+        case 'c':
+            if (mode == IDLEMODE) {
+                if (config.edit())
+                    apply_config();
+            } else {
+                printk("configuration in idle mode only\n");
+            }
+            break;
+#ifdef SECONDARY_CONTROL
+        case 's':
+            printk("secondary %s: shift %.3f V, %u broadcasts, %u reports\n",
+                   secondary.isEnabled() ? "on" : "off", secondary.getShift(),
+                   secondary.getNbBroadcasts(), secondary.getNbReports());
+            if (config.values.address == SECONDARY_COORDINATOR) {
+                printk("  restoration %.3f V\n", secondary.getRestoration());
+                for (uint8_t k = 0; k < config.values.nb_nodes; k++)
+                    printk("  node %u: shift %.3f V\n", k, secondary.getShift(k));
+            }
+            printk("  link: %u received, %u errors, %u lost\n", link.getNbReceived(),
+                   link.getNbErrors(), link.getNbLost());
             break;
+        case 'e':
+            if (config.values.address == SECONDARY_COORDINATOR) {
+                secondary.enable(!secondary.isEnabled());
+                printk("secondary control %s\n", secondary.isEnabled() ? "on" : "off");
+            }
+            break;
+#endif
         default:
             break;
         }
@@ -208,6 +303,7 @@ void loop_application_task()
     printk("%.2f:", V2_low_value);
     printk("%.2f:", I2_low_value);
     printk("%.2f:", reference);
+    printk("%.2f:", secondary.getShift());
     printk("%.2f\n", I1_low_value+I2_low_value);
 
     task.suspendBackgroundMs(100);
@@ -245,6 +341,13 @@ void loop_critical_task()
     if (meas_data != -10000)
         V_high = meas_data;
 
+    float32_t droop = (I1_low_value+I2_low_value)*config.values.coef_droop;
+
+    // slow secondary loop: measures sent to the coordinator, shift received
+#ifdef SECONDARY_CONTROL
+    secondary.tick(V1_low_value, droop, mode == POWERMODE);
+#endif
+
     if (mode == IDLEMODE)
     {
         pwm_enable = false;
@@ -258,21 +361,9 @@ void loop_critical_task()
             twist.startAll();
         }
 
-        #ifdef DROOP
-            float Vref_droop = reference - (I1_low_value+I2_low_value)*coef_droop;
-
-            duty_cycle = pid.calculateWithReturn(Vref_droop, V1_low_value); 
-        #endif
-
-        #ifdef DROOP1
-            float Vref_droop = reference - (I1_low_value+I2_low_value)*coef_droop1;
-            duty_cycle = pid.calculateWithReturn(Vref_droop, V1_low_value);
-        #endif
-
-        #ifdef DROOP2
-            float Vref_droop = reference - (I1_low_value+I2_low_value)*coef_droop2;
-            duty_cycle = pid.calculateWithReturn(Vref_droop, V1_low_value);  
-        #endif
+        // fast local droop, with the shift of the secondary control
+        float Vref_droop = reference + secondary.getShift() - droop;
+        duty_cycle = pid.calculateWithReturn(Vref_droop, V1_low_value);
 
         twist.setAllDutyCycle(duty_cycle);
 
@@ -0,0 +1,200 @@
+/*
+ * Copyright (c) 2021-2024 LAAS-CNRS
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published by
+ *   the Free Software Foundation, either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGLPV2.1
+ */
+
+/**
+ * @brief  Framing of the RS485 messages between the nodes of a microgrid.
+ *
+ *         The RS485 DMA sends and receives frames of a fixed size, the frame
+ *         is made of an 8 bytes header and a payload:
+ *
+ *             | version | type | dst | src | seq | length | crc16 | payload |
+ *
+ *         - `version` of the framing, frames of another version are dropped,
+ *         - `type` of the message, several messages share the link,
+ *         - `dst` address of the node, or RS485_BROADCAST for all the nodes,
+ *         - `src` address of the sender,
+ *         - `seq` sequence number, incremented at each frame of a sender,
+ *           a gap gives the number of lost frames,
+ *         - `length` of the payload used by the message,
+ *         - `crc16` CRC-16/CCITT (zephyr `crc16_itu_t()`, polynomial
+ *           0x1021, seed 0xFFFF) of the header and of the `length` bytes
+ *           of the payload.
+ *
+ *         The frames are the DMA buffers themselves: the payload is written
+ *         in place in the transmission buffer with `txPayload<T>()` and read
+ *         in place in the reception buffer with `rxPayload<T>()`, nothing is
+ *         copied. The destination is checked first, a node drops the frames
+ *         of the other nodes without computing their CRC.
+ *
+ *         The reception buffer is written by the DMA at each frame: the
+ *         payload must be read in the reception callback.
+ */
+
+#ifndef RS485_FRAME_H_
+#define RS485_FRAME_H_
+
+#include <stddef.h>
+
+#include "CommunicationAPI.h"
+#include "zephyr/sys/crc.h"
+
+#define RS485_FRAME_VERSION 1
+#define RS485_BROADCAST 0xFF
+#define RS485_MAX_NODES 16 // addresses from 0 to RS485_MAX_NODES - 1
+#define RS485_NO_MESSAGE 0 // type returned when no valid frame is received
+
+#ifndef RS485_PAYLOAD_SIZE
+#define RS485_PAYLOAD_SIZE 16 // [bytes] 24 bytes frames, 12 us at 20 Mbit/s
+#endif
+
+struct rs485_header
+{
+    uint8_t version;
+    uint8_t type;
+    uint8_t dst;
+    uint8_t src;
+    uint8_t seq;
+    uint8_t length;
+    uint16_t crc;
+};
+
+struct __attribute__((aligned(4))) rs485_frame
+{
+    rs485_header header;
+    uint8_t payload[RS485_PAYLOAD_SIZE];
+};
+
+class Rs485Link
+{
+public:
+    /**
+     * @brief configure the RS485 with the buffers of the link.
+     *
+     * @param address   address of this node.
+     * @param reception callback of the RS485, it calls `receive()`.
+     * @param speed     speed of the link, SPEED_20M for example.
+     */
+    void init(uint8_t address, void (*reception)(void), rs485_speed_t speed)
+    {
+        this->address = address;
+        seq = 0;
+        for (uint8_t k = 0; k < RS485_MAX_NODES; k++) {
+            last_seq[k] = 0;
+            seq_known[k] = false;
+        }
+        nb_received = 0;
+        nb_errors = 0;
+        nb_lost = 0;
+        communication.rs485.configure((uint8_t *) &tx, (uint8_t *) &rx,
+                                      sizeof(rs485_frame), reception, speed);
+    }
+
+    /**
+     * @brief prepare a message in the transmission buffer.
+     *
+     * @return the payload to fill before `send()`.
+     */
+    template <typename T>
+    T &txPayload(uint8_t type, uint8_t dst)
+    {
+        static_assert(sizeof(T) <= RS485_PAYLOAD_SIZE, "payload too large for the frame");
+        tx.header.version = RS485_FRAME_VERSION;
+        tx.header.type = type;
+        tx.header.dst = dst;
+        tx.header.src = address;
+        tx.header.length = sizeof(T);
+        return *reinterpret_cast<T *>(tx.payload);
+    }
+
+    /**
+     * @brief number the prepared message, compute its CRC and send it.
+     */
+    void send()
+    {
+        tx.header.seq = seq++;
+        tx.header.crc = crc(tx);
+        communication.rs485.startTransmission();
+    }
+
+    /**
+     * @brief check the received frame, to be called in the reception callback.
+     *
+     * @return its type, or RS485_NO_MESSAGE if it is not for this node or
+     * not valid.
+     */
+    uint8_t receive()
+    {
+        if (rx.header.dst != address && rx.header.dst != RS485_BROADCAST) {
+            return RS485_NO_MESSAGE;
+        }
+        if (rx.header.version != RS485_FRAME_VERSION
+            || rx.header.length > RS485_PAYLOAD_SIZE
+            || rx.header.src >= RS485_MAX_NODES
+            || rx.header.crc != crc(rx)) {
+            nb_errors++;
+            return RS485_NO_MESSAGE;
+        }
+
+        uint8_t src = rx.header.src;
+        if (seq_known[src]) {
+            nb_lost += (uint8_t) (rx.header.seq - last_seq[src] - 1);
+        }
+        last_seq[src] = rx.header.seq;
+        seq_known[src] = true;
+        nb_received++;
+        return rx.header.type;
+    }
+
+    /**
+     * @brief payload of the received frame, valid in the reception callback.
+     */
+    template <typename T>
+    const T &rxPayload()
+    {
+        static_assert(sizeof(T) <= RS485_PAYLOAD_SIZE, "payload too large for the frame");
+        return *reinterpret_cast<const T *>(rx.payload);
+    }
+
+    uint8_t getSource() { return rx.header.src; }
+    uint8_t getAddress() { return address; }
+    uint32_t getNbReceived() { return nb_received; }
+    uint32_t getNbErrors() { return nb_errors; }   // wrong version or CRC
+    uint32_t getNbLost() { return nb_lost; }       // gaps of the sequence numbers
+
+private:
+    /* header without its crc, then the used payload */
+    static uint16_t crc(const rs485_frame &frame)
+    {
+        uint16_t c = crc16_itu_t(0xFFFF, (const uint8_t *) &frame.header,
+                                 offsetof(rs485_header, crc));
+        return crc16_itu_t(c, frame.payload, frame.header.length);
+    }
+
+    rs485_frame tx;
+    rs485_frame rx;
+    uint8_t address;
+    uint8_t seq;
+    uint8_t last_seq[RS485_MAX_NODES];
+    bool seq_known[RS485_MAX_NODES];
+    uint32_t nb_received;
+    uint32_t nb_errors;
+    uint32_t nb_lost;
+};
+
+#endif // RS485_FRAME_H_
@@ -0,0 +1,351 @@
+/*
+ * Copyright (c) 2021-2024 LAAS-CNRS
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published by
+ *   the Free Software Foundation, either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGLPV2.1
+ */
+
+/**
+ * @brief  Secondary control of a DC bus shared by droop controlled nodes.
+ *
+ *         Each node keeps its droop in the critical task:
+ *
+ *             Vref = reference + shift - coef_droop.I
+ *
+ *         The bus voltage sags by coef_droop.I with the load, and the
+ *         sharing depends on the tolerances of the measures and on the
+ *         resistance of the cables. The coordinator, the node of address
+ *         SECONDARY_COORDINATOR, computes a slow `shift` of the reference
+ *         of each node from the measures of all the nodes:
+ *
+ *             restoration += Ts/T_voltage.(V_nominal - mean(V_k))
+ *             balance(k)  += Ts/T_sharing.(mean(D_k) - D_k)
+ *             shift(k)     = restoration + balance(k)
+ *
+ *         D_k = coef_droop.I is the droop of the node k: the nodes share the
+ *         current in the inverse ratio of their droop coefficients when
+ *         their droops are equal. The mean of the balances is removed, it
+ *         does not move the bus voltage. Both loops are integrals, much
+ *         slower than the voltage loops of the nodes.
+ *
+ *         Every `divider` ticks the coordinator broadcasts on the RS485 the
+ *         address of one node and its shift, the node takes its shift and
+ *         replies at once with its measures: one node per broadcast, so the
+ *         replies do not collide, and the frame carries one shift whatever
+ *         the number of nodes. A new shift is computed once all the nodes
+ *         have been polled, with the nodes which replied and are in power
+ *         mode; an idle node gets the restoration only.
+ *
+ *         A node which receives no broadcast for SECONDARY_TIMEOUT rounds
+ *         falls back to its local droop, its shift is 0.
+ */
+
+#ifndef SECONDARY_CONTROL_H_
+#define SECONDARY_CONTROL_H_
+
+#include "zephyr/kernel.h"
+
+#include "rs485_frame.h"
+
+#define SECONDARY_MAX_NODES RS485_MAX_NODES // one shift per frame, any address
+#define SECONDARY_COORDINATOR 0 // address of the coordinator
+#define SECONDARY_TIMEOUT 4 // [rounds] without broadcast before the local droop
+
+enum secondary_message // types of the messages sharing the link
+{
+    MSG_SECONDARY_SHIFTS = 1, // shifts from the coordinator, and the node to poll
+    MSG_SECONDARY_REPORT,     // measures of the polled node
+};
+
+struct secondary_shifts_msg
+{
+    float32_t shift; // [V] of the polled node
+    uint8_t polled;  // address of the node replying to this broadcast
+};
+
+struct secondary_report_msg
+{
+    float32_t voltage; // [V] bus voltage
+    float32_t droop;   // [V] coef_droop.I
+    uint8_t active;    // the node is in power mode
+};
+
+static_assert(sizeof(secondary_shifts_msg) <= RS485_PAYLOAD_SIZE, "shifts too large for a frame");
+
+class SecondaryControl
+{
+public:
+    /**
+     * @param address  address of this node, from 0 to nb_nodes - 1.
+     * @param nb_nodes nodes on the bus, coordinator included.
+     * @param divider  ticks of the critical task between two broadcasts.
+     * @param Ts       [s] period of the critical task.
+     * @return false if nb_nodes or address are out of range, the secondary
+     *         control is then disabled.
+     */
+    bool init(Rs485Link &link, uint8_t address, uint8_t nb_nodes, uint16_t divider, float32_t Ts)
+    {
+        this->link = &link;
+        this->address = address;
+        if (nb_nodes < 1 || nb_nodes > SECONDARY_MAX_NODES || address >= nb_nodes) {
+            printk("secondary control: node %u of %u nodes, %u nodes at most\n",
+                   address, nb_nodes, SECONDARY_MAX_NODES);
+            configured = false;
+            enabled = false;
+            return false;
+        }
+        configured = true;
+        this->nb_nodes = nb_nodes;
+        this->divider = divider ? divider : 1;
+        Ts_round = Ts * this->divider * this->nb_nodes;
+        timeout = (uint32_t) SECONDARY_TIMEOUT * this->divider * this->nb_nodes;
+        reset();
+        return true;
+    }
+
+    /**
+     * @brief time constants of the loops of the coordinator.
+     *
+     * @param max_shift [V] bound of the shift of each node.
+     */
+    void setGains(float32_t T_voltage, float32_t T_sharing, float32_t max_shift)
+    {
+        ki_voltage = T_voltage > 0.0F ? Ts_round / T_voltage : 0.0F;
+        ki_sharing = T_sharing > 0.0F ? Ts_round / T_sharing : 0.0F;
+        this->max_shift = max_shift;
+    }
+
+    /**
+     * @param voltage [V] bus voltage restored by the coordinator.
+     */
+    void setNominal(float32_t voltage) { nominal = voltage; }
+
+    /**
+     * @brief the coordinator broadcasts zero shifts, the nodes run their
+     * local droop only.
+     */
+    void enable(bool on)
+    {
+        enabled = on && configured;
+        if (!enabled) {
+            reset();
+        }
+    }
+
+    bool isEnabled() { return enabled; }
+
+    /**
+     * @brief clear the loops and the counters.
+     */
+    void reset()
+    {
+        restoration = 0.0F;
+        for (uint8_t k = 0; k < SECONDARY_MAX_NODES; k++) {
+            balance[k] = 0.0F;
+            shift[k] = 0.0F;
+            replied[k] = false;
+        }
+        local_shift = 0.0F;
+        ticks = 0;
+        polled = SECONDARY_COORDINATOR;
+        nb_broadcasts = 0;
+        nb_reports = 0;
+    }
+
+    /**
+     * @brief once per tick of the critical task.
+     *
+     * @param voltage [V] bus voltage measured by this node.
+     * @param droop   [V] coef_droop.I of this node.
+     * @param active  the node is in power mode, its measures are used.
+     */
+    void tick(float32_t voltage, float32_t droop, bool active)
+    {
+        this->voltage = voltage;
+        this->droop = droop;
+        this->active = active;
+        if (!configured) {
+            return;
+        }
+        if (address != SECONDARY_COORDINATOR) {
+            // local droop when the coordinator is silent
+            if (ticks < timeout) {
+                ticks++;
+            } else {
+                local_shift = 0.0F;
+            }
+            return;
+        }
+
+        if (++ticks < divider) {
+            return;
+        }
+        ticks = 0;
+        // the coordinator does not poll itself
+        report_voltage[SECONDARY_COORDINATOR] = voltage;
+        report_droop[SECONDARY_COORDINATOR] = droop;
+        replied[SECONDARY_COORDINATOR] = active;
+
+        polled = polled + 1 >= nb_nodes ? 0 : polled + 1;
+        if (polled == SECONDARY_COORDINATOR) {
+            update(); // end of a round
+        }
+        local_shift = shift[SECONDARY_COORDINATOR];
+
+        secondary_shifts_msg &msg =
+            link->txPayload<secondary_shifts_msg>(MSG_SECONDARY_SHIFTS, RS485_BROADCAST);
+        msg.shift = shift[polled];
+        msg.polled = polled == SECONDARY_COORDINATOR ? RS485_BROADCAST : polled;
+        link->send();
+        nb_broadcasts++;
+    }
+
+    /**
+     * @brief a valid frame of `type` is received, in the reception callback.
+     */
+    void receive(uint8_t type)
+    {
+        if (!configured) {
+            return;
+        }
+        if (address == SECONDARY_COORDINATOR) {
+            if (type == MSG_SECONDARY_REPORT && link->getSource() == polled) {
+                const secondary_report_msg &msg = link->rxPayload<secondary_report_msg>();
+                report_voltage[polled] = msg.voltage;
+                report_droop[polled] = msg.droop;
+                replied[polled] = msg.active != 0;
+                nb_reports++;
+            }
+            return;
+        }
+
+        if (type != MSG_SECONDARY_SHIFTS || link->getSource() != SECONDARY_COORDINATOR) {
+            return;
+        }
+        const secondary_shifts_msg &msg = link->rxPayload<secondary_shifts_msg>();
+        ticks = 0; // the coordinator is alive
+        bool reply = msg.polled == address;
+        if (reply) { // our turn: take our shift, reply at once, before the next broadcast
+            local_shift = msg.shift;
+            secondary_report_msg &report =
+                link->txPayload<secondary_report_msg>(MSG_SECONDARY_REPORT, SECONDARY_COORDINATOR);
+            report.voltage = voltage;
+            report.droop = droop;
+            report.active = active;
+            link->send();
+            nb_reports++;
+        }
+    }
+
+    /**
+     * @return [V] shift of the reference of this node.
+     */
+    float32_t getShift() { return local_shift; }
+
+    /**
+     * @return [V] shift of the node k, on the coordinator.
+     */
+    float32_t getShift(uint8_t k) { return shift[k]; }
+
+    float32_t getRestoration() { return restoration; }
+    uint32_t getNbBroadcasts() { return nb_broadcasts; }
+    uint32_t getNbReports() { return nb_reports; } // received by the coordinator, sent by a node
+
+private:
+    /* new shifts, from the active nodes which replied during the round */
+    void update()
+    {
+        float32_t voltage_mean = 0.0F;
+        float32_t droop_mean = 0.0F;
+        uint8_t nb_replied = 0;
+        for (uint8_t k = 0; k < nb_nodes; k++) {
+            if (replied[k]) {
+                voltage_mean += report_voltage[k];
+                droop_mean += report_droop[k];
+                nb_replied++;
+            }
+        }
+
+        if (!enabled || nb_replied == 0) {
+            // no power on the bus: the loops start again from 0
+            restoration = 0.0F;
+            for (uint8_t k = 0; k < nb_nodes; k++) {
+                balance[k] = 0.0F;
+                shift[k] = 0.0F;
+            }
+        } else {
+            voltage_mean /= nb_replied;
+            droop_mean /= nb_replied;
+            restoration = bound(restoration + ki_voltage * (nominal - voltage_mean), max_shift);
+            float32_t balance_mean = 0.0F;
+            for (uint8_t k = 0; k < nb_nodes; k++) {
+                if (replied[k]) {
+                    balance[k] = bound(balance[k] + ki_sharing * (droop_mean - report_droop[k]),
+                                       max_shift);
+                    balance_mean += balance[k];
+                } else {
+                    balance[k] = 0.0F;
+                }
+            }
+            balance_mean /= nb_replied;
+            for (uint8_t k = 0; k < nb_nodes; k++) {
+                if (replied[k]) {
+                    balance[k] -= balance_mean;
+                }
+                shift[k] = bound(restoration + balance[k], max_shift);
+            }
+        }
+        for (uint8_t k = 0; k < nb_nodes; k++) {
+            replied[k] = false;
+        }
+    }
+
+    static float32_t bound(float32_t x, float32_t max)
+    {
+        return x > max ? max : (x < -max ? -max : x);
+    }
+
+    Rs485Link *link = nullptr;
+    uint8_t address = 0;
+    uint8_t nb_nodes = 1;
+    uint16_t divider = 1;
+    float32_t Ts_round = 0.0F; // [s] period of the loops, all the nodes polled
+    uint32_t timeout = 0;      // [ticks]
+    float32_t ki_voltage = 0.0F;
+    float32_t ki_sharing = 0.0F;
+    float32_t max_shift = 0.0F;
+    float32_t nominal = 0.0F;
+    bool enabled = true;
+    bool configured = false; // init() accepted the address and the number of nodes
+
+    volatile float32_t voltage = 0.0F; // latest measures of this node
+    volatile float32_t droop = 0.0F;
+    volatile bool active = false;
+    volatile float32_t local_shift = 0.0F;
+    uint32_t ticks = 0;
+    uint8_t polled = 0;
+
+    // coordinator
+    float32_t report_voltage[SECONDARY_MAX_NODES];
+    float32_t report_droop[SECONDARY_MAX_NODES];
+    volatile bool replied[SECONDARY_MAX_NODES];
+    float32_t restoration = 0.0F;
+    float32_t balance[SECONDARY_MAX_NODES];
+    float32_t shift[SECONDARY_MAX_NODES];
+    uint32_t nb_broadcasts = 0;
+    uint32_t nb_reports = 0;
+};
+
+#endif // SECONDARY_CONTROL_H_